@@ -0,0 +1,130 @@
+/*
+  Copyright 2020 Simon Meaden
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+  of the Software, and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  @author: Simon Meaden
+
+*/
+
+/*
+   Times hid_enumerate_ex() through libudev against the direct sysfs
+   enumerator, and checks that both find the same devices.
+
+   usage: enumerate_benchmark [iterations]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hidapi.h"
+
+static double now_usec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int count_devices(struct hid_device_info *devs)
+{
+	int n = 0;
+	for (; devs; devs = devs->next)
+		n++;
+	return n;
+}
+
+static double time_enumeration(int flags, int iterations)
+{
+	double start = now_usec();
+	int i;
+
+	for (i = 0; i < iterations; i++)
+		hid_free_enumeration(hid_enumerate_ex(0x0, 0x0, flags));
+
+	return (now_usec() - start) / iterations;
+}
+
+/* Returns the number of devices in a with no identical entry in b. */
+static int count_mismatches(struct hid_device_info *a, struct hid_device_info *b)
+{
+	int mismatches = 0;
+
+	for (; a; a = a->next) {
+		struct hid_device_info *d;
+		for (d = b; d; d = d->next) {
+			if (strcmp(a->path, d->path) == 0 &&
+			    a->vendor_id == d->vendor_id &&
+			    a->product_id == d->product_id &&
+			    a->release_number == d->release_number &&
+			    a->interface_number == d->interface_number)
+				break;
+		}
+		if (!d) {
+			printf("  only in one list: %s\n", a->path);
+			mismatches++;
+		}
+	}
+
+	return mismatches;
+}
+
+int main(int argc, char *argv[])
+{
+	int iterations = (argc > 1)? atoi(argv[1]): 200;
+	struct hid_device_info *udev_devs, *sysfs_devs;
+	int mismatches;
+	int i;
+
+	if (iterations <= 0)
+		iterations = 1;
+
+	hid_init();
+
+	udev_devs = hid_enumerate_ex(0x0, 0x0, 0);
+	sysfs_devs = hid_enumerate_ex(0x0, 0x0, HID_ENUMERATE_SYSFS);
+	printf("devices: udev %d, sysfs %d\n",
+	       count_devices(udev_devs), count_devices(sysfs_devs));
+	mismatches = count_mismatches(udev_devs, sysfs_devs) +
+	             count_mismatches(sysfs_devs, udev_devs);
+	hid_free_enumeration(udev_devs);
+	hid_free_enumeration(sysfs_devs);
+
+	/* Warm up the page cache and the cached directory. */
+	for (i = 0; i < 3; i++) {
+		hid_free_enumeration(hid_enumerate_ex(0x0, 0x0, 0));
+		hid_free_enumeration(hid_enumerate_ex(0x0, 0x0, HID_ENUMERATE_SYSFS));
+	}
+
+	printf("%-26s %10s\n", "enumerator", "usec/call");
+	printf("%-26s %10.1f\n", "udev",
+	       time_enumeration(0, iterations));
+	printf("%-26s %10.1f\n", "udev, lazy strings",
+	       time_enumeration(HID_ENUMERATE_LAZY_STRINGS, iterations));
+	printf("%-26s %10.1f\n", "sysfs",
+	       time_enumeration(HID_ENUMERATE_SYSFS, iterations));
+	printf("%-26s %10.1f\n", "sysfs, lazy strings",
+	       time_enumeration(HID_ENUMERATE_SYSFS | HID_ENUMERATE_LAZY_STRINGS, iterations));
+
+	hid_exit();
+
+	return mismatches? 1: 0;
+}
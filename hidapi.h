@@ -40,6 +40,11 @@
 #endif
 
 #define HID_API_EXPORT_CALL HID_API_EXPORT HID_API_CALL /**< API export and call macro*/
+
+/** The largest report descriptor hid_get_report_descriptor() returns. */
+#define HID_API_MAX_REPORT_DESCRIPTOR_SIZE 4096
+/** Returned by hid_read() and hid_read_timeout() for a read ended by hid_cancel_read(). */
+#define HID_READ_CANCELLED -2
 //#define HID_API_EXPORT_CALL
 
 #ifdef __cplusplus
@@ -65,22 +70,34 @@ extern "C" {
 			wchar_t *manufacturer_string;
 			/** Product string */
 			wchar_t *product_string;
-			/** Usage Page for this Device/Interface
-			    (Windows/Mac only). */
+			/** Usage Page for this Device/Interface. Not set by
+			    the libusb implementation unless it is built with
+			    INVASIVE_GET_USAGE. */
 			unsigned short usage_page;
-			/** Usage for this Device/Interface
-			    (Windows/Mac only).*/
+			/** Usage for this Device/Interface, set where
+			    usage_page is.*/
 			unsigned short usage;
 			/** The USB interface which this logical device
 			    represents. Valid on both Linux implementations
 			    in all cases, and valid on the Windows implementation
 			    only if the device contains more than one interface. */
 			int interface_number;
+			/** The bus the device is connected by, one of the
+			    HID_BUS_* values. HID_BUS_UNKNOWN where the
+			    backend can't tell. */
+			int bus_type;
 
 			/** Pointer to the next device */
 			struct hid_device_info *next;
 		};
 
+		/** Values of hid_device_info::bus_type. */
+		#define HID_BUS_UNKNOWN 0x00 /**< The backend can't tell */
+		#define HID_BUS_USB 0x01 /**< USB */
+		#define HID_BUS_BLUETOOTH 0x02 /**< Bluetooth */
+		#define HID_BUS_I2C 0x03 /**< I2C */
+		#define HID_BUS_SPI 0x04 /**< SPI */
+
 
 		/** @brief Initialize the HIDAPI library.
 
@@ -134,6 +151,136 @@ extern "C" {
 		*/
 		struct hid_device_info HID_API_EXPORT * HID_API_CALL hid_enumerate(unsigned short vendor_id, unsigned short product_id);
 
+		/** Flags for hid_enumerate_ex(). */
+		#define HID_ENUMERATE_LAZY_STRINGS 0x01 /**< Leave the string fields NULL */
+		#define HID_ENUMERATE_SYSFS 0x02 /**< Linux only: read sysfs directly instead of using libudev */
+		#define HID_ENUMERATE_PARALLEL 0x04 /**< libusb only: read the strings of several devices at once */
+
+		/** The most worker threads used by #HID_ENUMERATE_PARALLEL. */
+		#define HID_ENUMERATE_MAX_THREADS 8
+
+		/** @brief Enumerate the HID Devices, with options.
+
+			This function behaves like hid_enumerate(), except that
+			@p flags can be used to change what is gathered for each
+			device.
+
+			If #HID_ENUMERATE_LAZY_STRINGS is set then only the cheap
+			fields (path, VID, PID, release and interface number) are
+			filled in and serial_number, manufacturer_string and
+			product_string are left NULL. On backends which have to
+			talk to the device to read its strings this avoids the
+			string descriptor requests entirely. The strings can be
+			fetched later with hid_get_device_info_strings().
+
+			If #HID_ENUMERATE_SYSFS is set the Linux backend reads
+			/sys/class/hidraw directly instead of going through
+			libudev, which is considerably faster on systems with many
+			devices. The result is the same list, although the order
+			follows the directory rather than the udev database.
+
+			If #HID_ENUMERATE_PARALLEL is set the libusb backend reads
+			the string descriptors of up to
+			#HID_ENUMERATE_MAX_THREADS devices at the same time, which
+			hides most of the control transfer latency on slow hubs.
+			The list is in the same order as without the flag.
+
+			Backends for which the strings are cheap may ignore
+			@p flags. #HID_ENUMERATE_SYSFS is ignored by all but the
+			Linux backend and #HID_ENUMERATE_PARALLEL by all but the
+			libusb backend.
+
+			@ingroup API
+			@param vendor_id The Vendor ID (VID) of the types of device
+				to open.
+			@param product_id The Product ID (PID) of the types of
+				device to open.
+			@param flags A combination of the HID_ENUMERATE_* flags.
+
+		    @returns
+		    	This function returns a pointer to a linked list of type
+		    	struct #hid_device, or NULL in the case of failure. Free
+		    	this linked list by calling hid_free_enumeration().
+		*/
+		struct hid_device_info HID_API_EXPORT * HID_API_CALL hid_enumerate_ex(unsigned short vendor_id, unsigned short product_id, int flags);
+
+		/** Fields of hid_enumerate_filter compared by
+			hid_enumerate_filtered(), besides the VID and PID. */
+		#define HID_FILTER_USAGE_PAGE 0x01 /**< Match usage_page */
+		#define HID_FILTER_USAGE 0x02 /**< Match usage */
+		#define HID_FILTER_INTERFACE 0x04 /**< Match interface_number */
+		#define HID_FILTER_BUS_TYPE 0x08 /**< Match bus_type */
+		#define HID_FILTER_SERIAL_PREFIX 0x10 /**< Match the start of the serial number */
+
+		/** Which devices hid_enumerate_filtered() returns. */
+		struct hid_enumerate_filter {
+			/** Vendor ID to match, or 0 for any */
+			unsigned short vendor_id;
+			/** Product ID to match, or 0 for any */
+			unsigned short product_id;
+			/** A combination of the HID_FILTER_* flags, naming the
+			    fields below which are compared. */
+			int match;
+			/** Usage Page of the device's top level collection */
+			unsigned short usage_page;
+			/** Usage of the device's top level collection */
+			unsigned short usage;
+			/** USB interface number */
+			int interface_number;
+			/** One of the HID_BUS_* values */
+			int bus_type;
+			/** The serial number must start with this string */
+			const wchar_t *serial_prefix;
+		};
+
+		/** @brief Enumerate the HID Devices which match a filter.
+
+			This function behaves like hid_enumerate_ex(), except that
+			devices are also compared with the fields of @p filter
+			named in its @c match member. Where the backend can, each
+			field is checked as soon as it is known, so devices which
+			don't match are passed over before their strings, or any
+			other attribute that is slow to read, are fetched.
+
+			The Linux backend reads the usage page and usage from the
+			report descriptor in sysfs, without opening the device.
+			The libusb backend can't read them without detaching the
+			kernel driver, so no device matches a usage filter there.
+			Devices whose bus is HID_BUS_UNKNOWN never match a bus
+			filter.
+
+			A serial number prefix is compared even if
+			#HID_ENUMERATE_LAZY_STRINGS is set, and the serial
+			numbers of the devices which match are then filled in.
+
+			@ingroup API
+			@param filter The devices to return.
+			@param flags A combination of the HID_ENUMERATE_* flags.
+
+		    @returns
+		    	This function returns a pointer to a linked list of type
+		    	struct #hid_device, or NULL if no device matches or in the
+		    	case of failure. Free this linked list by calling
+		    	hid_free_enumeration().
+		*/
+		struct hid_device_info HID_API_EXPORT * HID_API_CALL hid_enumerate_filtered(const struct hid_enumerate_filter *filter, int flags);
+
+		/** @brief Fill in the strings of an enumerated device.
+
+			Reads the serial number, manufacturer and product strings
+			of the device described by @p info, using only its path.
+			Fields which are already set are left untouched, those
+			which are NULL receive newly allocated strings which are
+			freed along with @p info by hid_free_enumeration().
+
+			@ingroup API
+			@param info A device entry returned from hid_enumerate_ex().
+
+			@returns
+				This function returns 0 on success and -1 on error.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_get_device_info_strings(struct hid_device_info *info);
+
 		/** @brief Free an enumeration Linked List
 
 		    This function frees a linked list created by hid_enumerate().
@@ -222,7 +369,8 @@ extern "C" {
 			@returns
 				This function returns the actual number of bytes read and
 				-1 on error. If no packet was available to be read within
-				the timeout period, this function returns 0.
+				the timeout period, this function returns 0, and if the
+				read was ended by hid_cancel_read(), #HID_READ_CANCELLED.
 		*/
 		int HID_API_EXPORT HID_API_CALL hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds);
 
@@ -242,7 +390,9 @@ extern "C" {
 			@returns
 				This function returns the actual number of bytes read and
 				-1 on error. If no packet was available to be read and
-				the handle is in non-blocking mode, this function returns 0.
+				the handle is in non-blocking mode, this function returns 0,
+				and if the read was ended by hid_cancel_read(),
+				#HID_READ_CANCELLED.
 		*/
 		int  HID_API_EXPORT HID_API_CALL hid_read(hid_device *device, unsigned char *data, size_t length);
 
@@ -266,6 +416,136 @@ extern "C" {
 		*/
 		int  HID_API_EXPORT HID_API_CALL hid_set_nonblocking(hid_device *device, int nonblock);
 
+		/** Counters of the reads of a device with a spin budget,
+			see hid_set_spin_budget(). */
+		struct hid_spin_stats {
+			/** Reads which found a report while spinning */
+			unsigned long long spin_hits;
+			/** Reads which spun for the whole budget and then slept */
+			unsigned long long sleeps;
+			/** Microseconds spent spinning, whether or not a report came */
+			unsigned long long spin_us;
+		};
+
+		/** @brief Spin for a report before sleeping in hid_read_timeout().
+
+			With a budget set, a read that would wait first checks for a
+			report without sleeping, over and over, for up to
+			@p microseconds, or the read's own timeout if that is
+			shorter. Only if nothing has come by then does it sleep as
+			usual, for what is left of its timeout. A report that comes
+			while spinning is picked up without the wake up latency of
+			the sleep, at the cost of keeping a CPU busy.
+
+			The Linux backend polls the device without a timeout, the
+			libusb and Mac backends watch the head of the list of
+			received reports and the Windows backend watches the read
+			in progress. Reads with a timeout of 0 never spin.
+
+			The budget can be changed at any time, from any thread.
+
+			@ingroup API
+			@param device A device handle returned from hid_open().
+			@param microseconds The longest a read spins, 0 to never spin.
+
+			@returns
+				This function returns 0 on success and -1 on error.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_set_spin_budget(hid_device *device, int microseconds);
+
+		/** @brief Get the counters of a device's spinning reads.
+
+			The counters start at 0 when the device is opened and count
+			every read since, whatever the budget was. They can be read
+			from any thread while another reads the device.
+
+			@ingroup API
+			@param device A device handle returned from hid_open().
+			@param stats The counters are copied here.
+
+			@returns
+				This function returns 0 on success and -1 on error.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_get_spin_stats(hid_device *device, struct hid_spin_stats *stats);
+
+		/** @brief Get a file descriptor to wait on for input reports.
+
+			The descriptor is readable, for poll(), select() or an event
+			loop, while hid_read() would return without waiting: when a
+			report is waiting, or the device has been disconnected. It
+			belongs to the device and is closed by hid_close(), and must
+			not be read from or written to.
+
+			The Linux backend returns the hidraw descriptor, the libusb
+			and Mac backends a pipe which their read thread keeps in
+			step with the queue of received reports. The Windows backend
+			has none.
+
+			@ingroup API
+			@param device A device handle returned from hid_open().
+
+			@returns
+				This function returns the file descriptor, or -1 on error
+				or if the platform has none.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_get_read_fd(hid_device *device);
+
+		/** @brief Make a read of the device return at once.
+
+			A hid_read() or hid_read_timeout() waiting on another thread
+			returns #HID_READ_CANCELLED straight away, however long its
+			timeout, including -1. If no read is waiting, the next one
+			returns #HID_READ_CANCELLED instead, so a cancel made just
+			before a read starts isn't lost. Several cancels before a
+			read end only that one read.
+
+			The Linux backend adds an eventfd to the poll() of each read,
+			the libusb and Mac backends wake the condition reads wait on
+			and the Windows backend signals an event reads wait on
+			alongside the read in progress.
+
+			This function can be called from any thread.
+
+			@ingroup API
+			@param device A device handle returned from hid_open().
+
+			@returns
+				This function returns 0 on success and -1 on error.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_cancel_read(hid_device *device);
+
+		/** A function hid_set_input_report_callback() passes each input
+			report to, with the context it was given. data is only
+			valid during the call. */
+		typedef void (HID_API_CALL *hid_input_report_callback)(void *context, hid_device *device, const unsigned char *data, size_t length);
+
+		/** @brief Pass each input report of a device to a function
+			rather than queueing it for hid_read().
+
+			The report is passed straight from the buffer it was
+			received into, without being copied or queued. The libusb
+			and Mac backends call the function on their read thread
+			as each report arrives, and reports are no longer queued.
+			The Linux and Windows backends have no read thread, so there
+			the function is called by hid_read() and hid_read_timeout()
+			on the thread reading the device, which return 0 for a report
+			passed to it.
+
+			The function must be quick, and must not read the device or
+			set its callback, but can write to it. Once this returns the
+			previous function is no longer being called.
+
+			@ingroup API
+			@param device A device handle returned from hid_open().
+			@param callback The function, or NULL to go back to
+				queueing reports.
+			@param context Passed to the function.
+
+			@returns
+				This function returns 0 on success and -1 on error.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_set_input_report_callback(hid_device *device, hid_input_report_callback callback, void *context);
+
 		/** @brief Send a Feature report to the device.
 
 			Feature reports are sent over the Control endpoint as a
@@ -319,6 +599,68 @@ extern "C" {
 		*/
 		int HID_API_EXPORT HID_API_CALL hid_get_feature_report(hid_device *device, unsigned char *data, size_t length);
 
+		/** @brief Get the report descriptor of a HID device.
+
+			The descriptor is copied as the device supplies it. Report
+			descriptors are at most HID_API_MAX_REPORT_DESCRIPTOR_SIZE
+			bytes long.
+
+			@ingroup API
+			@param device A device handle returned from hid_open().
+			@param buf The buffer to copy the descriptor into.
+			@param buf_size The size of the buffer in bytes.
+
+			@returns
+				This function returns the number of bytes copied into
+				@p buf, or -1 on error or if the platform can't read
+				the descriptor.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_get_report_descriptor(hid_device *device, unsigned char *buf, size_t buf_size);
+
+		/** @brief Get the Vendor ID and Product ID of an open HID device.
+
+			Lets a caller which opened a device by a remembered path
+			check that the path still leads to the device it expects,
+			as paths are reused when devices are unplugged and others
+			plugged in.
+
+			@ingroup API
+			@param device A device handle returned from hid_open().
+			@param vendor_id Set to the Vendor ID.
+			@param product_id Set to the Product ID.
+
+			@returns
+				This function returns 0 on success and -1 on error.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_get_device_ids(hid_device *device, unsigned short *vendor_id, unsigned short *product_id);
+
+		/** @brief Start closing a HID device, without waiting.
+
+			Stops what the backend runs in the background for the
+			device, without waiting for it to finish, so that
+			hid_close() then has less to wait for. Closing many devices
+			is quicker by calling this for each of them first, so that
+			they all wind down together, then hid_close() for each.
+
+			The libusb backend cancels the device's transfer and the Mac
+			backend stops its run loop, and hid_close() joins the read
+			thread. The Windows backend cancels the pending read,
+			whichever thread started it, and hid_close() waits for the
+			cancel to complete. The Linux backend has nothing running in
+			the background and does nothing.
+
+			This function can be called from any thread, alongside
+			other calls on the device.
+
+			The device shouldn't be read from after this, reads may
+			fail, and it must still be closed with hid_close(). Calling
+			this more than once does nothing more.
+
+			@ingroup API
+			@param device A device handle returned from hid_open().
+		*/
+		void HID_API_EXPORT HID_API_CALL hid_shutdown(hid_device *device);
+
 		/** @brief Close a HID device.
 
 			@ingroup API
@@ -42,6 +42,7 @@
 #include <fcntl.h>
 #include <pthread.h>
 #include <wchar.h>
+#include <time.h>
 
 /* GNU / LibUSB */
 #include <libusb.h>
@@ -173,6 +174,30 @@ struct hid_device_ {
 
 	/* List of received input reports. */
 	struct input_report *input_reports;
+
+	/* Microseconds a read spins before sleeping, and the spin counters.
+	   Accessed atomically, as they are set and read from any thread. */
+	int spin_budget_us;
+	unsigned long long spin_hits;
+	unsigned long long spin_sleeps;
+	unsigned long long spin_ns;
+
+	/* A pipe which holds a byte while a report is waiting or the read
+	   thread has stopped, so the read end can be polled, and whether it
+	   holds one. Written and drained under the mutex. */
+	int read_pipe[2];
+	int read_fd_ready;
+
+	/* Set by hid_cancel_read() under the mutex, and cleared by the read it
+	   ends. */
+	int read_cancelled;
+
+	/* The hid_set_input_report_callback() function and its context, only
+	   set and called under callback_mutex, which is apart from mutex so
+	   that the function can call hid_cancel_read(). */
+	hid_input_report_callback input_callback;
+	void *input_callback_context;
+	pthread_mutex_t callback_mutex;
 };
 
 static libusb_context *usb_context = NULL;
@@ -180,6 +205,26 @@ static libusb_context *usb_context = NULL;
 uint16_t get_usb_code_for_current_locale(void);
 static int return_data(hid_device *dev, unsigned char *data, size_t length);
 
+/* Makes read_pipe readable or not, to match whether hid_read() would return
+   at once, because a report is waiting or the read thread has stopped. Called
+   with the mutex held. */
+static void signal_read_fd(hid_device *dev, int ready)
+{
+	char byte = 0;
+
+	if (dev->read_pipe[0] < 0 || dev->read_fd_ready == ready)
+		return;
+
+	if (ready) {
+		if (write(dev->read_pipe[1], &byte, 1) == 1)
+			dev->read_fd_ready = 1;
+	}
+	else {
+		if (read(dev->read_pipe[0], &byte, 1) == 1)
+			dev->read_fd_ready = 0;
+	}
+}
+
 static hid_device *new_hid_device(void)
 {
 	hid_device *dev = calloc(1, sizeof(hid_device));
@@ -188,16 +233,37 @@ static hid_device *new_hid_device(void)
 	pthread_mutex_init(&dev->mutex, NULL);
 	pthread_cond_init(&dev->condition, NULL);
 	pthread_barrier_init(&dev->barrier, NULL, 2);
+	pthread_mutex_init(&dev->callback_mutex, NULL);
+
+	/* The pipe behind hid_get_read_fd(). */
+	dev->read_fd_ready = 0;
+	if (pipe(dev->read_pipe) == 0) {
+		int i;
+		for (i = 0; i < 2; i++) {
+			fcntl(dev->read_pipe[i], F_SETFL, fcntl(dev->read_pipe[i], F_GETFL) | O_NONBLOCK);
+			fcntl(dev->read_pipe[i], F_SETFD, FD_CLOEXEC);
+		}
+	}
+	else {
+		dev->read_pipe[0] = -1;
+		dev->read_pipe[1] = -1;
+	}
 
 	return dev;
 }
 
 static void free_hid_device(hid_device *dev)
 {
+	if (dev->read_pipe[0] >= 0) {
+		close(dev->read_pipe[0]);
+		close(dev->read_pipe[1]);
+	}
+
 	/* Clean up the thread objects */
 	pthread_barrier_destroy(&dev->barrier);
 	pthread_cond_destroy(&dev->condition);
 	pthread_mutex_destroy(&dev->mutex);
+	pthread_mutex_destroy(&dev->callback_mutex);
 
 	/* Free the device itself */
 	free(dev);
@@ -335,28 +401,16 @@ static inline int libusb_get_string_descriptor(libusb_device_handle *dev,
 #endif
 
 
-/* Get the first language the device says it reports. This comes from
-   USB string #0. */
-static uint16_t get_first_language(libusb_device_handle *dev)
-{
-	uint16_t buf[32];
-	int len;
-
-	/* Get the string from libusb. */
-	len = libusb_get_string_descriptor(dev,
-			0x0, /* String ID */
-			0x0, /* Language */
-			(unsigned char*)buf,
-			sizeof(buf));
-	if (len < 4)
-		return 0x0;
-
-	return buf[1]; /* First two bytes are len and descriptor type. */
-}
-
-static int is_language_supported(libusb_device_handle *dev, uint16_t lang)
+/* Choose the language to read the device's strings in. The current
+   locale's language is used if the device supports it, otherwise the
+   first language the device reports. Both come from USB string #0, so
+   this is a single control transfer, and the result can be reused for
+   every string of the device. Returns 0x0 if the device has no string
+   descriptors. */
+static uint16_t get_usb_language(libusb_device_handle *dev)
 {
 	uint16_t buf[32];
+	uint16_t lang;
 	int len;
 	int i;
 
@@ -369,22 +423,22 @@ static int is_language_supported(libusb_device_handle *dev, uint16_t lang)
 	if (len < 4)
 		return 0x0;
 
-
 	len /= 2; /* language IDs are two-bytes each. */
+	lang = get_usb_code_for_current_locale();
 	/* Start at index 1 because there are two bytes of protocol data. */
 	for (i = 1; i < len; i++) {
 		if (buf[i] == lang)
-			return 1;
+			return lang;
 	}
 
-	return 0;
+	return buf[1];
 }
 
 
 /* This function returns a newly allocated wide string containing the USB
-   device string numbered by the index. The returned string must be freed
-   by using free(). */
-static wchar_t *get_usb_string(libusb_device_handle *dev, uint8_t idx)
+   device string numbered by the index, in the language lang. The returned
+   string must be freed by using free(). */
+static wchar_t *get_usb_string_lang(libusb_device_handle *dev, uint8_t idx, uint16_t lang)
 {
 	char buf[512];
 	int len;
@@ -405,12 +459,6 @@ static wchar_t *get_usb_string(libusb_device_handle *dev, uint8_t idx)
 	char *outptr;
 #endif
 
-	/* Determine which language to use. */
-	uint16_t lang;
-	lang = get_usb_code_for_current_locale();
-	if (!is_language_supported(dev, lang))
-		lang = get_first_language(dev);
-
 	/* Get the string from libusb. */
 	len = libusb_get_string_descriptor(dev,
 			idx,
@@ -477,6 +525,28 @@ err:
 	return str;
 }
 
+/* As get_usb_string_lang(), choosing the language first. */
+static wchar_t *get_usb_string(libusb_device_handle *dev, uint8_t idx)
+{
+	return get_usb_string_lang(dev, idx, get_usb_language(dev));
+}
+
+/* Fill in whichever of the string fields of info are still NULL. The
+   language is only looked up once for all three strings. */
+static void fill_usb_strings(libusb_device_handle *handle,
+	const struct libusb_device_descriptor *desc,
+	struct hid_device_info *info)
+{
+	uint16_t lang = get_usb_language(handle);
+
+	if (!info->serial_number && desc->iSerialNumber > 0)
+		info->serial_number = get_usb_string_lang(handle, desc->iSerialNumber, lang);
+	if (!info->manufacturer_string && desc->iManufacturer > 0)
+		info->manufacturer_string = get_usb_string_lang(handle, desc->iManufacturer, lang);
+	if (!info->product_string && desc->iProduct > 0)
+		info->product_string = get_usb_string_lang(handle, desc->iProduct, lang);
+}
+
 static char *make_path(libusb_device *dev, int interface_number)
 {
 	char str[64];
@@ -518,13 +588,139 @@ int HID_API_EXPORT hid_exit(void)
 	return 0;
 }
 
+/* The string descriptor work for one USB device, used by
+   HID_ENUMERATE_PARALLEL. A composite device has one record per HID
+   interface; these are consecutive in the list, starting at first. */
+struct string_job {
+	libusb_device *dev;
+	struct libusb_device_descriptor desc;
+	struct hid_device_info *first;
+	int count;
+};
+
+struct string_pool {
+	struct string_job *jobs;
+	int num_jobs;
+	int next_job; /* Protected by mutex */
+	pthread_mutex_t mutex;
+};
+
+static void run_string_job(struct string_job *job)
+{
+	libusb_device_handle *handle;
+	struct hid_device_info *info;
+	int i;
+
+	if (libusb_open(job->dev, &handle) < 0)
+		return;
+	fill_usb_strings(handle, &job->desc, job->first);
+	libusb_close(handle);
+
+	/* The other interfaces of the device get copies. */
+	info = job->first;
+	for (i = 1; i < job->count; i++) {
+		info = info->next;
+		if (job->first->serial_number)
+			info->serial_number = wcsdup(job->first->serial_number);
+		if (job->first->manufacturer_string)
+			info->manufacturer_string = wcsdup(job->first->manufacturer_string);
+		if (job->first->product_string)
+			info->product_string = wcsdup(job->first->product_string);
+	}
+}
+
+static void *string_worker(void *param)
+{
+	struct string_pool *pool = param;
+
+	for (;;) {
+		int job;
+
+		pthread_mutex_lock(&pool->mutex);
+		job = pool->next_job++;
+		pthread_mutex_unlock(&pool->mutex);
+
+		if (job >= pool->num_jobs)
+			break;
+		run_string_job(&pool->jobs[job]);
+	}
+
+	return NULL;
+}
+
+/* Run the jobs over at most HID_ENUMERATE_MAX_THREADS threads. Every
+   job writes only to its own records, so the list keeps the order it
+   was built in no matter which thread finishes first. */
+static void run_string_jobs(struct string_job *jobs, int num_jobs)
+{
+	pthread_t threads[HID_ENUMERATE_MAX_THREADS];
+	struct string_pool pool;
+	int num_threads = 0;
+	int i;
+
+	pool.jobs = jobs;
+	pool.num_jobs = num_jobs;
+	pool.next_job = 0;
+	pthread_mutex_init(&pool.mutex, NULL);
+
+	for (i = 0; i < num_jobs && i < HID_ENUMERATE_MAX_THREADS; i++) {
+		if (pthread_create(&threads[num_threads], NULL, string_worker, &pool) == 0)
+			num_threads++;
+	}
+
+	/* If no thread could be started, do the work here. */
+	if (num_threads == 0)
+		string_worker(&pool);
+
+	for (i = 0; i < num_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	pthread_mutex_destroy(&pool.mutex);
+}
+
 struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id, unsigned short product_id)
 {
+	return hid_enumerate_ex(vendor_id, product_id, 0);
+}
+
+struct hid_device_info  HID_API_EXPORT *hid_enumerate_ex(unsigned short vendor_id, unsigned short product_id, int flags)
+{
+	struct hid_enumerate_filter filter;
+
+	memset(&filter, 0, sizeof(filter));
+	filter.vendor_id = vendor_id;
+	filter.product_id = product_id;
+
+	return hid_enumerate_filtered(&filter, flags);
+}
+
+/* Whether a complete record matches the parts of filter which can only be
+   checked once the strings (and usage, if read) are known. */
+static int filter_late_matches(const struct hid_enumerate_filter *filter, const struct hid_device_info *info)
+{
+	if ((filter->match & HID_FILTER_SERIAL_PREFIX) && filter->serial_prefix) {
+		if (!info->serial_number ||
+		    wcsncmp(info->serial_number, filter->serial_prefix, wcslen(filter->serial_prefix)) != 0)
+			return 0;
+	}
+	if ((filter->match & HID_FILTER_USAGE_PAGE) && filter->usage_page != info->usage_page)
+		return 0;
+	if ((filter->match & HID_FILTER_USAGE) && filter->usage != info->usage)
+		return 0;
+	return 1;
+}
+
+struct hid_device_info  HID_API_EXPORT *hid_enumerate_filtered(const struct hid_enumerate_filter *filter, int flags)
+{
+	unsigned short vendor_id = filter->vendor_id;
+	unsigned short product_id = filter->product_id;
 	libusb_device **devs;
 	libusb_device *dev;
 	libusb_device_handle *handle;
 	ssize_t num_devs;
 	int i = 0;
+	struct string_job *jobs = NULL;
+	int num_jobs = 0;
 
 	struct hid_device_info *root = NULL; /* return object */
 	struct hid_device_info *cur_dev = NULL;
@@ -532,12 +728,35 @@ struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id,
 	if(hid_init() < 0)
 		return NULL;
 
+#ifndef INVASIVE_GET_USAGE
+	/* The usage is never read, see INVASIVE_GET_USAGE, so nothing can
+	   match a usage filter. */
+	if (filter->match & (HID_FILTER_USAGE_PAGE | HID_FILTER_USAGE))
+		return NULL;
+#endif
+
+	/* Every device is USB. */
+	if ((filter->match & HID_FILTER_BUS_TYPE) && filter->bus_type != HID_BUS_USB)
+		return NULL;
+
+	/* The serial number is a string descriptor, so it has to be read to
+	   compare it. */
+	if (filter->match & HID_FILTER_SERIAL_PREFIX)
+		flags &= ~HID_ENUMERATE_LAZY_STRINGS;
+
 	num_devs = libusb_get_device_list(usb_context, &devs);
 	if (num_devs < 0)
 		return NULL;
+
+	/* With a parallel enumeration the strings are read after the list is
+	   built, one job per USB device. Lazy strings need no jobs at all. */
+	if ((flags & HID_ENUMERATE_PARALLEL) && !(flags & HID_ENUMERATE_LAZY_STRINGS))
+		jobs = calloc(num_devs, sizeof(struct string_job));
+
 	while ((dev = devs[i++]) != NULL) {
 		struct libusb_device_descriptor desc;
 		struct libusb_config_descriptor *conf_desc = NULL;
+		struct string_job *job = NULL;
 		int j, k;
 		int interface_num = 0;
 
@@ -557,12 +776,14 @@ struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id,
 					if (intf_desc->bInterfaceClass == LIBUSB_CLASS_HID) {
 						interface_num = intf_desc->bInterfaceNumber;
 
-						/* Check the VID/PID against the arguments */
+						/* Check the VID/PID and interface against the filter */
 						if ((vendor_id == 0x0 || vendor_id == dev_vid) &&
-						    (product_id == 0x0 || product_id == dev_pid)) {
+						    (product_id == 0x0 || product_id == dev_pid) &&
+						    (!(filter->match & HID_FILTER_INTERFACE) ||
+						     filter->interface_number == interface_num)) {
 							struct hid_device_info *tmp;
 
-							/* VID/PID match. Create the record. */
+							/* The device matches. Create the record. */
 							tmp = calloc(1, sizeof(struct hid_device_info));
 							if (cur_dev) {
 								cur_dev->next = tmp;
@@ -576,21 +797,30 @@ struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id,
 							cur_dev->next = NULL;
 							cur_dev->path = make_path(dev, interface_num);
 
-							res = libusb_open(dev, &handle);
+							/* Opening the device is only needed for the
+							   strings, which are the expensive part of
+							   enumeration. With lazy strings they are
+							   read later by hid_get_device_info_strings(),
+							   and a parallel enumeration reads them once
+							   the list is complete. */
+							if (jobs) {
+								if (!job) {
+									job = &jobs[num_jobs++];
+									job->dev = dev;
+									job->desc = desc;
+									job->first = cur_dev;
+								}
+								job->count++;
+								res = -1;
+							}
+							else if (flags & HID_ENUMERATE_LAZY_STRINGS)
+								res = -1;
+							else
+								res = libusb_open(dev, &handle);
 
 							if (res >= 0) {
-								/* Serial Number */
-								if (desc.iSerialNumber > 0)
-									cur_dev->serial_number =
-										get_usb_string(handle, desc.iSerialNumber);
-
-								/* Manufacturer and Product strings */
-								if (desc.iManufacturer > 0)
-									cur_dev->manufacturer_string =
-										get_usb_string(handle, desc.iManufacturer);
-								if (desc.iProduct > 0)
-									cur_dev->product_string =
-										get_usb_string(handle, desc.iProduct);
+								/* Serial Number, Manufacturer and Product strings */
+								fill_usb_strings(handle, &desc, cur_dev);
 
 #ifdef INVASIVE_GET_USAGE
 {
@@ -666,6 +896,8 @@ struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id,
 
 							/* Interface Number */
 							cur_dev->interface_number = interface_num;
+
+							cur_dev->bus_type = HID_BUS_USB;
 						}
 					}
 				} /* altsettings */
@@ -674,8 +906,30 @@ struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id,
 		}
 	}
 
+	if (jobs) {
+		run_string_jobs(jobs, num_jobs);
+		free(jobs);
+	}
+
 	libusb_free_device_list(devs, 1);
 
+	/* Drop the records which fail the checks that needed their strings. */
+	if (filter->match & (HID_FILTER_SERIAL_PREFIX | HID_FILTER_USAGE_PAGE | HID_FILTER_USAGE)) {
+		struct hid_device_info **link = &root;
+
+		while (*link) {
+			struct hid_device_info *d = *link;
+			if (filter_late_matches(filter, d)) {
+				link = &d->next;
+			}
+			else {
+				*link = d->next;
+				d->next = NULL;
+				hid_free_enumeration(d);
+			}
+		}
+	}
+
 	return root;
 }
 
@@ -693,6 +947,53 @@ void  HID_API_EXPORT hid_free_enumeration(struct hid_device_info *devs)
 	}
 }
 
+int HID_API_EXPORT hid_get_device_info_strings(struct hid_device_info *info)
+{
+	libusb_device **devs;
+	libusb_device *usb_dev;
+	libusb_device_handle *handle;
+	unsigned int bus, address, interface_num;
+	int res = -1;
+	int d = 0;
+
+	if (!info || !info->path)
+		return -1;
+
+	if(hid_init() < 0)
+		return -1;
+
+	/* The path is made by make_path(), so the bus and address are
+	   enough to find the device again without matching interfaces. */
+	if (sscanf(info->path, "%x:%x:%x", &bus, &address, &interface_num) != 3)
+		return -1;
+
+	if (libusb_get_device_list(usb_context, &devs) < 0)
+		return -1;
+
+	while ((usb_dev = devs[d++]) != NULL) {
+		struct libusb_device_descriptor desc;
+
+		if (libusb_get_bus_number(usb_dev) != bus ||
+		    libusb_get_device_address(usb_dev) != address)
+			continue;
+
+		libusb_get_device_descriptor(usb_dev, &desc);
+
+		if (libusb_open(usb_dev, &handle) < 0)
+			break;
+
+		fill_usb_strings(handle, &desc, info);
+
+		libusb_close(handle);
+		res = 0;
+		break;
+	}
+
+	libusb_free_device_list(devs, 1);
+
+	return res;
+}
+
 hid_device * hid_open(unsigned short vendor_id, unsigned short product_id, const wchar_t *serial_number)
 {
 	struct hid_device_info *devs, *cur_dev;
@@ -729,12 +1030,35 @@ hid_device * hid_open(unsigned short vendor_id, unsigned short product_id, const
 	return handle;
 }
 
+/* Passes a report to the device's input report callback, if it has one,
+   rather than queueing it. Returns 1 if it did. Called on the read thread. */
+static int call_input_callback(hid_device *dev, const unsigned char *data, size_t length)
+{
+	int called = 0;
+
+	if (__atomic_load_n(&dev->input_callback, __ATOMIC_ACQUIRE) == NULL)
+		return 0;
+
+	pthread_mutex_lock(&dev->callback_mutex);
+	if (dev->input_callback) {
+		dev->input_callback(dev->input_callback_context, dev, data, length);
+		called = 1;
+	}
+	pthread_mutex_unlock(&dev->callback_mutex);
+
+	return called;
+}
+
 static void read_callback(struct libusb_transfer *transfer)
 {
 	hid_device *dev = transfer->user_data;
 	int res;
 
-	if (transfer->status == LIBUSB_TRANSFER_COMPLETED) {
+	if (transfer->status == LIBUSB_TRANSFER_COMPLETED &&
+	    call_input_callback(dev, transfer->buffer, transfer->actual_length)) {
+		/* The input report callback had the report, it isn't queued. */
+	}
+	else if (transfer->status == LIBUSB_TRANSFER_COMPLETED) {
 
 		struct input_report *rpt = malloc(sizeof(*rpt));
 		rpt->data = malloc(transfer->actual_length);
@@ -749,6 +1073,7 @@ static void read_callback(struct libusb_transfer *transfer)
 			/* The list is empty. Put it at the root. */
 			dev->input_reports = rpt;
 			pthread_cond_signal(&dev->condition);
+			signal_read_fd(dev, 1);
 		}
 		else {
 			/* Find the end of the list and attach. */
@@ -853,6 +1178,7 @@ static void *read_thread(void *param)
 	   signaled. */
 	pthread_mutex_lock(&dev->mutex);
 	pthread_cond_broadcast(&dev->condition);
+	signal_read_fd(dev, 1);
 	pthread_mutex_unlock(&dev->mutex);
 
 	/* The dev->transfer->buffer and dev->transfer objects are cleaned up
@@ -1063,9 +1389,21 @@ static int return_data(hid_device *dev, unsigned char *data, size_t length)
 	dev->input_reports = rpt->next;
 	free(rpt->data);
 	free(rpt);
+	if (dev->input_reports == NULL && !dev->shutdown_thread && !dev->read_cancelled)
+		signal_read_fd(dev, 0);
 	return len;
 }
 
+/* Helper function, to simplify hid_read(). Ends a read cancelled by
+   hid_cancel_read(). This should be called with dev->mutex locked. */
+static int take_cancel(hid_device *dev)
+{
+	__atomic_store_n(&dev->read_cancelled, 0, __ATOMIC_RELAXED);
+	if (dev->input_reports == NULL && !dev->shutdown_thread)
+		signal_read_fd(dev, 0);
+	return HID_READ_CANCELLED;
+}
+
 static void cleanup_mutex(void *param)
 {
 	hid_device *dev = param;
@@ -1073,9 +1411,61 @@ static void cleanup_mutex(void *param)
 }
 
 
+/* Busy waits without the mutex for up to the device's spin budget, or
+   *milliseconds if that is shorter, until a report is queued, the read is
+   cancelled or the read thread stops. Returns
+   1 if one is, otherwise 0 with the time spent taken off *milliseconds. The
+   list is only peeked at here, the read that follows takes it under the
+   mutex. */
+static int spin_for_report(hid_device *dev, int budget_us, int *milliseconds)
+{
+	struct timespec start, now;
+	long long budget_ns = budget_us * 1000LL;
+	long long elapsed_ns;
+	int ready;
+
+	if (*milliseconds > 0 && *milliseconds * 1000000LL < budget_ns)
+		budget_ns = *milliseconds * 1000000LL;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	do {
+		ready = __atomic_load_n(&dev->input_reports, __ATOMIC_ACQUIRE) != NULL
+		        || __atomic_load_n(&dev->shutdown_thread, __ATOMIC_RELAXED)
+		        || __atomic_load_n(&dev->read_cancelled, __ATOMIC_RELAXED);
+		if (!ready) {
+#if defined(__x86_64__) || defined(__i386__)
+			__builtin_ia32_pause();
+#elif defined(__aarch64__)
+			__asm__ __volatile__("yield");
+#endif
+		}
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		elapsed_ns = (now.tv_sec - start.tv_sec) * 1000000000LL
+		             + (now.tv_nsec - start.tv_nsec);
+	} while (!ready && elapsed_ns < budget_ns);
+
+	__atomic_fetch_add(&dev->spin_ns, elapsed_ns, __ATOMIC_RELAXED);
+
+	if (ready) {
+		if (__atomic_load_n(&dev->input_reports, __ATOMIC_ACQUIRE) != NULL)
+			__atomic_fetch_add(&dev->spin_hits, 1, __ATOMIC_RELAXED);
+		return 1;
+	}
+
+	__atomic_fetch_add(&dev->spin_sleeps, 1, __ATOMIC_RELAXED);
+	if (*milliseconds > 0) {
+		*milliseconds -= (int) (elapsed_ns / 1000000);
+		if (*milliseconds < 0)
+			*milliseconds = 0;
+	}
+	return 0;
+}
+
 int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds)
 {
 	int bytes_read = -1;
+	int budget_us = __atomic_load_n(&dev->spin_budget_us, __ATOMIC_RELAXED);
 
 #if 0
 	int transferred;
@@ -1084,9 +1474,18 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 	return transferred;
 #endif
 
+	if (milliseconds != 0 && budget_us > 0)
+		spin_for_report(dev, budget_us, &milliseconds);
+
 	pthread_mutex_lock(&dev->mutex);
 	pthread_cleanup_push(&cleanup_mutex, dev);
 
+	/* hid_cancel_read() was called before this read. */
+	if (dev->read_cancelled) {
+		bytes_read = take_cancel(dev);
+		goto ret;
+	}
+
 	/* There's an input report queued up. Return it. */
 	if (dev->input_reports) {
 		/* Return the first one */
@@ -1103,10 +1502,13 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 
 	if (milliseconds == -1) {
 		/* Blocking */
-		while (!dev->input_reports && !dev->shutdown_thread) {
+		while (!dev->input_reports && !dev->shutdown_thread && !dev->read_cancelled) {
 			pthread_cond_wait(&dev->condition, &dev->mutex);
 		}
-		if (dev->input_reports) {
+		if (dev->read_cancelled) {
+			bytes_read = take_cancel(dev);
+		}
+		else if (dev->input_reports) {
 			bytes_read = return_data(dev, data, length);
 		}
 	}
@@ -1125,6 +1527,10 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 		while (!dev->input_reports && !dev->shutdown_thread) {
 			res = pthread_cond_timedwait(&dev->condition, &dev->mutex, &ts);
 			if (res == 0) {
+				if (dev->read_cancelled) {
+					bytes_read = take_cancel(dev);
+					break;
+				}
 				if (dev->input_reports) {
 					bytes_read = return_data(dev, data, length);
 					break;
@@ -1170,6 +1576,52 @@ int HID_API_EXPORT hid_set_nonblocking(hid_device *dev, int nonblock)
 	return 0;
 }
 
+int HID_API_EXPORT hid_set_spin_budget(hid_device *dev, int microseconds)
+{
+	if (microseconds < 0)
+		return -1;
+
+	__atomic_store_n(&dev->spin_budget_us, microseconds, __ATOMIC_RELAXED);
+	return 0;
+}
+
+int HID_API_EXPORT hid_get_spin_stats(hid_device *dev, struct hid_spin_stats *stats)
+{
+	if (!stats)
+		return -1;
+
+	stats->spin_hits = __atomic_load_n(&dev->spin_hits, __ATOMIC_RELAXED);
+	stats->sleeps = __atomic_load_n(&dev->spin_sleeps, __ATOMIC_RELAXED);
+	stats->spin_us = __atomic_load_n(&dev->spin_ns, __ATOMIC_RELAXED) / 1000;
+	return 0;
+}
+
+int HID_API_EXPORT hid_cancel_read(hid_device *dev)
+{
+	pthread_mutex_lock(&dev->mutex);
+	__atomic_store_n(&dev->read_cancelled, 1, __ATOMIC_RELAXED);
+	pthread_cond_broadcast(&dev->condition);
+	signal_read_fd(dev, 1);
+	pthread_mutex_unlock(&dev->mutex);
+
+	return 0;
+}
+
+int HID_API_EXPORT hid_set_input_report_callback(hid_device *dev, hid_input_report_callback callback, void *context)
+{
+	pthread_mutex_lock(&dev->callback_mutex);
+	dev->input_callback_context = context;
+	__atomic_store_n(&dev->input_callback, callback, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&dev->callback_mutex);
+
+	return 0;
+}
+
+int HID_API_EXPORT hid_get_read_fd(hid_device *dev)
+{
+	return dev->read_pipe[0];
+}
+
 
 int HID_API_EXPORT hid_send_feature_report(hid_device *dev, const unsigned char *data, size_t length)
 {
@@ -1231,15 +1683,58 @@ int HID_API_EXPORT hid_get_feature_report(hid_device *dev, unsigned char *data,
 	return res;
 }
 
+int HID_API_EXPORT hid_get_device_ids(hid_device *dev, unsigned short *vendor_id, unsigned short *product_id)
+{
+	struct libusb_device_descriptor desc;
 
-void HID_API_EXPORT hid_close(hid_device *dev)
+	if (libusb_get_device_descriptor(libusb_get_device(dev->device_handle), &desc) < 0)
+		return -1;
+
+	*vendor_id = desc.idVendor;
+	*product_id = desc.idProduct;
+	return 0;
+}
+
+int HID_API_EXPORT hid_get_report_descriptor(hid_device *dev, unsigned char *buf, size_t buf_size)
+{
+	int res;
+
+	/* The interface is already claimed by hid_open_path(), so unlike
+	   INVASIVE_GET_USAGE this doesn't detach the kernel driver. */
+	res = libusb_control_transfer(dev->device_handle,
+		LIBUSB_ENDPOINT_IN|LIBUSB_RECIPIENT_INTERFACE,
+		LIBUSB_REQUEST_GET_DESCRIPTOR,
+		LIBUSB_DT_REPORT << 8,
+		dev->interface,
+		buf, buf_size,
+		5000/*timeout millis*/);
+
+	if (res < 0) {
+		LOG("libusb_control_transfer() for getting the HID report descriptor failed with %d\n", res);
+		return -1;
+	}
+
+	return res;
+}
+
+
+void HID_API_EXPORT hid_shutdown(hid_device *dev)
 {
 	if (!dev)
 		return;
 
-	/* Cause read_thread() to stop. */
+	/* Cause read_thread() to stop. Cancelling a transfer a second time
+	   fails, but that's OK. */
 	dev->shutdown_thread = 1;
 	libusb_cancel_transfer(dev->transfer);
+}
+
+void HID_API_EXPORT hid_close(hid_device *dev)
+{
+	if (!dev)
+		return;
+
+	hid_shutdown(dev);
 
 	/* Wait for read_thread() to end. */
 	pthread_join(dev->thread, NULL);
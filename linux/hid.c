@@ -28,6 +28,8 @@
 #include <locale.h>
 #include <errno.h>
 #include <wchar.h>
+#include <limits.h>
+#include <time.h>
 
 /* Unix */
 #include <unistd.h>
@@ -35,8 +37,11 @@
 #include <sys/stat.h>
 #include <sys/ioctl.h>
 #include <sys/utsname.h>
+#include <sys/eventfd.h>
 #include <fcntl.h>
 #include <poll.h>
+#include <dirent.h>
+#include <pthread.h>
 
 /* Linux */
 #include <linux/hidraw.h>
@@ -76,11 +81,39 @@ struct hid_device_ {
 	int device_handle;
 	int blocking;
 	int uses_numbered_reports;
+
+	/* Manufacturer, product and serial number, indexed by
+	   device_string_id. Looked up the first time one of them is asked
+	   for and kept until the device is closed. */
+	wchar_t *strings[DEVICE_STRING_COUNT];
+	int strings_fetched;
+
+	/* Microseconds a read spins before sleeping, and the spin counters.
+	   Accessed atomically, as they are set and read from any thread. */
+	int spin_budget_us;
+	unsigned long long spin_hits;
+	unsigned long long spin_sleeps;
+	unsigned long long spin_ns;
+
+	/* An eventfd which hid_cancel_read() writes to and reads poll for. */
+	int cancel_fd;
+
+	/* The hid_set_input_report_callback() function and its context, only
+	   set and called under callback_mutex. */
+	hid_input_report_callback input_callback;
+	void *input_callback_context;
+	pthread_mutex_t callback_mutex;
 };
 
 
 static __u32 kernel_version = 0;
 
+/* /sys/class/hidraw, kept open between calls to enumerate_sysfs(). The
+   directory stream isn't safe to share, so it is only used under
+   sysfs_mutex. */
+static DIR *hidraw_class_dir = NULL;
+static pthread_mutex_t sysfs_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 static __u32 detect_kernel_version(void)
 {
 	struct utsname name;
@@ -108,6 +141,8 @@ static hid_device *new_hid_device(void)
 	dev->device_handle = -1;
 	dev->blocking = 1;
 	dev->uses_numbered_reports = 0;
+	dev->cancel_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	pthread_mutex_init(&dev->callback_mutex, NULL);
 
 	return dev;
 }
@@ -258,14 +293,21 @@ next_line:
 }
 
 
-static int get_device_string(hid_device *dev, enum device_string_id key, wchar_t *string, size_t maxlen)
+/* Look up the manufacturer, product and serial number strings of the
+   hidraw device with the given dev_t, indexed by device_string_id. Strings
+   which can't be found are left NULL, the others must be freed with free()
+   when done. */
+static int get_device_strings(dev_t devnum, wchar_t *strings[DEVICE_STRING_COUNT])
 {
 	struct udev *udev;
 	struct udev_device *udev_dev, *parent, *hid_dev;
-	struct stat s;
 	int ret = -1;
-        char *serial_number_utf8 = NULL;
-        char *product_name_utf8 = NULL;
+	int i;
+	char *serial_number_utf8 = NULL;
+	char *product_name_utf8 = NULL;
+
+	for (i = 0; i < DEVICE_STRING_COUNT; i++)
+		strings[i] = NULL;
 
 	/* Create the udev object */
 	udev = udev_new();
@@ -274,10 +316,8 @@ static int get_device_string(hid_device *dev, enum device_string_id key, wchar_t
 		return -1;
 	}
 
-	/* Get the dev_t (major/minor numbers) from the file handle. */
-	fstat(dev->device_handle, &s);
 	/* Open a udev device from the dev_t. 'c' means character device. */
-	udev_dev = udev_device_new_from_devnum(udev, 'c', s.st_rdev);
+	udev_dev = udev_device_new_from_devnum(udev, 'c', devnum);
 	if (udev_dev) {
 		hid_dev = udev_device_get_parent_with_subsystem_devtype(
 			udev_dev,
@@ -286,10 +326,9 @@ static int get_device_string(hid_device *dev, enum device_string_id key, wchar_t
 		if (hid_dev) {
 			unsigned short dev_vid;
 			unsigned short dev_pid;
-			int bus_type;
-			size_t retm;
+			int bus_type = 0;
 
-			ret = parse_uevent_info(
+			parse_uevent_info(
 			           udev_device_get_sysattr_value(hid_dev, "uevent"),
 			           &bus_type,
 			           &dev_vid,
@@ -298,24 +337,10 @@ static int get_device_string(hid_device *dev, enum device_string_id key, wchar_t
 			           &product_name_utf8);
 
 			if (bus_type == BUS_BLUETOOTH) {
-				switch (key) {
-					case DEVICE_STRING_MANUFACTURER:
-						wcsncpy(string, L"", maxlen);
-						ret = 0;
-						break;
-					case DEVICE_STRING_PRODUCT:
-						retm = mbstowcs(string, product_name_utf8, maxlen);
-						ret = (retm == (size_t)-1)? -1: 0;
-						break;
-					case DEVICE_STRING_SERIAL:
-						retm = mbstowcs(string, serial_number_utf8, maxlen);
-						ret = (retm == (size_t)-1)? -1: 0;
-						break;
-					case DEVICE_STRING_COUNT:
-					default:
-						ret = -1;
-						break;
-				}
+				strings[DEVICE_STRING_MANUFACTURER] = wcsdup(L"");
+				strings[DEVICE_STRING_PRODUCT] = utf8_to_wchar_t(product_name_utf8);
+				strings[DEVICE_STRING_SERIAL] = utf8_to_wchar_t(serial_number_utf8);
+				ret = 0;
 			}
 			else {
 				/* This is a USB device. Find its parent USB Device node. */
@@ -324,31 +349,16 @@ static int get_device_string(hid_device *dev, enum device_string_id key, wchar_t
 					   "usb",
 					   "usb_device");
 				if (parent) {
-					const char *str;
-					const char *key_str = NULL;
-
-					if (key >= 0 && key < DEVICE_STRING_COUNT) {
-						key_str = device_string_names[key];
-					} else {
-						ret = -1;
-						goto end;
-					}
-
-					str = udev_device_get_sysattr_value(parent, key_str);
-					if (str) {
-						/* Convert the string from UTF-8 to wchar_t */
-						retm = mbstowcs(string, str, maxlen);
-						ret = (retm == (size_t)-1)? -1: 0;
-						goto end;
-					}
+					for (i = 0; i < DEVICE_STRING_COUNT; i++)
+						strings[i] = copy_udev_string(parent, device_string_names[i]);
+					ret = 0;
 				}
 			}
 		}
 	}
 
-end:
-        free(serial_number_utf8);
-        free(product_name_utf8);
+	free(serial_number_utf8);
+	free(product_name_utf8);
 
 	udev_device_unref(udev_dev);
 	/* parent and hid_dev don't need to be (and can't be) unref'd.
@@ -358,6 +368,34 @@ end:
 	return ret;
 }
 
+static int get_device_string(hid_device *dev, enum device_string_id key, wchar_t *string, size_t maxlen)
+{
+	if (key < 0 || key >= DEVICE_STRING_COUNT || maxlen == 0)
+		return -1;
+
+	/* All three strings come from the same udev lookup, so they are
+	   fetched together the first time and served from the device after
+	   that. A failed lookup is tried again on the next call. */
+	if (!dev->strings_fetched) {
+		struct stat s;
+
+		/* Get the dev_t (major/minor numbers) from the file handle. */
+		if (fstat(dev->device_handle, &s) < 0)
+			return -1;
+		if (get_device_strings(s.st_rdev, dev->strings) < 0)
+			return -1;
+		dev->strings_fetched = 1;
+	}
+
+	if (!dev->strings[key])
+		return -1;
+
+	wcsncpy(string, dev->strings[key], maxlen);
+	string[maxlen-1] = L'\0';
+
+	return 0;
+}
+
 int HID_API_EXPORT hid_init(void)
 {
 	const char *locale;
@@ -374,12 +412,489 @@ int HID_API_EXPORT hid_init(void)
 
 int HID_API_EXPORT hid_exit(void)
 {
-	/* Nothing to do for this in the Linux/hidraw implementation. */
+	pthread_mutex_lock(&sysfs_mutex);
+	if (hidraw_class_dir) {
+		closedir(hidraw_class_dir);
+		hidraw_class_dir = NULL;
+	}
+	pthread_mutex_unlock(&sysfs_mutex);
+
 	return 0;
 }
 
+/* Read the sysfs attribute name, relative to the directory dir_fd, into
+   buf as a NUL terminated string without the trailing newline. Returns
+   the length of the string or -1 on error. */
+static int read_sysfs_attr(int dir_fd, const char *name, char *buf, size_t len)
+{
+	int fd;
+	ssize_t n;
+
+	fd = openat(dir_fd, name, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	n = read(fd, buf, len - 1);
+	close(fd);
+	if (n < 0)
+		return -1;
+
+	while (n > 0 && buf[n-1] == '\n')
+		n--;
+	buf[n] = '\0';
+
+	return n;
+}
+
+/* The same as parse_uevent_info(), but without allocating. uevent is
+   split up in place, and the serial number and product name are
+   returned as pointers into it. */
+static int
+parse_uevent_in_place(char *uevent, int *bus_type,
+	unsigned short *vendor_id, unsigned short *product_id,
+	const char **serial_number_utf8, const char **product_name_utf8)
+{
+	char *line = uevent;
+	int found_id = 0;
+	int found_serial = 0;
+	int found_name = 0;
+
+	while (line && *line) {
+		char *end = strchr(line, '\n');
+		if (end)
+			*end++ = '\0';
+
+		if (strncmp(line, "HID_ID=", 7) == 0) {
+			/* HID_ID=0003:000005AC:00008242 */
+			char *p = line + 7;
+			char *q;
+
+			*bus_type = strtoul(p, &q, 16);
+			if (*q == ':') {
+				*vendor_id = strtoul(q + 1, &p, 16);
+				if (*p == ':') {
+					*product_id = strtoul(p + 1, &q, 16);
+					found_id = 1;
+				}
+			}
+		} else if (strncmp(line, "HID_NAME=", 9) == 0) {
+			*product_name_utf8 = line + 9;
+			found_name = 1;
+		} else if (strncmp(line, "HID_UNIQ=", 9) == 0) {
+			*serial_number_utf8 = line + 9;
+			found_serial = 1;
+		}
+
+		line = end;
+	}
+
+	return (found_id && found_name && found_serial);
+}
+
+/* Get bytes from a HID Report Descriptor.
+   Only call with a num_bytes of 0, 1, 2, or 4. */
+static __u32 get_bytes(__u8 *rpt, size_t len, size_t num_bytes, size_t cur)
+{
+	/* Return if there aren't enough bytes. */
+	if (cur + num_bytes >= len)
+		return 0;
+
+	if (num_bytes == 0)
+		return 0;
+	else if (num_bytes == 1) {
+		return rpt[cur+1];
+	}
+	else if (num_bytes == 2) {
+		return (rpt[cur+2] * 256 + rpt[cur+1]);
+	}
+	else if (num_bytes == 4) {
+		return (rpt[cur+4] * 0x01000000 +
+		        rpt[cur+3] * 0x00010000 +
+		        rpt[cur+2] * 0x00000100 +
+		        rpt[cur+1] * 0x00000001);
+	}
+	else
+		return 0;
+}
+
+/* Retrieves the device's Usage Page and Usage from the report
+   descriptor. The algorithm is simple, as it just returns the first
+   Usage and Usage Page that it finds in the descriptor.
+   The return value is 0 on success and -1 on failure. */
+static int get_usage(__u8 *report_descriptor, size_t size,
+                     unsigned short *usage_page, unsigned short *usage)
+{
+	unsigned int i = 0;
+	int size_code;
+	int data_len, key_size;
+	int usage_found = 0, usage_page_found = 0;
+
+	while (i < size) {
+		int key = report_descriptor[i];
+		int key_cmd = key & 0xfc;
+
+		if ((key & 0xf0) == 0xf0) {
+			/* This is a Long Item. The next byte contains the
+			   length of the data section (value) for this key.
+			   See the HID specification, version 1.11, section
+			   6.2.2.3, titled "Long Items." */
+			if (i+1 < size)
+				data_len = report_descriptor[i+1];
+			else
+				data_len = 0; /* malformed report */
+			key_size = 3;
+		}
+		else {
+			/* This is a Short Item. The bottom two bits of the
+			   key contain the size code for the data section
+			   (value) for this key.  Refer to the HID
+			   specification, version 1.11, section 6.2.2.2,
+			   titled "Short Items." */
+			size_code = key & 0x3;
+			data_len = (size_code == 3)? 4: size_code;
+			key_size = 1;
+		}
+
+		if (key_cmd == 0x4) {
+			*usage_page = get_bytes(report_descriptor, size, data_len, i);
+			usage_page_found = 1;
+		}
+		if (key_cmd == 0x8) {
+			*usage = get_bytes(report_descriptor, size, data_len, i);
+			usage_found = 1;
+		}
+
+		if (usage_page_found && usage_found)
+			return 0; /* success */
+
+		/* Skip over this key and it's associated data */
+		i += data_len + key_size;
+	}
+
+	return -1; /* failure */
+}
+
+/* Top level usage pages and usages already parsed, keyed by a hash of
+   the report descriptor. Devices of the same model have the same
+   descriptor, so each model is parsed once however many are plugged in.
+   The table is direct mapped, a new descriptor replaces the one in its
+   slot. Only used under usage_cache_mutex. */
+#define USAGE_CACHE_SIZE 64
+
+struct usage_cache_entry {
+	__u64 hash;
+	size_t size; /* 0 for an unused entry */
+	unsigned short usage_page;
+	unsigned short usage;
+};
+
+static struct usage_cache_entry usage_cache[USAGE_CACHE_SIZE];
+static pthread_mutex_t usage_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* 64 bit FNV-1a hash of a report descriptor. */
+static __u64 hash_descriptor(const __u8 *desc, size_t size)
+{
+	__u64 hash = 0xcbf29ce484222325ULL;
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		hash ^= desc[i];
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+/* get_usage() through usage_cache. Returns 0 on success and -1 on
+   failure, failures aren't cached. */
+static int get_cached_usage(__u8 *desc, size_t size,
+                            unsigned short *usage_page, unsigned short *usage)
+{
+	__u64 hash = hash_descriptor(desc, size);
+	struct usage_cache_entry *entry = &usage_cache[hash % USAGE_CACHE_SIZE];
+	int ret = 0;
+
+	pthread_mutex_lock(&usage_cache_mutex);
+
+	if (entry->size == size && entry->hash == hash) {
+		*usage_page = entry->usage_page;
+		*usage = entry->usage;
+	}
+	else if (get_usage(desc, size, usage_page, usage) == 0) {
+		entry->hash = hash;
+		entry->size = size;
+		entry->usage_page = *usage_page;
+		entry->usage = *usage;
+	}
+	else {
+		ret = -1;
+	}
+
+	pthread_mutex_unlock(&usage_cache_mutex);
+
+	return ret;
+}
+
+/* Read the usage page and usage of the HID node hid_fd from its
+   report_descriptor attribute. The device isn't opened. Returns 0 on
+   success and -1 on failure. */
+static int get_sysfs_usage(int hid_fd, unsigned short *usage_page, unsigned short *usage)
+{
+	__u8 desc[HID_MAX_DESCRIPTOR_SIZE];
+	ssize_t n;
+	int fd;
+
+	fd = openat(hid_fd, "report_descriptor", O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	n = read(fd, desc, sizeof(desc));
+	close(fd);
+	if (n <= 0)
+		return -1;
+
+	return get_cached_usage(desc, n, usage_page, usage);
+}
+
+/* Convert a bus number from linux/input.h into a HID_BUS_* value. */
+static int get_bus_type(int bus_type)
+{
+	switch (bus_type) {
+	case BUS_USB:
+		return HID_BUS_USB;
+	case BUS_BLUETOOTH:
+		return HID_BUS_BLUETOOTH;
+	case BUS_I2C:
+		return HID_BUS_I2C;
+	default:
+		return HID_BUS_UNKNOWN;
+	}
+}
+
+/* The filter checks below are made in order of cost, so that
+   enumeration can stop work on a device as soon as one fails. */
+
+static int filter_id_matches(const struct hid_enumerate_filter *filter,
+	unsigned short vendor_id, unsigned short product_id, int bus_type)
+{
+	if (filter->vendor_id != 0x0 && filter->vendor_id != vendor_id)
+		return 0;
+	if (filter->product_id != 0x0 && filter->product_id != product_id)
+		return 0;
+	if ((filter->match & HID_FILTER_BUS_TYPE) && filter->bus_type != bus_type)
+		return 0;
+	return 1;
+}
+
+static int filter_serial_matches(const struct hid_enumerate_filter *filter, const char *serial_number_utf8)
+{
+	wchar_t *serial_number;
+	int ret;
+
+	if (!(filter->match & HID_FILTER_SERIAL_PREFIX) || !filter->serial_prefix)
+		return 1;
+
+	serial_number = utf8_to_wchar_t(serial_number_utf8);
+	ret = serial_number &&
+	      wcsncmp(serial_number, filter->serial_prefix, wcslen(filter->serial_prefix)) == 0;
+	free(serial_number);
+
+	return ret;
+}
+
+static int filter_interface_matches(const struct hid_enumerate_filter *filter, int interface_number)
+{
+	return !(filter->match & HID_FILTER_INTERFACE) ||
+	       filter->interface_number == interface_number;
+}
+
+static int filter_usage_matches(const struct hid_enumerate_filter *filter,
+	unsigned short usage_page, unsigned short usage)
+{
+	if ((filter->match & HID_FILTER_USAGE_PAGE) && filter->usage_page != usage_page)
+		return 0;
+	if ((filter->match & HID_FILTER_USAGE) && filter->usage != usage)
+		return 0;
+	return 1;
+}
+
+/* hid_enumerate() without libudev. Reads /sys/class/hidraw directly,
+   walking from each hidraw node to its HID, USB interface and USB device
+   nodes with openat() rather than building udev_device objects. The
+   only allocations are for the returned records. */
+static struct hid_device_info *enumerate_sysfs(const struct hid_enumerate_filter *filter, int flags)
+{
+	struct hid_device_info *root = NULL; /* return object */
+	struct hid_device_info *cur_dev = NULL;
+	struct dirent *entry;
+	int class_fd;
+
+	pthread_mutex_lock(&sysfs_mutex);
+
+	if (hidraw_class_dir) {
+		rewinddir(hidraw_class_dir);
+	}
+	else {
+		hidraw_class_dir = opendir("/sys/class/hidraw");
+		if (!hidraw_class_dir) {
+			pthread_mutex_unlock(&sysfs_mutex);
+			return NULL;
+		}
+	}
+	class_fd = dirfd(hidraw_class_dir);
+
+	while ((entry = readdir(hidraw_class_dir)) != NULL) {
+		char uevent[4096];
+		char link[NAME_MAX + 8];
+		char str[256];
+		char manufacturer_utf8[256];
+		char product_utf8[256];
+		const char *serial_number_utf8 = NULL;
+		const char *product_name_utf8 = NULL;
+		unsigned short dev_vid;
+		unsigned short dev_pid;
+		unsigned short release_number = 0x0;
+		unsigned short usage_page = 0x0;
+		unsigned short usage = 0x0;
+		int interface_number = -1;
+		int bus_type;
+		int hid_fd, intf_fd = -1, usb_fd = -1;
+		struct hid_device_info *tmp;
+
+		if (strncmp(entry->d_name, "hidraw", 6) != 0)
+			continue;
+
+		/* hidrawN/device is the device's HID node. */
+		snprintf(link, sizeof(link), "%s/device", entry->d_name);
+		hid_fd = openat(class_fd, link, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (hid_fd < 0)
+			continue;
+
+		if (read_sysfs_attr(hid_fd, "uevent", uevent, sizeof(uevent)) < 0 ||
+		    !parse_uevent_in_place(uevent, &bus_type, &dev_vid, &dev_pid,
+		                           &serial_number_utf8, &product_name_utf8))
+			goto next;
+
+		if (bus_type != BUS_USB && bus_type != BUS_BLUETOOTH) {
+			/* We only know how to handle USB and BT devices. */
+			goto next;
+		}
+
+		/* Check the VID/PID against the filter */
+		if (!filter_id_matches(filter, dev_vid, dev_pid, get_bus_type(bus_type)) ||
+		    !filter_serial_matches(filter, serial_number_utf8))
+			goto next;
+
+		/* A device whose descriptor can't be read is still listed,
+		   with a usage page and usage of 0, unless they are filtered. */
+		if (get_sysfs_usage(hid_fd, &usage_page, &usage) < 0) {
+			usage_page = 0x0;
+			usage = 0x0;
+			if (filter->match & (HID_FILTER_USAGE_PAGE | HID_FILTER_USAGE))
+				goto next;
+		}
+		if (!filter_usage_matches(filter, usage_page, usage))
+			goto next;
+
+		manufacturer_utf8[0] = '\0';
+		product_utf8[0] = '\0';
+
+		if (bus_type == BUS_USB) {
+			/* The HID node's parent is the USB interface and its
+			   parent is the USB device. As with the udev version,
+			   a device without a USB device node is skipped. */
+			intf_fd = openat(hid_fd, "..", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+			if (intf_fd >= 0)
+				usb_fd = openat(intf_fd, "..", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+			if (usb_fd < 0 ||
+			    read_sysfs_attr(usb_fd, "bcdDevice", str, sizeof(str)) < 0)
+				goto next;
+
+			release_number = strtol(str, NULL, 16);
+
+			if (read_sysfs_attr(intf_fd, "bInterfaceNumber", str, sizeof(str)) >= 0)
+				interface_number = strtol(str, NULL, 16);
+		}
+
+		if (!filter_interface_matches(filter, interface_number))
+			goto next;
+
+		if (bus_type == BUS_USB && !(flags & HID_ENUMERATE_LAZY_STRINGS)) {
+			read_sysfs_attr(usb_fd, device_string_names[DEVICE_STRING_MANUFACTURER],
+			                manufacturer_utf8, sizeof(manufacturer_utf8));
+			read_sysfs_attr(usb_fd, device_string_names[DEVICE_STRING_PRODUCT],
+			                product_utf8, sizeof(product_utf8));
+		}
+
+		/* The device matches. Create the record. */
+		tmp = calloc(1, sizeof(struct hid_device_info));
+		if (cur_dev) {
+			cur_dev->next = tmp;
+		}
+		else {
+			root = tmp;
+		}
+		cur_dev = tmp;
+
+		/* Fill out the record */
+		snprintf(link, sizeof(link), "/dev/%s", entry->d_name);
+		cur_dev->path = strdup(link);
+		cur_dev->vendor_id = dev_vid;
+		cur_dev->product_id = dev_pid;
+		cur_dev->release_number = release_number;
+		cur_dev->interface_number = interface_number;
+		cur_dev->usage_page = usage_page;
+		cur_dev->usage = usage;
+		cur_dev->bus_type = get_bus_type(bus_type);
+
+		/* A serial number filter needs the serial, so it is kept
+		   even with lazy strings. */
+		if (!(flags & HID_ENUMERATE_LAZY_STRINGS) ||
+		    (filter->match & HID_FILTER_SERIAL_PREFIX))
+			cur_dev->serial_number = utf8_to_wchar_t(serial_number_utf8);
+
+		if (!(flags & HID_ENUMERATE_LAZY_STRINGS)) {
+			if (bus_type == BUS_USB) {
+				cur_dev->manufacturer_string = utf8_to_wchar_t(manufacturer_utf8);
+				cur_dev->product_string = utf8_to_wchar_t(product_utf8);
+			}
+			else {
+				cur_dev->manufacturer_string = wcsdup(L"");
+				cur_dev->product_string = utf8_to_wchar_t(product_name_utf8);
+			}
+		}
+
+	next:
+		if (usb_fd >= 0)
+			close(usb_fd);
+		if (intf_fd >= 0)
+			close(intf_fd);
+		close(hid_fd);
+	}
+
+	pthread_mutex_unlock(&sysfs_mutex);
+
+	return root;
+}
+
 
 struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id, unsigned short product_id)
+{
+	return hid_enumerate_ex(vendor_id, product_id, 0);
+}
+
+struct hid_device_info  HID_API_EXPORT *hid_enumerate_ex(unsigned short vendor_id, unsigned short product_id, int flags)
+{
+	struct hid_enumerate_filter filter;
+
+	memset(&filter, 0, sizeof(filter));
+	filter.vendor_id = vendor_id;
+	filter.product_id = product_id;
+
+	return hid_enumerate_filtered(&filter, flags);
+}
+
+struct hid_device_info  HID_API_EXPORT *hid_enumerate_filtered(const struct hid_enumerate_filter *filter, int flags)
 {
 	struct udev *udev;
 	struct udev_enumerate *enumerate;
@@ -387,10 +902,12 @@ struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id,
 
 	struct hid_device_info *root = NULL; /* return object */
 	struct hid_device_info *cur_dev = NULL;
-	struct hid_device_info *prev_dev = NULL; /* previous device */
 
 	hid_init();
 
+	if (flags & HID_ENUMERATE_SYSFS)
+		return enumerate_sysfs(filter, flags);
+
 	/* Create the udev object */
 	udev = udev_new();
 	if (!udev) {
@@ -403,7 +920,7 @@ struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id,
 	udev_enumerate_add_match_subsystem(enumerate, "hidraw");
 	udev_enumerate_scan_devices(enumerate);
 	devices = udev_enumerate_get_list_entry(enumerate);
-	/* For each item, see if it matches the vid/pid, and if so
+	/* For each item, see if it matches the filter, and if so
 	   create a udev_device record for it */
 	udev_list_entry_foreach(dev_list_entry, devices) {
 		const char *sysfs_path;
@@ -411,10 +928,14 @@ struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id,
 		const char *str;
 		struct udev_device *raw_dev; /* The device's hidraw udev node. */
 		struct udev_device *hid_dev; /* The device's HID udev node. */
-		struct udev_device *usb_dev; /* The device's USB udev node. */
+		struct udev_device *usb_dev = NULL; /* The device's USB udev node. */
 		struct udev_device *intf_dev; /* The device's interface (in the USB sense). */
+		struct hid_device_info *tmp;
 		unsigned short dev_vid;
 		unsigned short dev_pid;
+		unsigned short usage_page = 0x0;
+		unsigned short usage = 0x0;
+		int interface_number = -1;
 		char *serial_number_utf8 = NULL;
 		char *product_name_utf8 = NULL;
 		int bus_type;
@@ -454,102 +975,122 @@ struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id,
 			goto next;
 		}
 
-		/* Check the VID/PID against the arguments */
-		if ((vendor_id == 0x0 || vendor_id == dev_vid) &&
-		    (product_id == 0x0 || product_id == dev_pid)) {
-			struct hid_device_info *tmp;
+		/* Check the VID/PID against the filter */
+		if (!filter_id_matches(filter, dev_vid, dev_pid, get_bus_type(bus_type)) ||
+		    !filter_serial_matches(filter, serial_number_utf8))
+			goto next;
 
-			/* VID/PID match. Create the record. */
-			tmp = malloc(sizeof(struct hid_device_info));
-			if (cur_dev) {
-				cur_dev->next = tmp;
+		/* Usage Page and Usage, read from sysfs rather than by
+		   opening the device. */
+		{
+			int hid_fd = open(udev_device_get_syspath(hid_dev),
+			                  O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+			result = (hid_fd >= 0) ? get_sysfs_usage(hid_fd, &usage_page, &usage) : -1;
+			if (hid_fd >= 0)
+				close(hid_fd);
+			if (result < 0) {
+				usage_page = 0x0;
+				usage = 0x0;
+				if (filter->match & (HID_FILTER_USAGE_PAGE | HID_FILTER_USAGE))
+					goto next;
 			}
-			else {
-				root = tmp;
+			if (!filter_usage_matches(filter, usage_page, usage))
+				goto next;
+		}
+
+		if (bus_type == BUS_USB) {
+			/* The device pointed to by raw_dev contains information about
+			   the hidraw device. In order to get information about the
+			   USB device, get the parent device with the
+			   subsystem/devtype pair of "usb"/"usb_device". This will
+			   be several levels up the tree, but the function will find
+			   it. */
+			usb_dev = udev_device_get_parent_with_subsystem_devtype(
+					raw_dev,
+					"usb",
+					"usb_device");
+
+			if (!usb_dev)
+				goto next;
+
+			/* Get a handle to the interface's udev node. */
+			intf_dev = udev_device_get_parent_with_subsystem_devtype(
+					raw_dev,
+					"usb",
+					"usb_interface");
+			if (intf_dev) {
+				str = udev_device_get_sysattr_value(intf_dev, "bInterfaceNumber");
+				interface_number = (str)? strtol(str, NULL, 16): -1;
 			}
-			prev_dev = cur_dev;
-			cur_dev = tmp;
+		}
 
-			/* Fill out the record */
-			cur_dev->next = NULL;
-			cur_dev->path = dev_path? strdup(dev_path): NULL;
+		if (!filter_interface_matches(filter, interface_number))
+			goto next;
 
-			/* VID/PID */
-			cur_dev->vendor_id = dev_vid;
-			cur_dev->product_id = dev_pid;
+		/* The device matches. Create the record. */
+		tmp = calloc(1, sizeof(struct hid_device_info));
+		if (cur_dev) {
+			cur_dev->next = tmp;
+		}
+		else {
+			root = tmp;
+		}
+		cur_dev = tmp;
+
+		/* Fill out the record */
+		cur_dev->next = NULL;
+		cur_dev->path = dev_path? strdup(dev_path): NULL;
+
+		/* VID/PID */
+		cur_dev->vendor_id = dev_vid;
+		cur_dev->product_id = dev_pid;
 
-			/* Serial Number */
+		/* Serial Number. A serial number filter needs it, so it is
+		   kept even with lazy strings. */
+		if (!(flags & HID_ENUMERATE_LAZY_STRINGS) ||
+		    (filter->match & HID_FILTER_SERIAL_PREFIX))
 			cur_dev->serial_number = utf8_to_wchar_t(serial_number_utf8);
 
-			/* Release Number */
-			cur_dev->release_number = 0x0;
-
-			/* Interface Number */
-			cur_dev->interface_number = -1;
-
-			switch (bus_type) {
-				case BUS_USB:
-					/* The device pointed to by raw_dev contains information about
-					   the hidraw device. In order to get information about the
-					   USB device, get the parent device with the
-					   subsystem/devtype pair of "usb"/"usb_device". This will
-					   be several levels up the tree, but the function will find
-					   it. */
-					usb_dev = udev_device_get_parent_with_subsystem_devtype(
-							raw_dev,
-							"usb",
-							"usb_device");
-
-					if (!usb_dev) {
-						/* Free this device */
-						free(cur_dev->serial_number);
-						free(cur_dev->path);
-						free(cur_dev);
-
-						/* Take it off the device list. */
-						if (prev_dev) {
-							prev_dev->next = NULL;
-							cur_dev = prev_dev;
-						}
-						else {
-							cur_dev = root = NULL;
-						}
-
-						goto next;
-					}
-
-					/* Manufacturer and Product strings */
+		/* Release Number */
+		cur_dev->release_number = 0x0;
+
+		/* Interface Number */
+		cur_dev->interface_number = interface_number;
+
+		/* Usage Page and Usage */
+		cur_dev->usage_page = usage_page;
+		cur_dev->usage = usage;
+
+		cur_dev->bus_type = get_bus_type(bus_type);
+
+		switch (bus_type) {
+			case BUS_USB:
+				/* Manufacturer and Product strings */
+				if (!(flags & HID_ENUMERATE_LAZY_STRINGS)) {
 					cur_dev->manufacturer_string = copy_udev_string(usb_dev, device_string_names[DEVICE_STRING_MANUFACTURER]);
 					cur_dev->product_string = copy_udev_string(usb_dev, device_string_names[DEVICE_STRING_PRODUCT]);
+				}
 
-					/* Release Number */
-					str = udev_device_get_sysattr_value(usb_dev, "bcdDevice");
-					cur_dev->release_number = (str)? strtol(str, NULL, 16): 0x0;
-
-					/* Get a handle to the interface's udev node. */
-					intf_dev = udev_device_get_parent_with_subsystem_devtype(
-							raw_dev,
-							"usb",
-							"usb_interface");
-					if (intf_dev) {
-						str = udev_device_get_sysattr_value(intf_dev, "bInterfaceNumber");
-						cur_dev->interface_number = (str)? strtol(str, NULL, 16): -1;
-					}
+				/* Release Number */
+				str = udev_device_get_sysattr_value(usb_dev, "bcdDevice");
+				cur_dev->release_number = (str)? strtol(str, NULL, 16): 0x0;
 
-					break;
+				break;
 
-				case BUS_BLUETOOTH:
-					/* Manufacturer and Product strings */
+			case BUS_BLUETOOTH:
+				/* Manufacturer and Product strings */
+				if (!(flags & HID_ENUMERATE_LAZY_STRINGS)) {
 					cur_dev->manufacturer_string = wcsdup(L"");
 					cur_dev->product_string = utf8_to_wchar_t(product_name_utf8);
+				}
 
-					break;
+				break;
 
-				default:
-					/* Unknown device type - this should never happen, as we
-					 * check for USB and Bluetooth devices above */
-					break;
-			}
+			default:
+				/* Unknown device type - this should never happen, as we
+				 * check for USB and Bluetooth devices above */
+				break;
 		}
 
 	next:
@@ -581,6 +1122,38 @@ void  HID_API_EXPORT hid_free_enumeration(struct hid_device_info *devs)
 	}
 }
 
+int HID_API_EXPORT hid_get_device_info_strings(struct hid_device_info *info)
+{
+	wchar_t *strings[DEVICE_STRING_COUNT];
+	wchar_t **fields[DEVICE_STRING_COUNT];
+	struct stat s;
+	int i;
+
+	if (!info || !info->path)
+		return -1;
+
+	/* The path is the hidraw device node, so its dev_t is all that
+	   is needed to find the udev device. */
+	if (stat(info->path, &s) < 0 || !S_ISCHR(s.st_mode))
+		return -1;
+
+	if (get_device_strings(s.st_rdev, strings) < 0)
+		return -1;
+
+	fields[DEVICE_STRING_MANUFACTURER] = &info->manufacturer_string;
+	fields[DEVICE_STRING_PRODUCT] = &info->product_string;
+	fields[DEVICE_STRING_SERIAL] = &info->serial_number;
+
+	for (i = 0; i < DEVICE_STRING_COUNT; i++) {
+		if (*fields[i] == NULL)
+			*fields[i] = strings[i];
+		else
+			free(strings[i]);
+	}
+
+	return 0;
+}
+
 hid_device * hid_open(unsigned short vendor_id, unsigned short product_id, const wchar_t *serial_number)
 {
 	struct hid_device_info *devs, *cur_dev;
@@ -593,7 +1166,8 @@ hid_device * hid_open(unsigned short vendor_id, unsigned short product_id, const
 		if (cur_dev->vendor_id == vendor_id &&
 		    cur_dev->product_id == product_id) {
 			if (serial_number) {
-				if (wcscmp(serial_number, cur_dev->serial_number) == 0) {
+				if (cur_dev->serial_number &&
+				    wcscmp(serial_number, cur_dev->serial_number) == 0) {
 					path_to_open = cur_dev->path;
 					break;
 				}
@@ -658,6 +1232,9 @@ hid_device * HID_API_EXPORT hid_open_path(const char *path)
 	}
 	else {
 		/* Unable to open any devices. */
+		if (dev->cancel_fd >= 0)
+			close(dev->cancel_fd);
+		pthread_mutex_destroy(&dev->callback_mutex);
 		free(dev);
 		return NULL;
 	}
@@ -674,33 +1251,135 @@ int HID_API_EXPORT hid_write(hid_device *dev, const unsigned char *data, size_t
 }
 
 
+/* Passes a report to the device's input report callback, if it has one.
+   Returns 1 if it did, and 0 if the report is for the caller. */
+static int call_input_callback(hid_device *dev, const unsigned char *data, size_t length)
+{
+	int called = 0;
+
+	if (__atomic_load_n(&dev->input_callback, __ATOMIC_ACQUIRE) == NULL)
+		return 0;
+
+	pthread_mutex_lock(&dev->callback_mutex);
+	if (dev->input_callback) {
+		dev->input_callback(dev->input_callback_context, dev, data, length);
+		called = 1;
+	}
+	pthread_mutex_unlock(&dev->callback_mutex);
+
+	return called;
+}
+
+/* Fills fds with the device and its cancel eventfd, for poll(). A negative
+   cancel_fd is passed over by poll(). */
+static void set_read_fds(hid_device *dev, struct pollfd fds[2])
+{
+	fds[0].fd = dev->device_handle;
+	fds[0].events = POLLIN;
+	fds[0].revents = 0;
+	fds[1].fd = dev->cancel_fd;
+	fds[1].events = POLLIN;
+	fds[1].revents = 0;
+}
+
+/* Checks the fds of a poll() which returned ret > 0. Returns
+   HID_READ_CANCELLED, taking the cancel, -1 on error or disconnection, or 1
+   if a report is waiting. */
+static int check_read_fds(hid_device *dev, struct pollfd fds[2])
+{
+	if (fds[1].revents & POLLIN) {
+		uint64_t count;
+		if (read(dev->cancel_fd, &count, sizeof(count)) != sizeof(count))
+			return -1;
+		return HID_READ_CANCELLED;
+	}
+
+	if (fds[0].revents & (POLLERR | POLLHUP | POLLNVAL))
+		return -1;
+
+	return 1;
+}
+
+/* Polls the device without sleeping for up to its spin budget, or
+   *milliseconds if that is shorter. Returns 1 if a report is waiting, -1 on
+   error or disconnection, HID_READ_CANCELLED if the read was cancelled and 0
+   if the budget ran out, taking the time spent off *milliseconds. */
+static int spin_for_report(hid_device *dev, int budget_us, int *milliseconds)
+{
+	struct pollfd fds[2];
+	struct timespec start, now;
+	long long budget_ns = budget_us * 1000LL;
+	long long elapsed_ns;
+	int ret;
+
+	if (*milliseconds > 0 && *milliseconds * 1000000LL < budget_ns)
+		budget_ns = *milliseconds * 1000000LL;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	do {
+		set_read_fds(dev, fds);
+		ret = poll(fds, 2, 0);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		elapsed_ns = (now.tv_sec - start.tv_sec) * 1000000000LL
+		             + (now.tv_nsec - start.tv_nsec);
+	} while (ret == 0 && elapsed_ns < budget_ns);
+
+	__atomic_fetch_add(&dev->spin_ns, elapsed_ns, __ATOMIC_RELAXED);
+
+	if (ret == -1)
+		return -1;
+
+	if (ret > 0) {
+		ret = check_read_fds(dev, fds);
+		if (ret == 1)
+			__atomic_fetch_add(&dev->spin_hits, 1, __ATOMIC_RELAXED);
+		return ret;
+	}
+
+	__atomic_fetch_add(&dev->spin_sleeps, 1, __ATOMIC_RELAXED);
+	if (*milliseconds > 0) {
+		*milliseconds -= (int) (elapsed_ns / 1000000);
+		if (*milliseconds < 0)
+			*milliseconds = 0;
+	}
+	return 0;
+}
+
 int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds)
 {
 	int bytes_read;
+	int budget_us = __atomic_load_n(&dev->spin_budget_us, __ATOMIC_RELAXED);
+	int spun = 0;
+
+	if (milliseconds != 0 && budget_us > 0) {
+		spun = spin_for_report(dev, budget_us, &milliseconds);
+		if (spun < 0)
+			return spun;
+	}
 
-	if (milliseconds >= 0) {
-		/* Milliseconds is either 0 (non-blocking) or > 0 (contains
-		   a valid timeout). In both cases we want to call poll()
-		   and wait for data to arrive.  Don't rely on non-blocking
-		   operation (O_NONBLOCK) since some kernels don't seem to
-		   properly report device disconnection through read() when
-		   in non-blocking mode.  */
+	if (!spun) {
+		/* Whatever the timeout, 0 (non-blocking), > 0 or -1
+		   (blocking), we want to call poll() and wait for data to
+		   arrive, or for hid_cancel_read() to signal the cancel
+		   eventfd. Don't rely on non-blocking operation (O_NONBLOCK)
+		   since some kernels don't seem to properly report device
+		   disconnection through read() when in non-blocking mode.  */
 		int ret;
-		struct pollfd fds;
+		struct pollfd fds[2];
 
-		fds.fd = dev->device_handle;
-		fds.events = POLLIN;
-		fds.revents = 0;
-		ret = poll(&fds, 1, milliseconds);
+		set_read_fds(dev, fds);
+		ret = poll(fds, 2, milliseconds);
 		if (ret == -1 || ret == 0) {
 			/* Error or timeout */
 			return ret;
 		}
 		else {
-			/* Check for errors on the file descriptor. This will
-			   indicate a device disconnection. */
-			if (fds.revents & (POLLERR | POLLHUP | POLLNVAL))
-				return -1;
+			/* Check for a cancel, or errors on the file descriptor,
+			   which indicate a device disconnection. */
+			ret = check_read_fds(dev, fds);
+			if (ret != 1)
+				return ret;
 		}
 	}
 
@@ -717,6 +1396,9 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 		bytes_read--;
 	}
 
+	if (bytes_read > 0 && call_input_callback(dev, data, bytes_read))
+		return 0;
+
 	return bytes_read;
 }
 
@@ -735,6 +1417,53 @@ int HID_API_EXPORT hid_set_nonblocking(hid_device *dev, int nonblock)
 	return 0; /* Success */
 }
 
+int HID_API_EXPORT hid_set_spin_budget(hid_device *dev, int microseconds)
+{
+	if (microseconds < 0)
+		return -1;
+
+	__atomic_store_n(&dev->spin_budget_us, microseconds, __ATOMIC_RELAXED);
+	return 0;
+}
+
+int HID_API_EXPORT hid_get_spin_stats(hid_device *dev, struct hid_spin_stats *stats)
+{
+	if (!stats)
+		return -1;
+
+	stats->spin_hits = __atomic_load_n(&dev->spin_hits, __ATOMIC_RELAXED);
+	stats->sleeps = __atomic_load_n(&dev->spin_sleeps, __ATOMIC_RELAXED);
+	stats->spin_us = __atomic_load_n(&dev->spin_ns, __ATOMIC_RELAXED) / 1000;
+	return 0;
+}
+
+int HID_API_EXPORT hid_cancel_read(hid_device *dev)
+{
+	uint64_t one = 1;
+
+	if (dev->cancel_fd < 0)
+		return -1;
+
+	return write(dev->cancel_fd, &one, sizeof(one)) == sizeof(one) ? 0 : -1;
+}
+
+int HID_API_EXPORT hid_set_input_report_callback(hid_device *dev, hid_input_report_callback callback, void *context)
+{
+	pthread_mutex_lock(&dev->callback_mutex);
+	dev->input_callback_context = context;
+	__atomic_store_n(&dev->input_callback, callback, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&dev->callback_mutex);
+
+	return 0;
+}
+
+int HID_API_EXPORT hid_get_read_fd(hid_device *dev)
+{
+	/* hidraw is readable while a report is waiting, and reports
+	   POLLERR or POLLHUP once the device is gone. */
+	return dev->device_handle;
+}
+
 
 int HID_API_EXPORT hid_send_feature_report(hid_device *dev, const unsigned char *data, size_t length)
 {
@@ -759,12 +1488,63 @@ int HID_API_EXPORT hid_get_feature_report(hid_device *dev, unsigned char *data,
 	return res;
 }
 
+int HID_API_EXPORT hid_get_device_ids(hid_device *dev, unsigned short *vendor_id, unsigned short *product_id)
+{
+	struct hidraw_devinfo info;
+
+	if (ioctl(dev->device_handle, HIDIOCGRAWINFO, &info) < 0)
+		return -1;
+
+	*vendor_id = (unsigned short) info.vendor;
+	*product_id = (unsigned short) info.product;
+	return 0;
+}
+
+int HID_API_EXPORT hid_get_report_descriptor(hid_device *dev, unsigned char *buf, size_t buf_size)
+{
+	struct hidraw_report_descriptor rpt_desc;
+	int desc_size = 0;
+	int res;
+
+	res = ioctl(dev->device_handle, HIDIOCGRDESCSIZE, &desc_size);
+	if (res < 0) {
+		perror("HIDIOCGRDESCSIZE");
+		return -1;
+	}
+
+	rpt_desc.size = desc_size;
+	res = ioctl(dev->device_handle, HIDIOCGRDESC, &rpt_desc);
+	if (res < 0) {
+		perror("HIDIOCGRDESC");
+		return -1;
+	}
+
+	if ((size_t) desc_size > buf_size)
+		desc_size = buf_size;
+	memcpy(buf, rpt_desc.value, desc_size);
+
+	return desc_size;
+}
+
+
+void HID_API_EXPORT hid_shutdown(hid_device *dev)
+{
+	/* Reads are made on the calling thread, there is nothing to stop. */
+	(void)dev;
+}
 
 void HID_API_EXPORT hid_close(hid_device *dev)
 {
+	int i;
+
 	if (!dev)
 		return;
 	close(dev->device_handle);
+	if (dev->cancel_fd >= 0)
+		close(dev->cancel_fd);
+	for (i = 0; i < DEVICE_STRING_COUNT; i++)
+		free(dev->strings[i]);
+	pthread_mutex_destroy(&dev->callback_mutex);
 	free(dev);
 }
 
@@ -29,7 +29,9 @@
 #include <locale.h>
 #include <pthread.h>
 #include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
+#include <fcntl.h>
 
 #include "hidapi.h"
 
@@ -118,8 +120,55 @@ struct hid_device_ {
 	pthread_barrier_t barrier; /* Ensures correct startup sequence */
 	pthread_barrier_t shutdown_barrier; /* Ensures correct shutdown sequence */
 	int shutdown_thread;
+
+	/* Microseconds a read spins before sleeping, and the spin counters.
+	   Accessed atomically, as they are set and read from any thread. */
+	int spin_budget_us;
+	unsigned long long spin_hits;
+	unsigned long long spin_sleeps;
+	unsigned long long spin_ns;
+
+	/* A pipe which holds a byte while a report is waiting or the read
+	   thread has stopped, so the read end can be polled, and whether it
+	   holds one. Written and drained under the mutex. */
+	int read_pipe[2];
+	int read_fd_ready;
+
+	/* Set by hid_cancel_read() under the mutex, and cleared by the read it
+	   ends. */
+	int read_cancelled;
+
+	/* The hid_set_input_report_callback() function and its context, only
+	   set and called under callback_mutex, which is apart from mutex so
+	   that the function can call hid_cancel_read(). */
+	hid_input_report_callback input_callback;
+	void *input_callback_context;
+	pthread_mutex_t callback_mutex;
+
+	/* Set by hid_shutdown(), so that it is only done once. */
+	int shutdown_started;
 };
 
+/* Makes read_pipe readable or not, to match whether hid_read() would return
+   at once, because a report is waiting or the read thread has stopped. Called
+   with the mutex held. */
+static void signal_read_fd(hid_device *dev, int ready)
+{
+	char byte = 0;
+
+	if (dev->read_pipe[0] < 0 || dev->read_fd_ready == ready)
+		return;
+
+	if (ready) {
+		if (write(dev->read_pipe[1], &byte, 1) == 1)
+			dev->read_fd_ready = 1;
+	}
+	else {
+		if (read(dev->read_pipe[0], &byte, 1) == 1)
+			dev->read_fd_ready = 0;
+	}
+}
+
 static hid_device *new_hid_device(void)
 {
 	hid_device *dev = calloc(1, sizeof(hid_device));
@@ -133,13 +182,34 @@ static hid_device *new_hid_device(void)
 	dev->input_report_buf = NULL;
 	dev->input_reports = NULL;
 	dev->shutdown_thread = 0;
+	dev->shutdown_started = 0;
+	dev->read_cancelled = 0;
+	dev->spin_budget_us = 0;
+	dev->spin_hits = 0;
+	dev->spin_sleeps = 0;
+	dev->spin_ns = 0;
 
 	/* Thread objects */
 	pthread_mutex_init(&dev->mutex, NULL);
+	pthread_mutex_init(&dev->callback_mutex, NULL);
 	pthread_cond_init(&dev->condition, NULL);
 	pthread_barrier_init(&dev->barrier, NULL, 2);
 	pthread_barrier_init(&dev->shutdown_barrier, NULL, 2);
 
+	/* The pipe behind hid_get_read_fd(). */
+	dev->read_fd_ready = 0;
+	if (pipe(dev->read_pipe) == 0) {
+		int i;
+		for (i = 0; i < 2; i++) {
+			fcntl(dev->read_pipe[i], F_SETFL, fcntl(dev->read_pipe[i], F_GETFL) | O_NONBLOCK);
+			fcntl(dev->read_pipe[i], F_SETFD, FD_CLOEXEC);
+		}
+	}
+	else {
+		dev->read_pipe[0] = -1;
+		dev->read_pipe[1] = -1;
+	}
+
 	return dev;
 }
 
@@ -166,11 +236,17 @@ static void free_hid_device(hid_device *dev)
 		CFRelease(dev->source);
 	free(dev->input_report_buf);
 
+	if (dev->read_pipe[0] >= 0) {
+		close(dev->read_pipe[0]);
+		close(dev->read_pipe[1]);
+	}
+
 	/* Clean up the thread objects */
 	pthread_barrier_destroy(&dev->shutdown_barrier);
 	pthread_barrier_destroy(&dev->barrier);
 	pthread_cond_destroy(&dev->condition);
 	pthread_mutex_destroy(&dev->mutex);
+	pthread_mutex_destroy(&dev->callback_mutex);
 
 	/* Free the structure itself. */
 	free(dev);
@@ -331,6 +407,27 @@ static wchar_t *dup_wcs(const wchar_t *s)
 }
 
 
+/* The HID_BUS_* value for the device's transport property. */
+static int get_bus_type(IOHIDDeviceRef device)
+{
+	char transport[32];
+
+	if (!get_string_property_utf8(device, CFSTR(kIOHIDTransportKey),
+	                              transport, sizeof(transport)))
+		return HID_BUS_UNKNOWN;
+
+	if (strcmp(transport, "USB") == 0)
+		return HID_BUS_USB;
+	if (strncmp(transport, "Bluetooth", 9) == 0)
+		return HID_BUS_BLUETOOTH;
+	if (strcmp(transport, "I2C") == 0)
+		return HID_BUS_I2C;
+	if (strcmp(transport, "SPI") == 0)
+		return HID_BUS_SPI;
+
+	return HID_BUS_UNKNOWN;
+}
+
 static int make_path(IOHIDDeviceRef device, char *buf, size_t len)
 {
 	int res;
@@ -488,6 +585,8 @@ struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id,
 
 			/* Interface Number (Unsupported on Mac)*/
 			cur_dev->interface_number = -1;
+
+			cur_dev->bus_type = get_bus_type(dev);
 		}
 	}
 
@@ -497,6 +596,66 @@ struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id,
 	return root;
 }
 
+struct hid_device_info  HID_API_EXPORT *hid_enumerate_ex(unsigned short vendor_id, unsigned short product_id, int flags)
+{
+	/* The strings are properties already cached by the IOHIDManager,
+	   so there is nothing to gain by deferring them. */
+	(void) flags;
+
+	return hid_enumerate(vendor_id, product_id);
+}
+
+struct hid_device_info  HID_API_EXPORT *hid_enumerate_filtered(const struct hid_enumerate_filter *filter, int flags)
+{
+	struct hid_device_info *root;
+	struct hid_device_info **link;
+
+	/* Everything the filter looks at is an IOHIDManager property, so
+	   there is no expensive work to skip. The list is filtered after
+	   it is built. */
+	root = hid_enumerate_ex(filter->vendor_id, filter->product_id, flags);
+
+	link = &root;
+	while (*link) {
+		struct hid_device_info *d = *link;
+		int matches = 1;
+
+		if ((filter->match & HID_FILTER_USAGE_PAGE) && filter->usage_page != d->usage_page)
+			matches = 0;
+		if ((filter->match & HID_FILTER_USAGE) && filter->usage != d->usage)
+			matches = 0;
+		if ((filter->match & HID_FILTER_INTERFACE) && filter->interface_number != d->interface_number)
+			matches = 0;
+		if ((filter->match & HID_FILTER_BUS_TYPE) && filter->bus_type != d->bus_type)
+			matches = 0;
+		if ((filter->match & HID_FILTER_SERIAL_PREFIX) && filter->serial_prefix &&
+		    (!d->serial_number ||
+		     wcsncmp(d->serial_number, filter->serial_prefix, wcslen(filter->serial_prefix)) != 0))
+			matches = 0;
+
+		if (matches) {
+			link = &d->next;
+		}
+		else {
+			*link = d->next;
+			d->next = NULL;
+			hid_free_enumeration(d);
+		}
+	}
+
+	return root;
+}
+
+int HID_API_EXPORT hid_get_device_info_strings(struct hid_device_info *info)
+{
+	/* hid_enumerate_ex() always fills in the strings. */
+	if (!info || !info->serial_number ||
+	    !info->manufacturer_string || !info->product_string)
+		return -1;
+
+	return 0;
+}
+
 void  HID_API_EXPORT hid_free_enumeration(struct hid_device_info *devs)
 {
 	/* This function is identical to the Linux version. Platform independent. */
@@ -558,9 +717,28 @@ static void hid_device_removal_callback(void *context, IOReturn result,
 	CFRunLoopStop(d->run_loop);
 }
 
+/* Passes a report to the device's input report callback, if it has one,
+   rather than queueing it. Returns 1 if it did. Called on the read thread. */
+static int call_input_callback(hid_device *dev, const unsigned char *data, size_t length)
+{
+	int called = 0;
+
+	if (__atomic_load_n(&dev->input_callback, __ATOMIC_ACQUIRE) == NULL)
+		return 0;
+
+	pthread_mutex_lock(&dev->callback_mutex);
+	if (dev->input_callback) {
+		dev->input_callback(dev->input_callback_context, dev, data, length);
+		called = 1;
+	}
+	pthread_mutex_unlock(&dev->callback_mutex);
+
+	return called;
+}
+
 /* The Run Loop calls this function for each input report received.
    This function puts the data into a linked list to be picked up by
-   hid_read(). */
+   hid_read(), unless the device has an input report callback. */
 static void hid_report_callback(void *context, IOReturn result, void *sender,
                          IOHIDReportType report_type, uint32_t report_id,
                          uint8_t *report, CFIndex report_length)
@@ -568,6 +746,10 @@ static void hid_report_callback(void *context, IOReturn result, void *sender,
 	struct input_report *rpt;
 	hid_device *dev = context;
 
+	/* The input report callback has the report, it isn't queued. */
+	if (call_input_callback(dev, report, report_length))
+		return;
+
 	/* Make a new Input Report object */
 	rpt = calloc(1, sizeof(struct input_report));
 	rpt->data = calloc(1, report_length);
@@ -603,6 +785,7 @@ static void hid_report_callback(void *context, IOReturn result, void *sender,
 
 	/* Signal a waiting thread that there is data. */
 	pthread_cond_signal(&dev->condition);
+	signal_read_fd(dev, 1);
 
 	/* Unlock */
 	pthread_mutex_unlock(&dev->mutex);
@@ -671,6 +854,7 @@ static void *read_thread(void *param)
 	   signaled. */
 	pthread_mutex_lock(&dev->mutex);
 	pthread_cond_broadcast(&dev->condition);
+	signal_read_fd(dev, 1);
 	pthread_mutex_unlock(&dev->mutex);
 
 	/* Wait here until hid_close() is called and makes it past
@@ -810,9 +994,21 @@ static int return_data(hid_device *dev, unsigned char *data, size_t length)
 	dev->input_reports = rpt->next;
 	free(rpt->data);
 	free(rpt);
+	if (dev->input_reports == NULL && !dev->shutdown_thread && !dev->disconnected && !dev->read_cancelled)
+		signal_read_fd(dev, 0);
 	return len;
 }
 
+/* Helper function, so that this isn't duplicated in hid_read(). Ends a read
+   cancelled by hid_cancel_read(). Called with the mutex held. */
+static int take_cancel(hid_device *dev)
+{
+	__atomic_store_n(&dev->read_cancelled, 0, __ATOMIC_RELAXED);
+	if (dev->input_reports == NULL && !dev->shutdown_thread && !dev->disconnected)
+		signal_read_fd(dev, 0);
+	return HID_READ_CANCELLED;
+}
+
 static int cond_wait(const hid_device *dev, pthread_cond_t *cond, pthread_mutex_t *mutex)
 {
 	while (!dev->input_reports) {
@@ -826,6 +1022,8 @@ static int cond_wait(const hid_device *dev, pthread_cond_t *cond, pthread_mutex_
 		   to sleep. See the pthread_cond_timedwait() man page for
 		   details. */
 
+		if (dev->read_cancelled)
+			return HID_READ_CANCELLED;
 		if (dev->shutdown_thread || dev->disconnected)
 			return -1;
 	}
@@ -846,6 +1044,8 @@ static int cond_timedwait(const hid_device *dev, pthread_cond_t *cond, pthread_m
 		   to sleep. See the pthread_cond_timedwait() man page for
 		   details. */
 
+		if (dev->read_cancelled)
+			return HID_READ_CANCELLED;
 		if (dev->shutdown_thread || dev->disconnected)
 			return -1;
 	}
@@ -854,13 +1054,75 @@ static int cond_timedwait(const hid_device *dev, pthread_cond_t *cond, pthread_m
 
 }
 
+/* Busy waits without the mutex for up to the device's spin budget, or
+   *milliseconds if that is shorter, until a report is queued, the device is
+   disconnected, the read is cancelled or the read thread stops. Returns
+   1 if one is, otherwise 0 with the time spent taken off *milliseconds. The
+   list is only peeked at here, the read that follows takes it under the
+   mutex. */
+static int spin_for_report(hid_device *dev, int budget_us, int *milliseconds)
+{
+	struct timespec start, now;
+	long long budget_ns = budget_us * 1000LL;
+	long long elapsed_ns;
+	int ready;
+
+	if (*milliseconds > 0 && *milliseconds * 1000000LL < budget_ns)
+		budget_ns = *milliseconds * 1000000LL;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	do {
+		ready = __atomic_load_n(&dev->input_reports, __ATOMIC_ACQUIRE) != NULL
+		        || __atomic_load_n(&dev->disconnected, __ATOMIC_RELAXED)
+		        || __atomic_load_n(&dev->shutdown_thread, __ATOMIC_RELAXED)
+		        || __atomic_load_n(&dev->read_cancelled, __ATOMIC_RELAXED);
+		if (!ready) {
+#if defined(__x86_64__) || defined(__i386__)
+			__builtin_ia32_pause();
+#elif defined(__aarch64__)
+			__asm__ __volatile__("yield");
+#endif
+		}
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		elapsed_ns = (now.tv_sec - start.tv_sec) * 1000000000LL
+		             + (now.tv_nsec - start.tv_nsec);
+	} while (!ready && elapsed_ns < budget_ns);
+
+	__atomic_fetch_add(&dev->spin_ns, elapsed_ns, __ATOMIC_RELAXED);
+
+	if (ready) {
+		if (__atomic_load_n(&dev->input_reports, __ATOMIC_ACQUIRE) != NULL)
+			__atomic_fetch_add(&dev->spin_hits, 1, __ATOMIC_RELAXED);
+		return 1;
+	}
+
+	__atomic_fetch_add(&dev->spin_sleeps, 1, __ATOMIC_RELAXED);
+	if (*milliseconds > 0) {
+		*milliseconds -= (int) (elapsed_ns / 1000000);
+		if (*milliseconds < 0)
+			*milliseconds = 0;
+	}
+	return 0;
+}
+
 int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds)
 {
 	int bytes_read = -1;
+	int budget_us = __atomic_load_n(&dev->spin_budget_us, __ATOMIC_RELAXED);
+
+	if (milliseconds != 0 && budget_us > 0)
+		spin_for_report(dev, budget_us, &milliseconds);
 
 	/* Lock the access to the report list. */
 	pthread_mutex_lock(&dev->mutex);
 
+	/* hid_cancel_read() was called before this read. */
+	if (dev->read_cancelled) {
+		bytes_read = take_cancel(dev);
+		goto ret;
+	}
+
 	/* There's an input report queued up. Return it. */
 	if (dev->input_reports) {
 		/* Return the first one */
@@ -890,6 +1152,8 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 		res = cond_wait(dev, &dev->condition, &dev->mutex);
 		if (res == 0)
 			bytes_read = return_data(dev, data, length);
+		else if (res == HID_READ_CANCELLED)
+			bytes_read = take_cancel(dev);
 		else {
 			/* There was an error, or a device disconnection. */
 			bytes_read = -1;
@@ -912,6 +1176,8 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 		res = cond_timedwait(dev, &dev->condition, &dev->mutex, &ts);
 		if (res == 0)
 			bytes_read = return_data(dev, data, length);
+		else if (res == HID_READ_CANCELLED)
+			bytes_read = take_cancel(dev);
 		else if (res == ETIMEDOUT)
 			bytes_read = 0;
 		else
@@ -941,6 +1207,52 @@ int HID_API_EXPORT hid_set_nonblocking(hid_device *dev, int nonblock)
 	return 0;
 }
 
+int HID_API_EXPORT hid_set_spin_budget(hid_device *dev, int microseconds)
+{
+	if (microseconds < 0)
+		return -1;
+
+	__atomic_store_n(&dev->spin_budget_us, microseconds, __ATOMIC_RELAXED);
+	return 0;
+}
+
+int HID_API_EXPORT hid_get_spin_stats(hid_device *dev, struct hid_spin_stats *stats)
+{
+	if (!stats)
+		return -1;
+
+	stats->spin_hits = __atomic_load_n(&dev->spin_hits, __ATOMIC_RELAXED);
+	stats->sleeps = __atomic_load_n(&dev->spin_sleeps, __ATOMIC_RELAXED);
+	stats->spin_us = __atomic_load_n(&dev->spin_ns, __ATOMIC_RELAXED) / 1000;
+	return 0;
+}
+
+int HID_API_EXPORT hid_cancel_read(hid_device *dev)
+{
+	pthread_mutex_lock(&dev->mutex);
+	__atomic_store_n(&dev->read_cancelled, 1, __ATOMIC_RELAXED);
+	pthread_cond_broadcast(&dev->condition);
+	signal_read_fd(dev, 1);
+	pthread_mutex_unlock(&dev->mutex);
+
+	return 0;
+}
+
+int HID_API_EXPORT hid_set_input_report_callback(hid_device *dev, hid_input_report_callback callback, void *context)
+{
+	pthread_mutex_lock(&dev->callback_mutex);
+	dev->input_callback_context = context;
+	__atomic_store_n(&dev->input_callback, callback, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&dev->callback_mutex);
+
+	return 0;
+}
+
+int HID_API_EXPORT hid_get_read_fd(hid_device *dev)
+{
+	return dev->read_pipe[0];
+}
+
 int HID_API_EXPORT hid_send_feature_report(hid_device *dev, const unsigned char *data, size_t length)
 {
 	return set_report(dev, kIOHIDReportTypeFeature, data, length);
@@ -965,10 +1277,42 @@ int HID_API_EXPORT hid_get_feature_report(hid_device *dev, unsigned char *data,
 		return -1;
 }
 
+int HID_API_EXPORT hid_get_device_ids(hid_device *dev, unsigned short *vendor_id, unsigned short *product_id)
+{
+	if (dev->disconnected)
+		return -1;
 
-void HID_API_EXPORT hid_close(hid_device *dev)
+	*vendor_id = get_vendor_id(dev->device_handle);
+	*product_id = get_product_id(dev->device_handle);
+	return 0;
+}
+
+int HID_API_EXPORT hid_get_report_descriptor(hid_device *dev, unsigned char *buf, size_t buf_size)
 {
-	if (!dev)
+	CFTypeRef ref;
+	CFIndex len;
+
+	/* Return if the device has been unplugged. */
+	if (dev->disconnected)
+		return -1;
+
+	ref = IOHIDDeviceGetProperty(dev->device_handle, CFSTR(kIOHIDReportDescriptorKey));
+	if (!ref || CFGetTypeID(ref) != CFDataGetTypeID())
+		return -1;
+
+	len = CFDataGetLength((CFDataRef) ref);
+	if ((size_t) len > buf_size)
+		len = buf_size;
+	CFDataGetBytes((CFDataRef) ref, CFRangeMake(0, len), buf);
+
+	return len;
+}
+
+
+void HID_API_EXPORT hid_shutdown(hid_device *dev)
+{
+	/* May be called from another thread alongside hid_close()'s own call. */
+	if (!dev || __atomic_exchange_n(&dev->shutdown_started, 1, __ATOMIC_ACQ_REL))
 		return;
 
 	/* Disconnect the report callback before close. */
@@ -987,6 +1331,14 @@ void HID_API_EXPORT hid_close(hid_device *dev)
 	/* Wake up the run thread's event loop so that the thread can exit. */
 	CFRunLoopSourceSignal(dev->source);
 	CFRunLoopWakeUp(dev->run_loop);
+}
+
+void HID_API_EXPORT hid_close(hid_device *dev)
+{
+	if (!dev)
+		return;
+
+	hid_shutdown(dev);
 
 	/* Notify the read thread that it can shut down now. */
 	pthread_barrier_wait(&dev->shutdown_barrier);
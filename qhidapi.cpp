@@ -41,6 +41,14 @@
    You can use enumerate to generate a list of available devices. The vendor and
   product id's can then be used to \c open() the devices.
 
+   One QHidApi can be shared by any number of threads. Finding a device by its id
+  takes no lock, being an index into a table of the open devices, and each
+  device has its own locks, one held while reading and one for every other call, so
+  calls on different devices never wait for each other and a blocking read doesn't
+  hold up writes to the same device. Opening and closing devices and enumerating
+  take locks of their own. A device closed while another thread is still using it
+  is released when that call returns.
+
    HIDAPI is a multi-platform library which allows an application to interface
   with USB and Bluetooth HID-Class devices on Windows, Linux, and Mac OS X. While
   it can be used to communicate with standard HID devices like keyboards, mice,
@@ -91,13 +99,30 @@ QHidApi::QHidApi(ushort vendorId, ushort productId, QObject* parent) :
 {
 }
 
+/*!
+   \brief Destructor of QHidApi class.
+
+   The readers started by startReader() are stopped and deleted first, as they hold
+   devices, then every device is closed, the futures' calls are waited for and hidapi
+   is finalized.
+*/
 QHidApi::~QHidApi()
 {
+  const QList<QHidReaderThread*> readers = findChildren<QHidReaderThread*>();
+
+  for (QHidReaderThread* reader : readers) {
+    delete reader;
+  }
+
+  delete d_ptr;
 }
 
 /*!
    \brief Get The Manufacturer String from a HID device.
 
+   The string is read from the device the first time it is asked for and
+   the same QString is returned after that, until the device is closed.
+
    \param id A quint32 device id.
 
    \return a QString containing the manufacturers name string, otherwise an empty QString.
@@ -110,6 +135,9 @@ QString QHidApi::manufacturerString(quint32 deviceId)
 /*!
    \brief Get The Product String from a HID device.
 
+   The string is read from the device the first time it is asked for and
+   the same QString is returned after that, until the device is closed.
+
    \param id A quint32 device id.
 
    \return a QString containing the product name string, otherwise an empty QString.
@@ -122,6 +150,9 @@ QString QHidApi::productString(quint32 deviceId)
 /*!
    \brief Get The Serial Number String from a HID device.
 
+   The string is read from the device the first time it is asked for and
+   the same QString is returned after that, until the device is closed.
+
    \param id A quint32 device id.
 
    \return a QString containing the Serial number string, otherwise an empty QString.
@@ -165,13 +196,56 @@ QString QHidApi::indexedString(quint32 deviceId, int index)
    \endcode
    will return the all devices of the specified manufacturer and product id's.
 
+   Reading the serial number, manufacturer and product strings is the slow part of
+   enumeration on some platforms, as each needs a request to the device. If you only
+   need to filter on the id's pass QHidApi::LazyStrings, the strings will then be
+   read the first time QHidDeviceInfo::serial(), manufacturer() or product() is called,
+   from any thread, and shared by every copy of the QHidDeviceInfo.
+   \code
+       enumerate(0xafaf, 0x0735, QHidApi::LazyStrings);
+   \endcode
+
+   On Linux QHidApi::SysfsEnumeration reads /sys/class/hidraw directly instead of
+   going through libudev, which is much quicker when there are a lot of devices.
+   It is ignored on the other platforms.
+
+   With the libusb backend QHidApi::ParallelStrings reads the strings of several
+   devices at the same time, which helps a lot with many devices on slow hubs. The
+   devices are returned in the same order either way.
+
    \param vendorId - an optional unsigned int vendor id
    \param productId - an optional unsigned int product id.
+   \param options - an optional set of EnumerateOptions.
    \return a QList<HidDeviceInfo> containing all relevant devices, or an empty list if no devices match.
 */
-QList<QHidDeviceInfo> QHidApi::enumerate(ushort vendorId, ushort productId)
+QList<QHidDeviceInfo> QHidApi::enumerate(ushort vendorId, ushort productId, EnumerateOptions options)
 {
-  return d_ptr->enumerate(vendorId, productId);
+  return d_ptr->enumerate(vendorId, productId, options);
+}
+
+/*!
+   \brief Enumerates the HID Devices which match a filter.
+
+   As enumerate(ushort, ushort, EnumerateOptions), but besides the vendor and product
+   ids the devices must also match the usage page, usage, interface number, bus type
+   and serial number prefix set on filter. The conditions are checked inside hidapi
+   before the strings are read, so this is much cheaper than enumerating everything
+   and filtering the list.
+   \code
+       QHidEnumerationFilter filter;
+       filter.setUsagePage(0xff00);
+       filter.setBusType(QHidDeviceInfo::UsbBus);
+       enumerate(filter, QHidApi::LazyStrings);
+   \endcode
+   will return all vendor defined interfaces on USB.
+
+   \param filter - the devices to return.
+   \param options - an optional set of EnumerateOptions.
+   \return a QList<HidDeviceInfo> containing all relevant devices, or an empty list if no devices match.
+*/
+QList<QHidDeviceInfo> QHidApi::enumerate(const QHidEnumerationFilter& filter, EnumerateOptions options)
+{
+  return d_ptr->enumerate(filter, options);
 }
 
 /*!
@@ -181,6 +255,10 @@ QList<QHidDeviceInfo> QHidApi::enumerate(ushort vendorId, ushort productId)
    is NULL, the first device with the specified VID and PID is opened. The method returns an id number
    which should be retained as it is used to identify the device that you wish to access.
 
+   Devices with a serial number are looked up in an index of the paths found by the last
+   enumerate(), so reopening a known device doesn't enumerate again. Only a device which
+   isn't in the index, or whose path has changed, causes a fresh enumeration.
+
    \param vendorId The Vendor ID (VID) of the device to open.
    \param productId The Product ID (PID) of the device to open.
    \param serialNumber The Serial Number of the device to open (Optionally NULL).
@@ -194,6 +272,10 @@ quint32 QHidApi::open(ushort vendorId, ushort productId, QString serialNumber)
 /*!
    \brief Closes the specified device if it exists, otherwise this command is ignored.
 
+   The id is not valid after this. Ids are never reused, as a slot is retired once
+   its 65535 generations are used up, so calls made with it later are ignored
+   rather than reaching a device opened since.
+
    \param id - the quint32 id for the device.
 */
 void QHidApi::close(quint32 deviceId)
@@ -201,6 +283,31 @@ void QHidApi::close(quint32 deviceId)
   return d_ptr->close(deviceId);
 }
 
+/*!
+   \brief Closes the devices with ids, ignoring those which aren't open.
+
+   As close(quint32) for each, but quicker for many devices. On libusb and Mac the read
+   thread of every device is told to stop before any is waited for, so they all wind
+   down together rather than one after another. Reads of the devices which other
+   threads are making may fail rather than finish.
+
+   \param ids - the quint32 ids of the devices.
+*/
+void QHidApi::close(const QList<quint32>& ids)
+{
+  d_ptr->close(ids);
+}
+
+/*!
+   \brief Closes every open device, as close(const QList<quint32>&).
+
+   The QHidApi is left usable, devices can be opened again afterwards.
+*/
+void QHidApi::closeAll()
+{
+  d_ptr->closeAll();
+}
+
 /*!
    \brief  Read an Input report from a HID device into a QByteArray.
 
@@ -234,6 +341,76 @@ QByteArray QHidApi::read(quint32 deviceId, int timeout)
   return d_ptr->read(deviceId, timeout);
 }
 
+/*!
+   \brief  Read an Input report from a HID device into report, with timeout, telling how the read ended.
+
+   As read(quint32, int), but the return value tells a timeout, an error and a read ended by
+   cancelRead() apart, where the other reads return an empty QByteArray for all three.
+
+   \param id A quint32 device id.
+   \param report Set to the report read, left alone if there was none.
+   \param timeout timeout in milliseconds or -1 for blocking wait.
+
+   \return Returns the size of the report, 0 if none came within timeout milliseconds,
+   ReadCancelled if the read was cancelled or -1 on error or if the device isn't open.
+*/
+int QHidApi::read(quint32 id, QByteArray& report, int timeout)
+{
+  return d_ptr->read(id, report, timeout);
+}
+
+/*!
+   \brief Makes a read of the device, waiting on another thread, return at once.
+
+   A read(), readFuture() or QHidReaderThread read waiting for a report stops waiting,
+   however long its timeout, read(quint32, QByteArray&, int) returning ReadCancelled and
+   the others no report. If no read is waiting, the next one is cancelled instead, so a
+   cancel made just before a read starts isn't lost, and several cancels before a read
+   cancel only that one.
+
+   This can be called from any thread, and doesn't wait for the read it cancels. A
+   readAsync() waiting on the device's descriptor sees the cancel within a few tens of
+   milliseconds and resumes with no report.
+
+   \param id  A quint32 device id.
+   \return Returns true on success and false on error, or if the device isn't open.
+*/
+bool QHidApi::cancelRead(quint32 id)
+{
+  return d_ptr->cancelRead(id);
+}
+
+/*!
+   \brief Has every input report of the device passed straight to handler.
+
+   \code
+       auto parse = [&parser](quint32 id, const uchar* data, int size) {
+           parser.parse(id, data, size);
+       };
+       api->setReportHandler(id, parse);
+   \endcode
+   The handler is given a view of the buffer the report was received into, valid only
+   during the call, with no QByteArray made, no queue and no event loop in between. On
+   libusb and Mac it is called on hidapi's read thread for the device as each report
+   arrives. Linux and Windows have no such thread, so there it is called on the thread
+   reading the device, usually a QHidReaderThread, whose reads then return no report.
+   Either way the handler must be quick and thread safe. It can write to the device and
+   make other calls on it, but mustn't read it, close it or set its handler.
+
+   The reports don't reach read(), readFuture(), readAsync(), a QHidReaderThread's queue
+   or value() while a handler is set. QHidReportHandler doesn't own what it refers to, so
+   a lambda with captures must outlive the handler. Once this returns the old handler
+   isn't being called.
+
+   \param id  A quint32 device id.
+   \param handler the handler, or an empty QHidReportHandler to go back to read().
+   \return Returns true on success and false on error, or if the device isn't open.
+*/
+bool QHidApi::setReportHandler(quint32 id, QHidReportHandler handler)
+{
+  return d_ptr->setReportHandler(id, handler);
+}
+
 /*!
    \brief Get a feature report from a HID device.
 
@@ -251,6 +428,167 @@ QByteArray QHidApi::featureReport(quint32 deviceId, uint reportId)
   return d_ptr->featureReport(deviceId, reportId);
 }
 
+/*!
+   \brief Get the parsed report descriptor of a HID device.
+
+   The descriptor is read from the device and parsed the first time it is asked for
+   and the same QHidReportDescriptor is returned after that, until the device is closed.
+   Its fields give the layout of every report, so the data returned by read() and
+   featureReport() can be decoded without hard coded offsets.
+   \code
+       QHidReportDescriptor descriptor = api->reportDescriptor(id);
+       for (const QHidReportField& field : descriptor.fields(QHidReportField::InputReport)) {
+           // field.usagePage, field.usage, field.bitOffset, field.bitSize...
+       }
+   \endcode
+
+   \param id A quint32 device id.
+
+   \return the parsed descriptor, which is invalid if the descriptor couldn't be read
+   or parsed. The descriptor can't be read on Windows.
+*/
+QHidReportDescriptor QHidApi::reportDescriptor(quint32 deviceId)
+{
+  return d_ptr->reportDescriptor(deviceId);
+}
+
+/*!
+   \brief Resolve a usage of a device to a handle for valueAt().
+
+   The usage is looked up in the device's report descriptor once, and the handle is
+   an index into the locations resolved for the device, so valueAt() doesn't look
+   anything up. Handles are valid until the device is closed.
+
+   \param id A quint32 device id.
+   \param usagePage the usage page of the value.
+   \param usage the usage of the value.
+   \param type the kind of report the value is in.
+
+   \return the handle, or -1 if the device has no such value.
+*/
+int QHidApi::resolveUsage(quint32 id, ushort usagePage, ushort usage,
+                          QHidReportField::ReportType type)
+{
+  return d_ptr->resolveUsage(id, usagePage, usage, type);
+}
+
+/*!
+   \brief The value of a handle returned by resolveUsage().
+
+   An input value is read from the last input report holding it, an output or feature
+   value from the report last built by setValue().
+
+   \param id A quint32 device id.
+   \param handle a handle returned by resolveUsage().
+   \param ok set false if there is no such value or no report holding it yet.
+
+   \return the value, or 0 on error.
+*/
+qint32 QHidApi::valueAt(quint32 id, int handle, bool* ok)
+{
+  return d_ptr->valueAt(id, handle, ok);
+}
+
+/*!
+   \brief The value of a usage in the last input report read from a device.
+
+   The value is found through the device's report descriptor, so the report id and
+   the bit offset, size and sign of the value don't need to be known. The usage is
+   resolved the first time and the resolution is kept until the device is closed.
+   A usage in the range of an Array field, a key of a keyboard for example, reads as 1
+   while it is in the report and 0 when it isn't.
+
+   Input reports are kept from when the device is opened, so a value can be asked for
+   after any read.
+   \code
+       api->read(id);
+       bool ok;
+       qint32 x = api->value(id, 0x01, 0x30, &ok);
+   \endcode
+
+   \param id A quint32 device id.
+   \param usagePage the usage page of the value.
+   \param usage the usage of the value.
+   \param ok set false if there is no such value or no report holding it yet.
+
+   \return the value, or 0 on error.
+*/
+qint32 QHidApi::value(quint32 id, ushort usagePage, ushort usage, bool* ok)
+{
+  return d_ptr->value(id, usagePage, usage, ok);
+}
+
+/*!
+   \brief The values of several usages in the last input reports read from a device.
+
+   \param id A quint32 device id.
+   \param usages the usages of the values.
+
+   \return the values in the order of usages, 0 for any which can't be read.
+*/
+QVector<qint32> QHidApi::values(quint32 id, const QVector<QHidUsage>& usages)
+{
+  return d_ptr->values(id, usages);
+}
+
+/*!
+   \brief Set the value of a usage in an output or feature report and send the report.
+
+   The report is built by a QHidReportEncoder kept for the device, so the other values
+   of the report are those last set, or 0.
+
+   \param id A quint32 device id.
+   \param usagePage the usage page of the value.
+   \param usage the usage of the value.
+   \param value the value, clamped to the logical range of its field.
+   \param type OutputReport or FeatureReport.
+
+   \return the number of bytes written, or -1 on error.
+*/
+int QHidApi::setValue(quint32 id, ushort usagePage, ushort usage, qint32 value,
+                      QHidReportField::ReportType type)
+{
+  return d_ptr->setValue(id, usagePage, usage, value, type);
+}
+
+/*!
+   \brief Build an output report from usage and value pairs and write it to a HID device.
+
+   The report is built by a QHidReportEncoder compiled from the device's report descriptor
+   the first time, and kept until the device is closed. Each value is clamped to the
+   logical range of its field and packed into the encoder's buffer for the report, which
+   keeps the values of the fields not given from the last time, and the report is then
+   written as write(quint32, QByteArray) writes it.
+   \code
+       api->write(id, { QHidUsageValue(0x08, 0x01, 1),     // Num Lock on
+                        QHidUsageValue(0x08, 0x02, 0) });  // Caps Lock off
+   \endcode
+
+   \param id A quint32 device id.
+   \param values the values, all of which must be in the same report.
+
+   \return the number of bytes written, or -1 on error.
+*/
+int QHidApi::write(quint32 id, const QVector<QHidUsageValue>& values)
+{
+  return d_ptr->write(id, values);
+}
+
+/*!
+   \brief Build a feature report from usage and value pairs and send it to a HID device.
+
+   As write(quint32, const QVector<QHidUsageValue>&), for a feature report.
+
+   \param id A quint32 device id.
+   \param values the values, all of which must be in the same report.
+
+   \return the number of bytes written, or -1 on error.
+*/
+int QHidApi::sendFeatureReport(quint32 id, const QVector<QHidUsageValue>& values)
+{
+  return d_ptr->sendFeatureReport(id, values);
+}
+
 /*!
    \brief  Write an Feature report to a HID device.
 
@@ -317,6 +655,283 @@ QString QHidApi::error(quint32 deviceId)
   return d_ptr->error(deviceId);
 }
 
+/*!
+   \brief Starts a thread of its own reading the input reports of a device.
+
+   The reports are delivered through the lock free QHidReportQueue of the returned
+   QHidReaderThread. The thread can be pinned to CPUs, run at SCHED_FIFO priority and
+   lock the process's memory, as set in options, so that reads aren't preempted by
+   other work and the time from read to consumer stays bounded. Don't call read() for
+   the device while the reader runs.
+
+   \param id A quint32 device id.
+   \param options how the thread runs.
+   \return the reader, which is owned by this QHidApi, or nullptr if the device isn't open.
+*/
+QHidReaderThread* QHidApi::startReader(quint32 id, const QHidReaderOptions& options)
+{
+  return d_ptr->startReader(QList<quint32>() << id, options);
+}
+
+/*!
+   \brief Starts one thread reading the input reports of a group of devices.
+
+   As startReader(quint32, const QHidReaderOptions&), with the reports of every device
+   in the one queue, each tagged with its device's id. The devices are polled in turn,
+   so while idle a report may wait up to QHidReaderOptions::pollInterval milliseconds.
+
+   \param ids the quint32 device ids, of which those that aren't open are left out.
+   \param options how the thread runs.
+   \return the reader, which is owned by this QHidApi, or nullptr if none of the devices is open.
+*/
+QHidReaderThread* QHidApi::startReader(const QList<quint32>& ids, const QHidReaderOptions& options)
+{
+  return d_ptr->startReader(ids, options);
+}
+
+/*!
+   \brief enumerate() without blocking the calling thread.
+
+   The QFuture functions run the blocking calls on a small thread pool of the QHidApi's
+   own, so a GUI thread never waits for an enumeration or a slow control transfer. Calls
+   on the same device run one at a time, in the order they were made, and calls on
+   different devices run side by side. Reads are the exception, they are ordered among
+   themselves but run alongside the other calls on the device, on threads of their own,
+   so a command sent with sendFeatureReportFuture() isn't held up by a readFuture()
+   waiting for its response. Cancelling a future skips its call if it hasn't
+   started yet, and ends the wait of readFuture().
+
+   With Qt 6 the futures are chained with QFuture::then(). With Qt 5, which has no
+   continuations, watch them with a QFutureWatcher.
+   \code
+       QFutureWatcher<QList<QHidDeviceInfo>>* watcher = new QFutureWatcher<QList<QHidDeviceInfo>>(this);
+       connect(watcher, &QFutureWatcherBase::finished, this, [this, watcher] {
+           showDevices(watcher->result());
+           watcher->deleteLater();
+       });
+       watcher->setFuture(api->enumerateFuture(0x0, 0x0, QHidApi::LazyStrings));
+   \endcode
+
+   \param vendorId - an optional unsigned int vendor id
+   \param productId - an optional unsigned int product id.
+   \param options - an optional set of QHidApi::EnumerateOptions.
+   \return a future of the list enumerate() returns.
+*/
+QFuture<QList<QHidDeviceInfo>> QHidApi::enumerateFuture(ushort vendorId, ushort productId,
+                                                        EnumerateOptions options)
+{
+  return d_ptr->enumerateFuture(vendorId, productId, options);
+}
+
+/*!
+   \brief enumerate() with a filter, without blocking the calling thread, see
+   enumerateFuture(ushort, ushort, EnumerateOptions).
+
+   \param filter the devices to return.
+   \param options - an optional set of QHidApi::EnumerateOptions.
+   \return a future of the list enumerate() returns.
+*/
+QFuture<QList<QHidDeviceInfo>> QHidApi::enumerateFuture(const QHidEnumerationFilter& filter,
+                                                        EnumerateOptions options)
+{
+  return d_ptr->enumerateFuture(filter, options);
+}
+
+/*!
+   \brief open() without blocking the calling thread, see
+   enumerateFuture(ushort, ushort, EnumerateOptions).
+
+   \param vendorId The Vendor ID (VID) of the device to open.
+   \param productId The Product ID (PID) of the device to open.
+   \param serialNumber The Serial Number of the device to open (Optionally empty).
+   \return a future of the device id, 0 if the device couldn't be opened.
+*/
+QFuture<quint32> QHidApi::openFuture(ushort vendorId, ushort productId,
+                                     const QString& serialNumber)
+{
+  return d_ptr->openFuture(vendorId, productId, serialNumber);
+}
+
+/*!
+   \brief open() by path without blocking the calling thread, see
+   enumerateFuture(ushort, ushort, EnumerateOptions).
+
+   \param path - the path to the device
+   \return a future of the device id, 0 if the device couldn't be opened.
+*/
+QFuture<quint32> QHidApi::openFuture(const QString& path)
+{
+  return d_ptr->openFuture(path);
+}
+
+/*!
+   \brief read() with a timeout, without blocking the calling thread, see
+   enumerateFuture(ushort, ushort, EnumerateOptions).
+
+   Cancelling the future, or closing the device, ends the wait within a few tens of
+   milliseconds. The other futures of the device don't wait for the read.
+
+   \param id A quint32 device id.
+   \param timeout timeout in milliseconds or -1 to wait until a report comes or the
+   future is cancelled.
+   \return a future of the report, which is empty if none came or on error.
+*/
+QFuture<QByteArray> QHidApi::readFuture(quint32 id, int timeout)
+{
+  return d_ptr->readFuture(id, timeout);
+}
+
+/*!
+   \brief featureReport() without blocking the calling thread, see
+   enumerateFuture(ushort, ushort, EnumerateOptions).
+
+   \param id A quint32 device id.
+   \param reportId the report id of the report.
+   \return a future of the report, which is empty on error.
+*/
+QFuture<QByteArray> QHidApi::featureReportFuture(quint32 id, uint reportId)
+{
+  return d_ptr->featureReportFuture(id, reportId);
+}
+
+/*!
+   \brief sendFeatureReport() without blocking the calling thread, see
+   enumerateFuture(ushort, ushort, EnumerateOptions).
+
+   \param id A quint32 device id.
+   \param reportId the report id
+   \param data The data to send, excluding the report number as the first byte.
+   \return a future of the number of bytes written, or -1 on error.
+*/
+QFuture<int> QHidApi::sendFeatureReportFuture(quint32 id, quint8 reportId, const QByteArray& data)
+{
+  return d_ptr->sendFeatureReportFuture(id, reportId, data);
+}
+
+/*!
+   \brief manufacturerString() without blocking the calling thread, see
+   enumerateFuture(ushort, ushort, EnumerateOptions).
+
+   \param id A quint32 device id.
+   \return a future of the string, empty on error.
+*/
+QFuture<QString> QHidApi::manufacturerStringFuture(quint32 id)
+{
+  return d_ptr->manufacturerStringFuture(id);
+}
+
+/*!
+   \brief productString() without blocking the calling thread, see
+   enumerateFuture(ushort, ushort, EnumerateOptions).
+
+   \param id A quint32 device id.
+   \return a future of the string, empty on error.
+*/
+QFuture<QString> QHidApi::productStringFuture(quint32 id)
+{
+  return d_ptr->productStringFuture(id);
+}
+
+/*!
+   \brief serialNumberString() without blocking the calling thread, see
+   enumerateFuture(ushort, ushort, EnumerateOptions).
+
+   \param id A quint32 device id.
+   \return a future of the string, empty on error.
+*/
+QFuture<QString> QHidApi::serialNumberStringFuture(quint32 id)
+{
+  return d_ptr->serialNumberStringFuture(id);
+}
+
+/*!
+   \brief indexedString() without blocking the calling thread, see
+   enumerateFuture(ushort, ushort, EnumerateOptions).
+
+   \param id A quint32 device id.
+   \param index The index of the string to get.
+   \return a future of the string, empty on error.
+*/
+QFuture<QString> QHidApi::indexedStringFuture(quint32 id, int index)
+{
+  return d_ptr->indexedStringFuture(id, index);
+}
+
+#ifdef QHIDAPI_COROUTINES
+
+/*!
+   \brief Reads an input report from a coroutine, as read(), without blocking a thread.
+
+   \code
+       QByteArray report = co_await api->readAsync(id);
+   \endcode
+   The coroutine is suspended until a report comes and is then resumed from the event
+   loop of this QHidApi's thread, see QHidReadAwaitable. Only built with C++20
+   coroutines.
+
+   \param id A quint32 device id.
+   \return an awaitable of the report, which is empty on error or if the device isn't open.
+*/
+QHidReadAwaitable QHidApi::readAsync(quint32 id)
+{
+  return QHidReadAwaitable(this, d_ptr, id);
+}
+
+/*!
+   \brief Writes an output report from a coroutine, as write(quint32, QByteArray).
+
+   Writes are synchronous in every backend, with nothing to wait on, so the write is
+   made on the thread pool of the futures, in turn with the device's other futures,
+   and the coroutine resumed from the event loop of this QHidApi's thread. Destroying
+   the QHidApi waits for a write already started and skips the rest. Only built with
+   C++20 coroutines.
+
+   \param id A quint32 device id.
+   \param data the report, starting with its report id.
+   \return an awaitable of the number of bytes written, or -1 on error.
+*/
+QHidCallAwaitable<int> QHidApi::writeAsync(quint32 id, const QByteArray& data)
+{
+  QHidApiPrivate* d = d_ptr;
+  return QHidCallAwaitable<int>(this, [d, id, data] { return d->writeFuture(id, data); });
+}
+
+/*!
+   \brief Gets a feature report from a coroutine, as featureReport(), on the thread
+   pool of the futures as writeAsync() does.
+
+   \param id A quint32 device id.
+   \param reportId the report id of the report.
+   \return an awaitable of the report, which is empty on error.
+*/
+QHidCallAwaitable<QByteArray> QHidApi::featureReportAsync(quint32 id, uint reportId)
+{
+  QHidApiPrivate* d = d_ptr;
+  return QHidCallAwaitable<QByteArray>(this, [d, id, reportId] {
+    return d->featureReportFuture(id, reportId);
+  });
+}
+
+/*!
+   \brief Sends a feature report from a coroutine, as sendFeatureReport(), on the
+   thread pool of the futures as writeAsync() does.
+
+   \param id A quint32 device id.
+   \param reportId the report id of the report.
+   \param data the report, without its report id.
+   \return an awaitable of the number of bytes written, or -1 on error.
+*/
+QHidCallAwaitable<int> QHidApi::sendFeatureReportAsync(quint32 id, quint8 reportId,
+    const QByteArray& data)
+{
+  QHidApiPrivate* d = d_ptr;
+  return QHidCallAwaitable<int>(this, [d, id, reportId, data] {
+    return d->sendFeatureReportFuture(id, reportId, data);
+  });
+}
+
+#endif // QHIDAPI_COROUTINES
+
 /*!
    \brief  Set the device handle to be blocking.
 
@@ -349,6 +964,36 @@ bool QHidApi::setNonBlocking(quint32 deviceId)
   return d_ptr->setNonBlocking(deviceId);
 }
 
+/*!
+   \brief Sets how long a read of the device spins before it sleeps.
+
+   A read that has to wait for a report first checks for one without sleeping, over
+   and over, for up to microseconds, and only then sleeps for the rest of its timeout.
+   A report which comes while spinning is picked up in a few microseconds, without the
+   wake up latency of the sleep, at the cost of keeping a CPU busy, so the budget is
+   best kept for the devices which need it, read from a QHidReaderThread with a CPU of
+   its own. spinStats() shows how often the spinning pays off.
+
+   \param id  A quint32 device id.
+   \param microseconds the longest a read spins, 0 to never spin.
+   \return Returns true on success and false on error.
+*/
+bool QHidApi::setSpinBudget(quint32 id, int microseconds)
+{
+  return d_ptr->setSpinBudget(id, microseconds);
+}
+
+/*!
+   \brief The counters of the device's spinning reads, since it was opened.
+
+   \param id  A quint32 device id.
+   \return the counters, all 0 if the device isn't open.
+*/
+QHidSpinStats QHidApi::spinStats(quint32 id)
+{
+  return d_ptr->spinStats(id);
+}
+
 /*!
    \brief Open a HID device by its path name.
 
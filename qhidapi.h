@@ -30,45 +30,134 @@
 #include <QList>
 #include <QVariant>
 #include <QByteArray>
+#include <QFuture>
+#include <QVector>
 #include <QList>
 
 #include "qhidapi_global.h"
 #include "qhiddeviceinfo.h"
+#include "qhidenumerationfilter.h"
+#include "qhidreportdescriptor.h"
+#include "qhidreportencoder.h"
+#include "qhidreaderthread.h"
+#include "qhidreporthandler.h"
+#include "qhidawaitable.h"
 
 class QHidApiPrivate;
 
+/** Counters of a device's spinning reads, see QHidApi::setSpinBudget(). */
+struct QHidSpinStats {
+  QHidSpinStats() :
+    spinHits(0),
+    sleeps(0),
+    spinMicroseconds(0) {}
+
+  /** Reads which found a report while spinning. */
+  quint64 spinHits;
+  /** Reads which spun for the whole budget and then slept. */
+  quint64 sleeps;
+  /** Time spent spinning, whether or not a report came. */
+  quint64 spinMicroseconds;
+};
+
 class QHIDAPISHARED_EXPORT QHidApi : public QObject
 {
 
   Q_OBJECT
 
-public: QHidApi(ushort vendorId, QObject* parent = nullptr);
+public:
+  /*!
+     \brief Options which change what enumerate() gathers for each device.
+  */
+  enum EnumerateOption {
+    NoEnumerateOptions = 0x0, //!< Read everything during enumeration.
+    LazyStrings = 0x1, //!< Defer the string reads until first use.
+    SysfsEnumeration = 0x2, //!< Linux only, read sysfs directly rather than through libudev.
+    ParallelStrings = 0x4, //!< libusb only, read the strings of several devices at once.
+  };
+  Q_DECLARE_FLAGS(EnumerateOptions, EnumerateOption)
+
+  /*!
+     \brief What read() returns, rather than a report size, for a read ended by cancelRead().
+  */
+  enum ReadStatus {
+    ReadCancelled = -2, //!< The read was cancelled, the same as HID_READ_CANCELLED.
+  };
+
+  QHidApi(ushort vendorId, QObject* parent = nullptr);
   QHidApi(ushort vendorId, ushort productId, QObject* parent = nullptr);
   QHidApi(QObject* parent = nullptr);
   ~QHidApi();
 
-  QList<QHidDeviceInfo> enumerate(ushort vendorId = 0x0, ushort productId = 0x0);
+  QList<QHidDeviceInfo> enumerate(ushort vendorId = 0x0, ushort productId = 0x0,
+                                  EnumerateOptions options = NoEnumerateOptions);
+  QList<QHidDeviceInfo> enumerate(const QHidEnumerationFilter& filter,
+                                  EnumerateOptions options = NoEnumerateOptions);
 
   quint32 open(ushort vendor_id, ushort product_id, QString serial_number = QString());
   quint32 open(QString path);
   void close(quint32 deviceId);
+  void close(const QList<quint32>& ids);
+  void closeAll();
   QByteArray read(quint32 deviceId);
   QByteArray read(quint32 id, int timeout);
+  int read(quint32 id, QByteArray& report, int timeout = -1);
+  bool cancelRead(quint32 id);
+  bool setReportHandler(quint32 id, QHidReportHandler handler);
   int write(quint32 id, QByteArray data, quint8 reportId);
   int write(quint32 id, QByteArray data);
   bool setBlocking(quint32 id);
   bool setNonBlocking(quint32 id);
+  bool setSpinBudget(quint32 id, int microseconds);
+  QHidSpinStats spinStats(quint32 id);
   QByteArray featureReport(quint32 id, uint reportId);
   int sendFeatureReport(quint32 id, quint8 reportId, QByteArray data);
+  QHidReportDescriptor reportDescriptor(quint32 id);
+  int resolveUsage(quint32 id, ushort usagePage, ushort usage,
+                   QHidReportField::ReportType type = QHidReportField::InputReport);
+  qint32 valueAt(quint32 id, int handle, bool* ok = nullptr);
+  qint32 value(quint32 id, ushort usagePage, ushort usage, bool* ok = nullptr);
+  QVector<qint32> values(quint32 id, const QVector<QHidUsage>& usages);
+  int setValue(quint32 id, ushort usagePage, ushort usage, qint32 value,
+               QHidReportField::ReportType type = QHidReportField::OutputReport);
+  int write(quint32 id, const QVector<QHidUsageValue>& values);
+  int sendFeatureReport(quint32 id, const QVector<QHidUsageValue>& values);
   QString manufacturerString(quint32 deviceId);
   QString productString(quint32 id);
   QString serialNumberString(quint32 id);
   QString indexedString(quint32 id, int index);
   QString error(quint32 id);
+  QHidReaderThread* startReader(quint32 id,
+                                const QHidReaderOptions& options = QHidReaderOptions());
+  QHidReaderThread* startReader(const QList<quint32>& ids,
+                                const QHidReaderOptions& options = QHidReaderOptions());
+  QFuture<QList<QHidDeviceInfo>> enumerateFuture(ushort vendorId = 0x0, ushort productId = 0x0,
+                                                 EnumerateOptions options = NoEnumerateOptions);
+  QFuture<QList<QHidDeviceInfo>> enumerateFuture(const QHidEnumerationFilter& filter,
+                                                 EnumerateOptions options = NoEnumerateOptions);
+  QFuture<quint32> openFuture(ushort vendorId, ushort productId,
+                              const QString& serialNumber = QString());
+  QFuture<quint32> openFuture(const QString& path);
+  QFuture<QByteArray> readFuture(quint32 id, int timeout);
+  QFuture<QByteArray> featureReportFuture(quint32 id, uint reportId);
+  QFuture<int> sendFeatureReportFuture(quint32 id, quint8 reportId, const QByteArray& data);
+  QFuture<QString> manufacturerStringFuture(quint32 id);
+  QFuture<QString> productStringFuture(quint32 id);
+  QFuture<QString> serialNumberStringFuture(quint32 id);
+  QFuture<QString> indexedStringFuture(quint32 id, int index);
+#ifdef QHIDAPI_COROUTINES
+  QHidReadAwaitable readAsync(quint32 id);
+  QHidCallAwaitable<int> writeAsync(quint32 id, const QByteArray& data);
+  QHidCallAwaitable<QByteArray> featureReportAsync(quint32 id, uint reportId);
+  QHidCallAwaitable<int> sendFeatureReportAsync(quint32 id, quint8 reportId,
+                                                const QByteArray& data);
+#endif
 
 private:
   QHidApiPrivate* d_ptr;
   Q_DECLARE_PRIVATE(QHidApi)
 };
 
+Q_DECLARE_OPERATORS_FOR_FLAGS(QHidApi::EnumerateOptions)
+
 #endif // QHIDAPI_H
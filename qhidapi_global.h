@@ -16,4 +16,12 @@ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH RE
 #  define QHIDAPISHARED_EXPORT Q_DECL_IMPORT
 #endif
 
+// the awaitable reads and writes, when the compiler has C++20 coroutines.
+// The library and the code using it have to agree.
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#  if __has_include(<coroutine>)
+#    define QHIDAPI_COROUTINES
+#  endif
+#endif
+
 #endif // QHIDAPI_GLOBAL_H
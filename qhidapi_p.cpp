@@ -25,10 +25,14 @@
 #include "qhidapi_p.h"
 #include "qhidapi.h"
 
+#include <QThread>
+
+#include <cstring>
+#include <string>
+
 QHidApiPrivate::QHidApiPrivate(ushort vendorId, ushort productId, QHidApi* parent) :
   mVendorId(vendorId),
   mProductId(productId),
-  mNextId(1),
   q_ptr(parent)
 {
   init();
@@ -37,26 +41,51 @@ QHidApiPrivate::QHidApiPrivate(ushort vendorId, ushort productId, QHidApi* paren
 
 QHidApiPrivate::~QHidApiPrivate()
 {
+  // the calls of the futures use the devices, so are finished first.
+  mAsync.stop();
+
+  // the devices have to be closed before hidapi is finalized.
+  closeAll();
+
+  for (QAtomicPointer<DeviceSlotPage>& page : mSlotPages) {
+    delete page.loadAcquire();
+  }
+
   exit();
 }
 
 /*!
    \brief Get The Manufacturer String from a HID device.
 
+   The string is read from the device the first time it is asked for and
+   the same QString is returned after that, until the device is closed.
+
    \param id A quint32 device id.
 
    \return a QString containing the manufacturers name string, otherwise an empty QString.
 */
 QString QHidApiPrivate::manufacturerString(quint32 id)
 {
-  wchar_t buf[MAX_STR];
-  hid_device* dev = findId(id);
+  QSharedPointer<QHidOpenDevice> device = findId(id);
 
-  int rep = hid_get_manufacturer_string(dev, buf, MAX_STR);
+  if (!device) {
+    return QString();
+  }
+
+  QMutexLocker locker(&device->mutex);
+
+  if (device->manufacturerFetched) {
+    return device->manufacturerString;
+  }
+
+  wchar_t buf[MAX_STR];
+  int rep = hid_get_manufacturer_string(device->device, buf, MAX_STR);
 
   if (rep != -1) {
 
     QString result = QString::fromWCharArray(buf);
+    device->manufacturerString = result;
+    device->manufacturerFetched = true;
 
     return result;
   }
@@ -67,20 +96,35 @@ QString QHidApiPrivate::manufacturerString(quint32 id)
 /*!
    \brief Get The Product String from a HID device.
 
+   The string is read from the device the first time it is asked for and
+   the same QString is returned after that, until the device is closed.
+
    \param id A quint32 device id.
 
    \return a QString containing the product name string, otherwise an empty QString.
 */
 QString QHidApiPrivate::productString(quint32 id)
 {
-  wchar_t buf[MAX_STR];
-  hid_device* dev = findId(id);
+  QSharedPointer<QHidOpenDevice> device = findId(id);
 
-  int rep = hid_get_product_string(dev, buf, MAX_STR);
+  if (!device) {
+    return QString();
+  }
+
+  QMutexLocker locker(&device->mutex);
+
+  if (device->productFetched) {
+    return device->productString;
+  }
+
+  wchar_t buf[MAX_STR];
+  int rep = hid_get_product_string(device->device, buf, MAX_STR);
 
   if (rep != -1) {
 
     QString result = QString::fromWCharArray(buf);
+    device->productString = result;
+    device->productFetched = true;
 
     return result;
   }
@@ -91,20 +135,35 @@ QString QHidApiPrivate::productString(quint32 id)
 /*!
    \brief Get The Serial Number String from a HID device.
 
+   The string is read from the device the first time it is asked for and
+   the same QString is returned after that, until the device is closed.
+
    \param id A quint32 device id.
 
    \return a QString containing the Serial number string, otherwise an empty QString.
 */
 QString QHidApiPrivate::serialNumberString(quint32 id)
 {
-  wchar_t buf[MAX_STR];
-  hid_device* dev = findId(id);
+  QSharedPointer<QHidOpenDevice> device = findId(id);
 
-  int rep = hid_get_serial_number_string(dev, buf, MAX_STR);
+  if (!device) {
+    return QString();
+  }
+
+  QMutexLocker locker(&device->mutex);
+
+  if (device->serialNumberFetched) {
+    return device->serialNumberString;
+  }
+
+  wchar_t buf[MAX_STR];
+  int rep = hid_get_serial_number_string(device->device, buf, MAX_STR);
 
   if (rep != -1) {
 
     QString result = QString::fromWCharArray(buf);
+    device->serialNumberString = result;
+    device->serialNumberFetched = true;
 
     return result;
   }
@@ -122,10 +181,16 @@ QString QHidApiPrivate::serialNumberString(quint32 id)
 */
 QString QHidApiPrivate::indexedString(quint32 id, int index)
 {
+  QSharedPointer<QHidOpenDevice> device = findId(id);
+
+  if (!device) {
+    return QString();
+  }
+
   wchar_t buf[MAX_STR];
-  hid_device* dev = findId(id);
+  QMutexLocker locker(&device->mutex);
 
-  int rep = hid_get_indexed_string(dev, index, buf, MAX_STR);
+  int rep = hid_get_indexed_string(device->device, index, buf, MAX_STR);
 
   if (rep != -1) {
 
@@ -188,36 +253,122 @@ int QHidApiPrivate::exit()
    \endcode
    will return the all devices of the specified manufacturer and product id's.
 
+   With QHidApi::LazyStrings in options only the cheap fields are filled in,
+   the serial number, manufacturer and product strings are read from the device
+   the first time QHidDeviceInfo::serial(), manufacturer() or product() is called.
+   With QHidApi::SysfsEnumeration the Linux backend reads /sys/class/hidraw
+   directly instead of going through libudev, and with QHidApi::ParallelStrings
+   the libusb backend reads the strings of several devices at once.
+
    \param vendorId - an optional unsigned int vendor id
    \param productId - an optional unsigned int product id.
+   \param options - an optional set of QHidApi::EnumerateOptions.
+   \return a QList<HidDeviceInfo> containing all relevant devices, or an empty list if no devices match.
+*/
+QList<QHidDeviceInfo> QHidApiPrivate::enumerate(ushort vendorId, ushort productId,
+                                                QHidApi::EnumerateOptions options)
+{
+  return enumerate(QHidEnumerationFilter(vendorId, productId), options);
+}
+
+/*!
+   \brief Enumerates the HID Devices which match a filter.
+
+   The conditions set on filter are passed down to hid_enumerate_filtered(), which
+   checks each one as soon as the backend knows it.
+
+   \param filter - the devices to return.
+   \param options - an optional set of QHidApi::EnumerateOptions.
    \return a QList<HidDeviceInfo> containing all relevant devices, or an empty list if no devices match.
 */
-QList<QHidDeviceInfo> QHidApiPrivate::enumerate(ushort vendorId, ushort productId)
+QList<QHidDeviceInfo> QHidApiPrivate::enumerate(const QHidEnumerationFilter& filter,
+                                                QHidApi::EnumerateOptions options)
 {
-  hid_device_info* info = hid_enumerate(vendorId, productId);
-  mDeviceInfoList.clear();
+  int flags = 0;
+
+  if (options.testFlag(QHidApi::LazyStrings)) {
+    flags |= HID_ENUMERATE_LAZY_STRINGS;
+  }
+
+  if (options.testFlag(QHidApi::SysfsEnumeration)) {
+    flags |= HID_ENUMERATE_SYSFS;
+  }
+
+  if (options.testFlag(QHidApi::ParallelStrings)) {
+    flags |= HID_ENUMERATE_PARALLEL;
+  }
+
+  hid_enumerate_filter f;
+  std::wstring serialPrefix = filter.serialPrefix().toStdWString();
+  memset(&f, 0, sizeof(f));
+  f.vendor_id = filter.vendorId();
+  f.product_id = filter.productId();
+
+  if (filter.hasUsagePage()) {
+    f.match |= HID_FILTER_USAGE_PAGE;
+    f.usage_page = filter.usagePage();
+  }
+
+  if (filter.hasUsage()) {
+    f.match |= HID_FILTER_USAGE;
+    f.usage = filter.usage();
+  }
+
+  if (filter.hasInterfaceNumber()) {
+    f.match |= HID_FILTER_INTERFACE;
+    f.interface_number = filter.interfaceNumber();
+  }
+
+  if (filter.hasBusType()) {
+    f.match |= HID_FILTER_BUS_TYPE;
+    f.bus_type = filter.busType();
+  }
+
+  if (filter.hasSerialPrefix()) {
+    f.match |= HID_FILTER_SERIAL_PREFIX;
+    f.serial_prefix = serialPrefix.c_str();
+  }
+
+  hid_device_info* devices = hid_enumerate_filtered(&f, flags);
+  hid_device_info* info = devices;
+  QList<QHidDeviceInfo> result;
 
   while (info != NULL) {
     QHidDeviceInfo i;
     i.path = QString(info->path);
     i.vendorId = info->vendor_id;
-    i.manufacturerString = QString::fromWCharArray(info->manufacturer_string);
+    i.manufacturerString = fromWideString(info->manufacturer_string);
     i.productId = info->product_id;
-    i.productString = QString::fromWCharArray(info->product_string);
+    i.productString = fromWideString(info->product_string);
     i.releaseNumber = info->release_number;
-    i.serialNumber = QString::fromWCharArray(info->serial_number);
-#if defined(Q_OS_WIN32) || defined(Q_OS_MAC)
+    i.serialNumber = fromWideString(info->serial_number);
     i.usagePage = info->usage_page;
     i.usage = info->usage;
-#endif
     i.interfaceNumber = info->interface_number;
-    mDeviceInfoList.append(i);
+    i.busType = QHidDeviceInfo::BusType(info->bus_type);
+
+    if (flags & HID_ENUMERATE_LAZY_STRINGS) {
+      i.setLazyStrings();
+    }
+
+    result.append(i);
     info = info->next;
   }
 
-  hid_free_enumeration(info);
+  {
+    QMutexLocker locker(&mEnumerationMutex);
+
+    // a filtered list may leave out devices with these ids, so only add to the index.
+    if (!(flags & HID_ENUMERATE_LAZY_STRINGS)) {
+      updateSerialIndex(f.vendor_id, f.product_id, devices, f.match == 0);
+    }
+
+    mDeviceInfoList = result;
+  }
+
+  hid_free_enumeration(devices);
 
-  return mDeviceInfoList;
+  return result;
 }
 
 /*!
@@ -227,6 +378,10 @@ QList<QHidDeviceInfo> QHidApiPrivate::enumerate(ushort vendorId, ushort productI
    is NULL, the first device with the specified VID and PID is opened. The method returns an id number
    which should be retained as it is used to identify the device that you wish to access.
 
+   Devices with a serial number are looked up in an index of the paths found by the last
+   enumerate(), so reopening a known device doesn't enumerate again. Only a device which
+   isn't in the index, or whose path has changed, causes a fresh enumeration.
+
    \param vendorId The Vendor ID (VID) of the device to open.
    \param productId The Product ID (PID) of the device to open.
    \param serialNumber The Serial Number of the device to open (Optionally NULL).
@@ -234,283 +389,1094 @@ QList<QHidDeviceInfo> QHidApiPrivate::enumerate(ushort vendorId, ushort productI
 */
 quint32 QHidApiPrivate::open(ushort vendorId, ushort productId, QString serialNumber)
 {
+  QMutexLocker locker(&mRegistryMutex);
 
-  QList<QMultiMap<ushort, QVariant>> products = mVendorMap.values(vendorId);
-
-  if (products.isEmpty()) {
-    return openNewProduct(vendorId, productId, serialNumber);
+  // have we opened this product before.
+  const QHidDeviceRegistry::Record* record = mRegistry.findProduct(vendorId, productId, serialNumber);
 
-  } else {
-    return openProduct(vendorId, productId, serialNumber);
+  if (record != nullptr) {
+    return record->id;
   }
 
-  return 0;
+  return openNewProduct(vendorId, productId, serialNumber);
 }
 
 /*!
    \brief Closes the specified device if it exists, otherwise this command is ignored.
 
+   The id is not valid after this. Ids are never reused, as a slot is retired once
+   its 65535 generations are used up, so calls made with it later are ignored
+   rather than reaching a device opened since. A call on the device which
+   another thread is still making finishes first, the device is closed when the last
+   one returns.
+
    \param id - the quint32 id for the device.
 */
 void QHidApiPrivate::close(quint32 id)
 {
-  hid_device* dev = findId(id);
+  QSharedPointer<QHidOpenDevice> device;
+
+  {
+    QMutexLocker locker(&mRegistryMutex);
+
+    if (!mRegistry.remove(id)) {
+      return;
+    }
 
-  if (dev != NULL) {
-    hid_close(dev);
+    device = takeDevice(id);
   }
-}
 
-hid_device* QHidApiPrivate::findId(quint32 id)
-{
-  if (mIdDeviceMap.contains(id)) {
-    hid_device* dev = mIdDeviceMap.value(id);
-    return dev;
+  if (device) {
+    device->closed.storeRelease(1);
   }
 
-  return NULL;
+  // hid_close() is called as the last reference goes, here unless another thread holds one.
 }
 
 /*!
-   \brief  Read an Input report from a HID device into a QByteArray.
+   \brief Closes the devices with ids, ignoring those which aren't open.
 
-   Input reports are returned to the host through the INTERRUPT IN endpoint. The first byte will contain the Report number if the device uses numbered reports.
-   It should be noted that the write function returns data as unsigned char values but a QByteArray stores signed char's. To recover the report as raw unsigned
-   characters you should use reinterpret_cast<uchar*>(bytearray.data()).
-
-   \param id A quint32 device id.
+   As close(quint32) for each, but every device's background reading is stopped before
+   any is closed, see shutdownDevices(), so they wind down together rather than one
+   after another.
 
-   \return Returns the data in a QByteArray. If no packet was available to be read and the handle is in non-blocking mode, Returns the data in a QByteArray.
+   \param ids - the quint32 ids of the devices.
 */
-QByteArray QHidApiPrivate::read(quint32 id)
+void QHidApiPrivate::close(const QList<quint32>& ids)
 {
-  hid_device* device = findId(id);
+  QList<QSharedPointer<QHidOpenDevice>> devices;
 
-  if (device != NULL) {
-    unsigned char buf[65];
+  {
+    QMutexLocker locker(&mRegistryMutex);
 
-    int rep = hid_read(device, buf, 65);
+    for (quint32 id : ids) {
+      if (!mRegistry.remove(id)) {
+        continue;
+      }
 
-    if (rep > 0) {
-      QByteArray data(reinterpret_cast<char*>(buf), rep);
-      return data;
+      QSharedPointer<QHidOpenDevice> device = takeDevice(id);
+
+      if (device) {
+        devices.append(device);
+      }
     }
   }
 
-  return QByteArray();
+  shutdownDevices(devices);
 }
 
 /*!
-   \brief  Read an Input report from a HID device into a QByteArray,  with timeout.
+   \brief Closes every open device, as close(const QList<quint32>&).
+*/
+void QHidApiPrivate::closeAll()
+{
+  QList<QSharedPointer<QHidOpenDevice>> devices;
 
-   Input reports are returned to the host through the INTERRUPT IN endpoint.
-   The first byte will contain the Report number if the device uses numbered reports.
-   If no packet was availableto be read within timeout milliseconds and the device
-   is in non-blocking mode.
+  {
+    QMutexLocker locker(&mRegistryMutex);
+    const QList<quint32> ids = mRegistry.ids();
+    mRegistry.clear();
 
-   It should be noted that the write function returns data as unsigned char values
-   but a QByteArray stores signed char's. To recover the report as raw unsigned
-   characters you should use reinterpret_cast<uchar*>(bytearray.data()).
+    for (quint32 id : ids) {
+      QSharedPointer<QHidOpenDevice> device = takeDevice(id);
 
-   \param id A quint32 device id.
-   \param timeout timeout in milliseconds or -1 for blocking wait.
+      if (device) {
+        devices.append(device);
+      }
+    }
+  }
 
-   \return Returns the data in a QByteArray.
+  shutdownDevices(devices);
+}
+
+/*
+   Marks devices, which have been taken out of the registry and slots,
+   closed and starts closing them all with hid_shutdown(), which on libusb
+   cancels each transfer without joining the read thread and on Windows
+   cancels each read without waiting, before any is closed. The hid_close()
+   of each, as its last reference is dropped, then only waits for what is
+   already stopping. hid_shutdown() can be called alongside other calls on
+   the device, so it doesn't wait for the device's mutex behind a feature
+   report or control transfer. Empties devices.
 */
-QByteArray QHidApiPrivate::read(quint32 id, int timeout)
+void QHidApiPrivate::shutdownDevices(QList<QSharedPointer<QHidOpenDevice>>& devices)
 {
-  hid_device* device = findId(id);
+  for (const QSharedPointer<QHidOpenDevice>& device : devices) {
+    device->closed.storeRelease(1);
+    hid_shutdown(device->device);
+  }
 
-  if (device != NULL) {
-    unsigned char buf[65];
+  // hid_close() is called as the last reference goes, here unless another thread holds one.
+  devices.clear();
+}
+
+/*
+   Reads a report from device into data, with hid_read() if deviceMode is set,
+   so waiting or not as setBlocking() said, otherwise waiting up to timeout
+   milliseconds, -1 for ever. The report is given to the device's usage map if
+   it has one. returns what hidapi did, the size of the report, 0 if there was
+   none, HID_READ_CANCELLED if the read was cancelled or -1 on error.
+*/
+int QHidApiPrivate::readReport(QHidOpenDevice* device, QByteArray& data, int timeout,
+                               bool deviceMode)
+{
+  unsigned char buf[65];
+  int rep;
 
-    int rep = hid_read_timeout(device, buf, 65, timeout);
+  {
+    QMutexLocker locker(&device->readMutex);
+    rep = deviceMode ? hid_read(device->device, buf, 65)
+          : hid_read_timeout(device->device, buf, 65, timeout);
+  }
 
-    if (rep > 0) {
-      QByteArray data(reinterpret_cast<char*>(buf), rep);
-      return data;
+  if (rep > 0) {
+    data = QByteArray(reinterpret_cast<char*>(buf), rep);
+
+    if (device->hasUsageMap.loadAcquire()) {
+      QMutexLocker locker(&device->mutex);
+      device->usageMap->setInputReport(data);
     }
   }
 
-  return QByteArray();
+  return rep;
 }
 
-/*!
-   \brief Get a feature report from a HID device.
+/*
+   The open device with id, or a null pointer. No lock is taken: the slot is
+   indexed by the low 16 bits of id and its id compared, as the registry's
+   findId() does.
+*/
+QSharedPointer<QHidOpenDevice> QHidApiPrivate::findId(quint32 id)
+{
+  const int index = int(id & 0xffff);
+  DeviceSlotPage* page = mSlotPages[index / SLOT_PAGE_SIZE].loadAcquire();
+  QSharedPointer<QHidOpenDevice> device;
 
-   Set the first byte of the returned data will contain the Report ID of the report to be read. Make sure to allow space for this extra byte in data[].
-   Upon return, the first byte will still contain the Report ID, and the report data will start in data[1].
+  if (id == 0 || page == nullptr) {
+    return device;
+  }
 
-   \param id A quint32 device id.
-   \param reportId the reportId.
+  DeviceSlot& slot = page->entries[index % SLOT_PAGE_SIZE];
+  slot.readers.ref();
 
-   \return Returns the data in a QByteArray. Returns an empty QByteArray on error.
+  if (slot.device.loadAcquire() != nullptr && slot.id.loadAcquire() == id) {
+    device = slot.owner;
+  }
 
+  slot.readers.deref();
+
+  return device;
+}
+
+/*
+   Takes the device with id out of its slot, for close(). Called with
+   mRegistryMutex held, after id has been removed from the registry.
+   returns the device, or a null pointer.
 */
-QByteArray QHidApiPrivate::featureReport(quint32 id, uint reportId)
+QSharedPointer<QHidOpenDevice> QHidApiPrivate::takeDevice(quint32 id)
 {
-  hid_device* device = findId(id);
+  const int index = int(id & 0xffff);
+  DeviceSlotPage* page = mSlotPages[index / SLOT_PAGE_SIZE].loadAcquire();
+  QSharedPointer<QHidOpenDevice> device;
 
-  if (device != NULL) {
-    unsigned char buf[65];
-    buf[0] = reportId;
+  if (page == nullptr) {
+    return device;
+  }
 
-    int rep = hid_get_feature_report(device, buf, sizeof(buf));
+  DeviceSlot& slot = page->entries[index % SLOT_PAGE_SIZE];
 
-    if (rep > 0) {
-      QByteArray data(reinterpret_cast<char*>(buf), rep);
-      return data;
-    }
+  if (slot.id.loadAcquire() != id || slot.device.fetchAndStoreOrdered(nullptr) == nullptr) {
+    return device;
   }
 
-  return QByteArray();
-}
-
-/*!
-   \brief  Write an Feature report to a HID device.
+  /*
+     a findId() which counted itself before device was cleared may still be
+     copying owner. One which counts itself after sees no device, both being
+     ordered, so once the count is 0 nothing more reads owner.
+  */
+  while (slot.readers.fetchAndAddOrdered(0) != 0) {
+    QThread::yieldCurrentThread();
+  }
 
-   HID reports have a maximum length of 64 bytes, plus an the initial char being a report ID. For devices which only support a single report, this must be set to 0x0.
-   The remaining bytes contain the report data.
+  device.swap(slot.owner);
 
-   Data will send the data on the first OUT endpoint, if one exists. If it does not, it will send the data through the Control Endpoint (Endpoint 0).
+  return device;
+}
 
-   \param id A quint32 device id.
-   \param the report id
-   \param The data to send, excluding the report number as the first byte.
-   \return the number of bytes written, or -1 on error.
+/*
+   Adds a newly opened device to the registry and its slot, closing it if
+   there is no room. Called with mRegistryMutex held. returns the device's
+   id, or 0.
 */
-int QHidApiPrivate::sendFeatureReport(quint32 id, quint8 reportId, QByteArray data)
+quint32 QHidApiPrivate::addDevice(const QHidDeviceRegistry::Record& record)
 {
-  if (data.length() > 64) {
-    return -1;
+  quint32 id = mRegistry.insert(record);
+
+  if (id == 0) {
+    hid_close(record.device);
+    return 0;
   }
 
-  hid_device* device = findId(id);
+  QSharedPointer<QHidOpenDevice> device(new QHidOpenDevice(record.device, record.vendorId,
+                                        record.productId, record.path));
 
-  if (device != NULL) {
-    data.prepend(reportId);
+  // made now, so that value() sees the reports read before it is first called.
+  {
+    QMutexLocker deviceLocker(&device->mutex);
+    usageMap(device.data());
+  }
 
-    int rep = hid_send_feature_report(device, reinterpret_cast<uchar*>(data.data()), data.length());
+  const int index = int(id & 0xffff);
+  DeviceSlotPage* page = mSlotPages[index / SLOT_PAGE_SIZE].loadAcquire();
 
-    return rep;
+  if (page == nullptr) {
+    page = new DeviceSlotPage;
+    mSlotPages[index / SLOT_PAGE_SIZE].storeRelease(page);
   }
 
-  return -1;
+  // published last, so a findId() which sees the device sees its id and owner.
+  DeviceSlot& slot = page->entries[index % SLOT_PAGE_SIZE];
+  slot.owner = device;
+  slot.id.storeRelease(id);
+  slot.device.storeRelease(device.data());
+
+  return id;
 }
 
 /*!
-   \brief  Write an Output report to a HID device.
-
-   HID reports have a maximum length of 64 bytes, plus an the initial char being a report ID. For devices which only support a single report, this must be set to 0x0.
-   The remaining bytes contain the report data.
+   \brief  Read an Input report from a HID device into a QByteArray.
 
-   Data will send the data on the first OUT endpoint, if one exists. If it does not, it will send the data through the Control Endpoint (Endpoint 0).
+   Input reports are returned to the host through the INTERRUPT IN endpoint. The first byte will contain the Report number if the device uses numbered reports.
+   It should be noted that the write function returns data as unsigned char values but a QByteArray stores signed char's. To recover the report as raw unsigned
+   characters you should use reinterpret_cast<uchar*>(bytearray.data()).
 
    \param id A quint32 device id.
-   \param the report id
-   \param The data to send, excluding the report number as the first byte.
-   \return the number of bytes written, or -1 on error.
+
+   \return Returns the data in a QByteArray. If no packet was available to be read and the handle is in non-blocking mode, Returns the data in a QByteArray.
 */
-int QHidApiPrivate::write(quint32 id, QByteArray data, quint8 reportNumber)
+QByteArray QHidApiPrivate::read(quint32 id)
 {
-  if (data.length() > 64) {
-    return -1;
-  }
-
-  hid_device* device = findId(id);
-
-  if (device != NULL) {
-    data.prepend(reportNumber);
-
-    int rep = hid_write(device, reinterpret_cast<uchar*>(data.data()), data.length());
+  QSharedPointer<QHidOpenDevice> device = findId(id);
+  QByteArray data;
 
-    return rep;
+  if (device) {
+    readReport(device.data(), data, 0, true);
   }
 
-  return -1;
+  return data;
 }
 
 /*!
-   \brief  Write an Output report to a HID device.
+   \brief  Read an Input report from a HID device into a QByteArray,  with timeout.
 
-   HID reports have a maximum length of 64 bytes, plus an the initial char being a report ID. For devices which only support a single report, this must be set to 0x0.
-   The remaining bytes contain the report data. In this version of write() it is assumed that the initial report character is already prepended to the supplied QByteArray.
+   Input reports are returned to the host through the INTERRUPT IN endpoint.
+   The first byte will contain the Report number if the device uses numbered reports.
+   If no packet was availableto be read within timeout milliseconds and the device
+   is in non-blocking mode.
 
-   Data will send the data on the first OUT endpoint, if one exists. If it does not, it will send the data through the Control Endpoint (Endpoint 0).
+   It should be noted that the write function returns data as unsigned char values
+   but a QByteArray stores signed char's. To recover the report as raw unsigned
+   characters you should use reinterpret_cast<uchar*>(bytearray.data()).
 
    \param id A quint32 device id.
-   \param The data to send, excluding the report number as the first byte.
+   \param timeout timeout in milliseconds or -1 for blocking wait.
 
-   \return the number of bytes written, or -1 on error.
+   \return Returns the data in a QByteArray.
 */
-int QHidApiPrivate::write(quint32 id, QByteArray data)
+QByteArray QHidApiPrivate::read(quint32 id, int timeout)
 {
-  if (data.length() > 65) {
-    return -1;
-  }
-
-  hid_device* device = findId(id);
+  QSharedPointer<QHidOpenDevice> device = findId(id);
+  QByteArray data;
 
-  if (device != NULL) {
-    int rep = hid_write(device, reinterpret_cast<uchar*>(data.data()), data.length());
-
-    return rep;
+  if (device) {
+    readReport(device.data(), data, timeout);
   }
 
-  return -1;
+  return data;
 }
 
 /*!
-   \brief Get a string describing the last error which occurred on the supplied device.
+   \brief  Read an Input report from a HID device into report, with timeout, telling how the read ended.
 
    \param id A quint32 device id.
+   \param report Set to the report read, left alone if there was none.
+   \param timeout timeout in milliseconds or -1 for blocking wait.
 
-   \return This function returns a string containing the last error which occurred on the device or an empty QString if none has occurred.
+   \return Returns the size of the report, 0 if none came within timeout milliseconds,
+   QHidApi::ReadCancelled if the read was cancelled or -1 on error.
 */
-QString QHidApiPrivate::error(quint32 id)
+int QHidApiPrivate::read(quint32 id, QByteArray& report, int timeout)
 {
-  hid_device* device = findId(id);
-
-  if (device != NULL) {
-    QString r;
-
-    const wchar_t* errorString = hid_error(device);
-    r = QString::fromWCharArray(errorString);
-
-    if (r == NULL) {
-      return QString();
-    }
+  QSharedPointer<QHidOpenDevice> device = findId(id);
 
-    return r;
+  if (!device) {
+    return -1;
   }
 
-  return QString();
+  return readReport(device.data(), report, timeout);
 }
 
 /*!
-   \brief  Set the device handle to be blocking.
-
-   In non-blocking mode calls to read() will return immediately with a value of 0 if there is no data to be read. In blocking mode, read() will wait (block)
-   until there is data to read before returning.
+   \brief Makes a read of the device, waiting on another thread, return at once.
 
-   Blocking can be turned on and off at any time.
+   The read holds the device's readMutex for as long as it waits, so that isn't taken
+   here, hidapi's cancel being safe to call alongside a read.
 
    \param id  A quint32 device id.
    \return Returns true on success and false on error.
 */
-bool QHidApiPrivate::setBlocking(quint32 id)
+bool QHidApiPrivate::cancelRead(quint32 id)
 {
-  hid_device* device = findId(id);
+  QSharedPointer<QHidOpenDevice> device = findId(id);
 
-  int rep = hid_set_nonblocking(device, 1);
-  return !!rep;
+  if (!device) {
+    return false;
+  }
+
+  return hid_cancel_read(device->device) == 0;
 }
 
 /*!
-   \brief  Set the device handle to be non-blocking.
+   \brief Has the device's input reports passed to handler, rather than queued for read().
 
-   In non-blocking mode calls to read() will return immediately with a value of 0 if there is no data to be read. In blocking mode, read() will wait (block)
-   until there is data to read before returning.
+   The callback is cleared first, which waits for a call in progress, so the old handler
+   is never called while it is replaced. That wait is made under handlerMutex rather
+   than the device's mutex, as hidapi holds its callback lock through the call and a
+   handler which writes, or asks for a string, takes the device's mutex.
+
+   \param id  A quint32 device id.
+   \param handler the handler, or an empty one to go back to queueing the reports.
+   \return Returns true on success and false on error.
+*/
+bool QHidApiPrivate::setReportHandler(quint32 id, QHidReportHandler handler)
+{
+  QSharedPointer<QHidOpenDevice> device = findId(id);
+
+  if (!device) {
+    return false;
+  }
+
+  QMutexLocker locker(&device->handlerMutex);
+
+  if (hid_set_input_report_callback(device->device, nullptr, nullptr) != 0) {
+    return false;
+  }
+
+  device->reportHandler = handler;
+  device->reportHandlerId = id;
+
+  if (!handler) {
+    return true;
+  }
+
+  return hid_set_input_report_callback(device->device, &QHidApiPrivate::inputReportCallback,
+                                       device.data()) == 0;
+}
+
+/*
+   The input report callback of a device with a report handler, context
+   being its QHidOpenDevice, which is open for as long as hidapi calls this.
+*/
+void HID_API_CALL QHidApiPrivate::inputReportCallback(void* context, hid_device* device,
+                                                      const unsigned char* data, size_t length)
+{
+  Q_UNUSED(device)
+  QHidOpenDevice* openDevice = static_cast<QHidOpenDevice*>(context);
+
+  openDevice->reportHandler(openDevice->reportHandlerId, data, int(length));
+}
+
+/*!
+   \brief Get a feature report from a HID device.
+
+   Set the first byte of the returned data will contain the Report ID of the report to be read. Make sure to allow space for this extra byte in data[].
+   Upon return, the first byte will still contain the Report ID, and the report data will start in data[1].
+
+   \param id A quint32 device id.
+   \param reportId the reportId.
+
+   \return Returns the data in a QByteArray. Returns an empty QByteArray on error.
+
+*/
+QByteArray QHidApiPrivate::featureReport(quint32 id, uint reportId)
+{
+  QSharedPointer<QHidOpenDevice> device = findId(id);
+
+  if (device) {
+    unsigned char buf[65];
+    buf[0] = reportId;
+
+    QMutexLocker locker(&device->mutex);
+    int rep = hid_get_feature_report(device->device, buf, sizeof(buf));
+
+    if (rep > 0) {
+      QByteArray data(reinterpret_cast<char*>(buf), rep);
+      return data;
+    }
+  }
+
+  return QByteArray();
+}
+
+/*!
+   \brief Get the parsed report descriptor of a HID device.
+
+   The descriptor is read from the device when it is opened, for its usage map, and the
+   same QHidReportDescriptor is returned after that, until the device is closed. Descriptors
+   which have been parsed before, by any process, are taken from the QHidDescriptorCache
+   rather than parsed again.
+
+   \param id A quint32 device id.
+
+   \return the parsed descriptor, which is invalid if the descriptor couldn't be read
+   or parsed. The descriptor can't be read on Windows.
+*/
+QHidReportDescriptor QHidApiPrivate::reportDescriptor(quint32 id)
+{
+  QSharedPointer<QHidOpenDevice> device = findId(id);
+
+  if (!device) {
+    return QHidReportDescriptor();
+  }
+
+  QMutexLocker locker(&device->mutex);
+  return reportDescriptor(device.data());
+}
+
+/*
+   The parsed report descriptor of device, read the first time. Called with
+   the device's mutex held.
+*/
+QHidReportDescriptor QHidApiPrivate::reportDescriptor(QHidOpenDevice* device)
+{
+  if (device->descriptorFetched) {
+    return device->descriptor;
+  }
+
+  unsigned char buf[HID_API_MAX_REPORT_DESCRIPTOR_SIZE];
+  int rep = hid_get_report_descriptor(device->device, buf, sizeof(buf));
+
+  if (rep <= 0) {
+    return QHidReportDescriptor();
+  }
+
+  // the ids of a device opened by path come from the last enumeration, if it was in it.
+  ushort vendorId = device->vendorId;
+  ushort productId = device->productId;
+  ushort releaseNumber = 0;
+
+  {
+    QMutexLocker locker(&mEnumerationMutex);
+
+    for (const QHidDeviceInfo& info : mDeviceInfoList) {
+      if (!device->path.isEmpty() ? info.path == device->path
+          : (info.vendorId == vendorId && info.productId == productId)) {
+        vendorId = info.vendorId;
+        productId = info.productId;
+        releaseNumber = info.releaseNumber;
+        break;
+      }
+    }
+  }
+
+  QMutexLocker locker(&mDescriptorCacheMutex);
+  device->descriptor = mDescriptorCache.parse(vendorId, productId, releaseNumber,
+                       QByteArray(reinterpret_cast<char*>(buf), rep));
+  device->descriptorFetched = true;
+
+  return device->descriptor;
+}
+
+/*
+   The usage map of device, created from its report descriptor when the
+   device is opened, or at the next call if the descriptor couldn't be read
+   then. Called with the device's mutex held. returns nullptr if the
+   descriptor can't be read.
+*/
+QHidUsageMap* QHidApiPrivate::usageMap(QHidOpenDevice* device)
+{
+  if (device->usageMap) {
+    return device->usageMap.data();
+  }
+
+  QHidReportDescriptor descriptor = reportDescriptor(device);
+
+  if (!descriptor.isValid()) {
+    return nullptr;
+  }
+
+  device->usageMap.reset(new QHidUsageMap(descriptor));
+  device->hasUsageMap.storeRelease(1);
+
+  return device->usageMap.data();
+}
+
+/*!
+   \brief Resolve a usage of a device to a handle for valueAt().
+
+   \param id A quint32 device id.
+   \param usagePage the usage page of the value.
+   \param usage the usage of the value.
+   \param type the kind of report the value is in.
+
+   \return the handle, or -1 if the device has no such value.
+*/
+int QHidApiPrivate::resolveUsage(quint32 id, ushort usagePage, ushort usage,
+                                 QHidReportField::ReportType type)
+{
+  QSharedPointer<QHidOpenDevice> device = findId(id);
+
+  if (!device) {
+    return -1;
+  }
+
+  QMutexLocker locker(&device->mutex);
+  QHidUsageMap* map = usageMap(device.data());
+
+  return map != nullptr ? map->resolve(type, usagePage, usage) : -1;
+}
+
+/*!
+   \brief The value of a resolved handle.
+
+   \param id A quint32 device id.
+   \param handle a handle returned by resolveUsage().
+   \param ok set false if there is no such value or no report holding it yet.
+
+   \return the value, or 0 on error.
+*/
+qint32 QHidApiPrivate::valueAt(quint32 id, int handle, bool* ok)
+{
+  QSharedPointer<QHidOpenDevice> device = findId(id);
+
+  if (device) {
+    QMutexLocker locker(&device->mutex);
+
+    if (device->usageMap) {
+      return device->usageMap->value(handle, ok);
+    }
+  }
+
+  if (ok != nullptr) {
+    *ok = false;
+  }
+
+  return 0;
+}
+
+/*!
+   \brief The value of a usage in the last input report read from a device.
+
+   \param id A quint32 device id.
+   \param usagePage the usage page of the value.
+   \param usage the usage of the value.
+   \param ok set false if there is no such value or no report holding it yet.
+
+   \return the value, or 0 on error.
+*/
+qint32 QHidApiPrivate::value(quint32 id, ushort usagePage, ushort usage, bool* ok)
+{
+  QSharedPointer<QHidOpenDevice> device = findId(id);
+
+  if (device) {
+    QMutexLocker locker(&device->mutex);
+    QHidUsageMap* map = usageMap(device.data());
+
+    if (map != nullptr) {
+      return map->value(map->resolve(QHidReportField::InputReport, usagePage, usage), ok);
+    }
+  }
+
+  if (ok != nullptr) {
+    *ok = false;
+  }
+
+  return 0;
+}
+
+/*!
+   \brief The values of several usages in the last input reports read from a device.
+
+   \param id A quint32 device id.
+   \param usages the usages of the values.
+
+   \return the values in the order of usages, 0 for any which can't be read.
+*/
+QVector<qint32> QHidApiPrivate::values(quint32 id, const QVector<QHidUsage>& usages)
+{
+  QVector<qint32> result(usages.size(), 0);
+  QSharedPointer<QHidOpenDevice> device = findId(id);
+
+  if (!device) {
+    return result;
+  }
+
+  QMutexLocker locker(&device->mutex);
+  QHidUsageMap* map = usageMap(device.data());
+
+  if (map == nullptr) {
+    return result;
+  }
+
+  for (int i = 0; i < usages.size(); i++) {
+    const QHidUsage& u = usages.at(i);
+    result[i] = map->value(map->resolve(QHidReportField::InputReport, u.usagePage, u.usage));
+  }
+
+  return result;
+}
+
+/*!
+   \brief Set the value of a usage in an output or feature report and send the report.
+
+   \param id A quint32 device id.
+   \param usagePage the usage page of the value.
+   \param usage the usage of the value.
+   \param value the value.
+   \param type OutputReport or FeatureReport.
+
+   \return the number of bytes written, or -1 on error.
+*/
+int QHidApiPrivate::setValue(quint32 id, ushort usagePage, ushort usage, qint32 value,
+                             QHidReportField::ReportType type)
+{
+  QSharedPointer<QHidOpenDevice> device = findId(id);
+
+  if (!device) {
+    return -1;
+  }
+
+  QMutexLocker locker(&device->mutex);
+  QHidUsageMap* map = usageMap(device.data());
+
+  if (map == nullptr) {
+    return -1;
+  }
+
+  int reportId = map->setValue(map->resolve(type, usagePage, usage), value);
+
+  if (reportId < 0) {
+    return -1;
+  }
+
+  return sendEncodedReport(device->device, map->encoder(type), quint8(reportId));
+}
+
+/*!
+   \brief Build an output report from usage and value pairs and write it to a HID device.
+
+   \param id A quint32 device id.
+   \param values the values, all of which must be in the same report.
+
+   \return the number of bytes written, or -1 on error.
+*/
+int QHidApiPrivate::write(quint32 id, const QVector<QHidUsageValue>& values)
+{
+  return sendEncodedReport(id, values, QHidReportField::OutputReport);
+}
+
+/*!
+   \brief Build a feature report from usage and value pairs and send it to a HID device.
+
+   \param id A quint32 device id.
+   \param values the values, all of which must be in the same report.
+
+   \return the number of bytes written, or -1 on error.
+*/
+int QHidApiPrivate::sendFeatureReport(quint32 id, const QVector<QHidUsageValue>& values)
+{
+  return sendEncodedReport(id, values, QHidReportField::FeatureReport);
+}
+
+/*!
+   \brief Encode values with the device's encoder of type and send the report.
+*/
+int QHidApiPrivate::sendEncodedReport(quint32 id, const QVector<QHidUsageValue>& values,
+                                      QHidReportField::ReportType type)
+{
+  QSharedPointer<QHidOpenDevice> device = findId(id);
+
+  if (!device) {
+    return -1;
+  }
+
+  QMutexLocker locker(&device->mutex);
+  QHidUsageMap* map = usageMap(device.data());
+
+  if (map == nullptr) {
+    return -1;
+  }
+
+  QHidReportEncoder* encoder = map->encoder(type);
+  int reportId = encoder->encode(values);
+
+  if (reportId < 0) {
+    return -1;
+  }
+
+  return sendEncodedReport(device->device, encoder, quint8(reportId));
+}
+
+/*!
+   \brief Send the report with reportId as encoder has built it, through hid_write() for
+   an output report or hid_send_feature_report() for a feature report.
+*/
+int QHidApiPrivate::sendEncodedReport(hid_device* device, const QHidReportEncoder* encoder,
+                                      quint8 reportId)
+{
+  const uchar* data = encoder->data(reportId);
+  const size_t size = size_t(encoder->reportSize(reportId));
+
+  if (encoder->type() == QHidReportField::FeatureReport) {
+    return hid_send_feature_report(device, data, size);
+  }
+
+  return hid_write(device, data, size);
+}
+
+/*!
+   \brief  Write an Feature report to a HID device.
+
+   HID reports have a maximum length of 64 bytes, plus an the initial char being a report ID. For devices which only support a single report, this must be set to 0x0.
+   The remaining bytes contain the report data.
+
+   Data will send the data on the first OUT endpoint, if one exists. If it does not, it will send the data through the Control Endpoint (Endpoint 0).
+
+   \param id A quint32 device id.
+   \param the report id
+   \param The data to send, excluding the report number as the first byte.
+   \return the number of bytes written, or -1 on error.
+*/
+int QHidApiPrivate::sendFeatureReport(quint32 id, quint8 reportId, QByteArray data)
+{
+  if (data.length() > 64) {
+    return -1;
+  }
+
+  QSharedPointer<QHidOpenDevice> device = findId(id);
+
+  if (device) {
+    data.prepend(reportId);
+
+    QMutexLocker locker(&device->mutex);
+    int rep = hid_send_feature_report(device->device, reinterpret_cast<uchar*>(data.data()),
+                                      data.length());
+
+    return rep;
+  }
+
+  return -1;
+}
+
+/*!
+   \brief  Write an Output report to a HID device.
+
+   HID reports have a maximum length of 64 bytes, plus an the initial char being a report ID. For devices which only support a single report, this must be set to 0x0.
+   The remaining bytes contain the report data.
+
+   Data will send the data on the first OUT endpoint, if one exists. If it does not, it will send the data through the Control Endpoint (Endpoint 0).
+
+   \param id A quint32 device id.
+   \param the report id
+   \param The data to send, excluding the report number as the first byte.
+   \return the number of bytes written, or -1 on error.
+*/
+int QHidApiPrivate::write(quint32 id, QByteArray data, quint8 reportNumber)
+{
+  if (data.length() > 64) {
+    return -1;
+  }
+
+  QSharedPointer<QHidOpenDevice> device = findId(id);
+
+  if (device) {
+    data.prepend(reportNumber);
+
+    QMutexLocker locker(&device->mutex);
+    int rep = hid_write(device->device, reinterpret_cast<uchar*>(data.data()), data.length());
+
+    return rep;
+  }
+
+  return -1;
+}
+
+/*!
+   \brief  Write an Output report to a HID device.
+
+   HID reports have a maximum length of 64 bytes, plus an the initial char being a report ID. For devices which only support a single report, this must be set to 0x0.
+   The remaining bytes contain the report data. In this version of write() it is assumed that the initial report character is already prepended to the supplied QByteArray.
+
+   Data will send the data on the first OUT endpoint, if one exists. If it does not, it will send the data through the Control Endpoint (Endpoint 0).
+
+   \param id A quint32 device id.
+   \param The data to send, excluding the report number as the first byte.
+
+   \return the number of bytes written, or -1 on error.
+*/
+int QHidApiPrivate::write(quint32 id, QByteArray data)
+{
+  if (data.length() > 65) {
+    return -1;
+  }
+
+  QSharedPointer<QHidOpenDevice> device = findId(id);
+
+  if (device) {
+    QMutexLocker locker(&device->mutex);
+    int rep = hid_write(device->device, reinterpret_cast<uchar*>(data.data()), data.length());
+
+    return rep;
+  }
+
+  return -1;
+}
+
+/*!
+   \brief Get a string describing the last error which occurred on the supplied device.
+
+   \param id A quint32 device id.
+
+   \return This function returns a string containing the last error which occurred on the device or an empty QString if none has occurred.
+*/
+QString QHidApiPrivate::error(quint32 id)
+{
+  QSharedPointer<QHidOpenDevice> device = findId(id);
+
+  if (device) {
+    QString r;
+
+    QMutexLocker locker(&device->mutex);
+    const wchar_t* errorString = hid_error(device->device);
+    r = QString::fromWCharArray(errorString);
+
+    if (r == NULL) {
+      return QString();
+    }
+
+    return r;
+  }
+
+  return QString();
+}
+
+/*!
+   \brief Starts a QHidReaderThread reading the devices with ids, which is a
+   child of the QHidApi.
+
+   Ids which aren't open are left out.
+
+   \param ids the quint32 device ids.
+   \param options how the thread runs.
+   \return the started reader, or nullptr if none of the devices is open.
+*/
+QHidReaderThread* QHidApiPrivate::startReader(const QList<quint32>& ids,
+                                              const QHidReaderOptions& options)
+{
+  QVector<QSharedPointer<QHidOpenDevice>> devices;
+  QList<quint32> found;
+
+  for (quint32 id : ids) {
+    QSharedPointer<QHidOpenDevice> device = findId(id);
+
+    if (device && !found.contains(id)) {
+      devices.append(device);
+      found.append(id);
+    }
+  }
+
+  if (devices.isEmpty()) {
+    return nullptr;
+  }
+
+  QHidReaderThread* reader = new QHidReaderThread(devices, found, options, q_ptr);
+  reader->start();
+
+  return reader;
+}
+
+/*!
+   \brief enumerate() on the thread pool of the futures.
+*/
+QFuture<QList<QHidDeviceInfo>> QHidApiPrivate::enumerateFuture(ushort vendorId, ushort productId,
+                                                               QHidApi::EnumerateOptions options)
+{
+  return mAsync.run<QList<QHidDeviceInfo>>(0, [this, vendorId, productId, options]
+  (QFutureInterface<QList<QHidDeviceInfo>>&) {
+    return enumerate(vendorId, productId, options);
+  });
+}
+
+/*!
+   \brief enumerate() with a filter, on the thread pool of the futures.
+*/
+QFuture<QList<QHidDeviceInfo>> QHidApiPrivate::enumerateFuture(const QHidEnumerationFilter& filter,
+                                                               QHidApi::EnumerateOptions options)
+{
+  return mAsync.run<QList<QHidDeviceInfo>>(0, [this, filter, options]
+  (QFutureInterface<QList<QHidDeviceInfo>>&) {
+    return enumerate(filter, options);
+  });
+}
+
+/*!
+   \brief open() on the thread pool of the futures.
+*/
+QFuture<quint32> QHidApiPrivate::openFuture(ushort vendorId, ushort productId,
+                                            const QString& serialNumber)
+{
+  return mAsync.run<quint32>(0, [this, vendorId, productId, serialNumber](QFutureInterface<quint32>&) {
+    return open(vendorId, productId, serialNumber);
+  });
+}
+
+/*!
+   \brief open() by path on the thread pool of the futures.
+*/
+QFuture<quint32> QHidApiPrivate::openFuture(const QString& path)
+{
+  return mAsync.run<quint32>(0, [this, path](QFutureInterface<quint32>&) {
+    return open(path);
+  });
+}
+
+/*!
+   \brief read() with a timeout, on the thread pool of the futures.
+
+   The read waits at most ASYNC_WAIT_SLICE milliseconds at a time, so a
+   cancelled future, the device being closed or the QHidApi being destroyed
+   ends the wait. It runs
+   in the device's read lane, so the other futures of the device aren't
+   queued behind it.
+*/
+QFuture<QByteArray> QHidApiPrivate::readFuture(quint32 id, int timeout)
+{
+  return mAsync.run<QByteArray>(id, [this, id, timeout](QFutureInterface<QByteArray>& future) {
+    QSharedPointer<QHidOpenDevice> device = findId(id);
+    QByteArray data;
+    int remaining = timeout;
+
+    while (device && !device->closed.loadAcquire() && !future.isCanceled()
+           && !mAsync.isStopping()) {
+      const int slice = (remaining < 0 || remaining > ASYNC_WAIT_SLICE) ? ASYNC_WAIT_SLICE : remaining;
+
+      if (readReport(device.data(), data, slice) != 0) {
+        break;
+      }
+
+      if (remaining >= 0) {
+        remaining -= slice;
+
+        if (remaining <= 0) {
+          break;
+        }
+      }
+    }
+
+    return data;
+  }, QHidAsyncExecutor::ReadLane);
+}
+
+/*!
+   \brief write() on the thread pool of the futures, for QHidApi::writeAsync().
+*/
+QFuture<int> QHidApiPrivate::writeFuture(quint32 id, const QByteArray& data)
+{
+  return mAsync.run<int>(id, [this, id, data](QFutureInterface<int>&) {
+    return write(id, data);
+  });
+}
+
+/*!
+   \brief featureReport() on the thread pool of the futures.
+*/
+QFuture<QByteArray> QHidApiPrivate::featureReportFuture(quint32 id, uint reportId)
+{
+  return mAsync.run<QByteArray>(id, [this, id, reportId](QFutureInterface<QByteArray>&) {
+    return featureReport(id, reportId);
+  });
+}
+
+/*!
+   \brief sendFeatureReport() on the thread pool of the futures.
+*/
+QFuture<int> QHidApiPrivate::sendFeatureReportFuture(quint32 id, quint8 reportId,
+                                                     const QByteArray& data)
+{
+  return mAsync.run<int>(id, [this, id, reportId, data](QFutureInterface<int>&) {
+    return sendFeatureReport(id, reportId, data);
+  });
+}
+
+/*!
+   \brief manufacturerString() on the thread pool of the futures.
+*/
+QFuture<QString> QHidApiPrivate::manufacturerStringFuture(quint32 id)
+{
+  return mAsync.run<QString>(id, [this, id](QFutureInterface<QString>&) {
+    return manufacturerString(id);
+  });
+}
+
+/*!
+   \brief productString() on the thread pool of the futures.
+*/
+QFuture<QString> QHidApiPrivate::productStringFuture(quint32 id)
+{
+  return mAsync.run<QString>(id, [this, id](QFutureInterface<QString>&) {
+    return productString(id);
+  });
+}
+
+/*!
+   \brief serialNumberString() on the thread pool of the futures.
+*/
+QFuture<QString> QHidApiPrivate::serialNumberStringFuture(quint32 id)
+{
+  return mAsync.run<QString>(id, [this, id](QFutureInterface<QString>&) {
+    return serialNumberString(id);
+  });
+}
+
+/*!
+   \brief indexedString() on the thread pool of the futures.
+*/
+QFuture<QString> QHidApiPrivate::indexedStringFuture(quint32 id, int index)
+{
+  return mAsync.run<QString>(id, [this, id, index](QFutureInterface<QString>&) {
+    return indexedString(id, index);
+  });
+}
+
+/*!
+   \brief  Set the device handle to be blocking.
+
+   In non-blocking mode calls to read() will return immediately with a value of 0 if there is no data to be read. In blocking mode, read() will wait (block)
+   until there is data to read before returning.
+
+   Blocking can be turned on and off at any time.
+
+   \param id  A quint32 device id.
+   \return Returns true on success and false on error.
+*/
+bool QHidApiPrivate::setBlocking(quint32 id)
+{
+  QSharedPointer<QHidOpenDevice> device = findId(id);
+
+  if (!device) {
+    return false;
+  }
+
+  QMutexLocker locker(&device->mutex);
+  int rep = hid_set_nonblocking(device->device, 1);
+  return !!rep;
+}
+
+/*!
+   \brief  Set the device handle to be non-blocking.
+
+   In non-blocking mode calls to read() will return immediately with a value of 0 if there is no data to be read. In blocking mode, read() will wait (block)
+   until there is data to read before returning.
 
    Nonblocking can be turned on and off at any time.
 
@@ -519,12 +1485,66 @@ bool QHidApiPrivate::setBlocking(quint32 id)
 */
 bool QHidApiPrivate::setNonBlocking(quint32 id)
 {
-  hid_device* device = findId(id);
+  QSharedPointer<QHidOpenDevice> device = findId(id);
+
+  if (!device) {
+    return false;
+  }
 
-  int rep = hid_set_nonblocking(device, 0);
+  QMutexLocker locker(&device->mutex);
+  int rep = hid_set_nonblocking(device->device, 0);
   return !!rep;
 }
 
+/*!
+   \brief Sets how long a read of the device spins before it sleeps.
+
+   The backend reads the budget atomically, so it is set without waiting for a read
+   in progress.
+
+   \param id  A quint32 device id.
+   \param microseconds the longest a read spins, 0 to never spin.
+   \return Returns true on success and false on error.
+*/
+bool QHidApiPrivate::setSpinBudget(quint32 id, int microseconds)
+{
+  QSharedPointer<QHidOpenDevice> device = findId(id);
+
+  if (!device) {
+    return false;
+  }
+
+  QMutexLocker locker(&device->mutex);
+  return hid_set_spin_budget(device->device, microseconds) == 0;
+}
+
+/*!
+   \brief The counters of the device's spinning reads.
+
+   \param id  A quint32 device id.
+   \return the counters, all 0 if the device isn't open.
+*/
+QHidSpinStats QHidApiPrivate::spinStats(quint32 id)
+{
+  QSharedPointer<QHidOpenDevice> device = findId(id);
+  QHidSpinStats result;
+
+  if (!device) {
+    return result;
+  }
+
+  hid_spin_stats stats;
+  QMutexLocker locker(&device->mutex);
+
+  if (hid_get_spin_stats(device->device, &stats) == 0) {
+    result.spinHits = stats.spin_hits;
+    result.sleeps = stats.sleeps;
+    result.spinMicroseconds = stats.spin_us;
+  }
+
+  return result;
+}
+
 /*!
    \brief Open a HID device by its path name.
 
@@ -536,13 +1556,13 @@ bool QHidApiPrivate::setNonBlocking(quint32 id)
 */
 quint32 QHidApiPrivate::open(QString path)
 {
-
-  quint32 id = 0;
+  QMutexLocker locker(&mRegistryMutex);
 
   // have we opened this path before.
-  if (mPathMap.contains(path)) {
-    id = mPathMap.value(path);
-    return id;
+  const QHidDeviceRegistry::Record* record = mRegistry.findPath(path);
+
+  if (record != nullptr) {
+    return record->id;
   }
 
   // if not open it.
@@ -554,129 +1574,176 @@ quint32 QHidApiPrivate::open(QString path)
   }
 
   // have we already opened it.
-  if (mDeviceIdMap.contains(device)) {
-    id = mDeviceIdMap.value(device);
-    return id;
-  }
+  record = mRegistry.findDevice(device);
 
-  // get the next available id
-  id = nextId();
+  if (record != nullptr) {
+    return record->id;
+  }
 
-  // and save it away with the device
-  mIdDeviceMap.insert(id, device);
-  mDeviceIdMap.insert(device, id);
-  mPathMap.insert(path, id);
+  // and save it away with the device, under the next available id.
+  QHidDeviceRegistry::Record r;
+  r.device = device;
+  r.vendorId = 0;
+  r.productId = 0;
+  r.path = path;
 
-  return id;
+  return addDevice(r);
 }
 
 /*
-   Opens a new product for the supplied vendor/product/serial number.
-   returns the handle id if successful, otherwise  returns 0.
+   Opens a new product for the supplied vendor/product/serial number. Called
+   with mRegistryMutex held. returns the handle id if successful, otherwise
+   returns 0.
 */
 quint32 QHidApiPrivate::openNewProduct(ushort vendorId, ushort productId, QString serialNumber)
 {
   hid_device* device = NULL;
-  quint32 id = 0;
+  QString path;
 
   if (serialNumber.isEmpty()) {
     device = hid_open(vendorId, productId, NULL);
 
-    if (device != NULL) {
-      id = nextId();
-      QVariant v(id);
-      QMultiMap<ushort, QVariant> pmap;
-      pmap.insert(productId, v);
-      mVendorMap.insert(vendorId, pmap);
-      mIdDeviceMap.insert(id, device);
-      mDeviceIdMap.insert(device, id);
-    }
-
   } else {
-    wchar_t* sn = new wchar_t[serialNumber.length() + 1];
-    serialNumber.toWCharArray(sn);
-    sn[serialNumber.length()] = 0x0;
-    device = hid_open(0x4d8, 0xf1fa, NULL);
-
-    //        device = hid_open(vendorId, productId, sn/*, Q_NULLPTR*/);
-    if (device != Q_NULLPTR) {
-      id = nextId();
-      QVariant v(serialNumber);
-      QMultiMap<ushort, QVariant> pmap;
-      pmap.insert(productId, v);
-      mVendorMap.insert(vendorId, pmap);
-      mSerDevices.insert(serialNumber, id);
-      mIdDeviceMap.insert(id, device);
-      mDeviceIdMap.insert(device, id);
-    }
+    device = openSerial(vendorId, productId, serialNumber, path);
   }
 
-  return id;
+  if (device == NULL) {
+    return 0;
+  }
+
+  QHidDeviceRegistry::Record r;
+  r.device = device;
+  r.vendorId = vendorId;
+  r.productId = productId;
+  r.serialNumber = serialNumber;
+  r.path = path;
+
+  return addDevice(r);
 }
 
 /*
-   Opens a product for the supplied vendor/product/serial number. First checks if we already have
-   this combination open, otherwise opens a new one.
-
-   returns the handle id if successful, otherwise  returns 0.
+   Opens the device with the supplied vendor/product/serial number through the
+   serial number index, so a known device costs a hash lookup and hid_open_path().
+   The index is refreshed for this vendor/product once if the device isn't in it,
+   or if its path no longer opens because it has been plugged in again. As paths
+   are reused, the device a remembered path opens is checked against the
+   vendor/product/serial number, and if it is another device it is closed, the
+   entry dropped and the index refreshed.
+   Sets path to the opened path. returns the device if successful, otherwise NULL.
 */
-quint32 QHidApiPrivate::openProduct(ushort vendorId, ushort productId, QString serialNumber)
+hid_device* QHidApiPrivate::openSerial(ushort vendorId, ushort productId, QString serialNumber,
+                                       QString& path)
 {
-  quint32 id = 0;
+  QHidSerialKey key = { vendorId, productId, serialNumber };
 
-  /* First check if we already have this.
-     get list of all products for this vendor and
-     iterate through it to find it.
-  */
-  QList<QMultiMap<ushort, QVariant>> vmap = mVendorMap.values(vendorId);
-  QListIterator<QMultiMap<ushort, QVariant>> vmapIt(vmap);
+  for (int attempt = 0; attempt < 2; attempt++) {
+    hid_device_info* devices = attempt > 0 ? hid_enumerate(vendorId, productId) : NULL;
+    QString knownPath;
 
-  while (vmapIt.hasNext()) {
+    {
+      QMutexLocker locker(&mEnumerationMutex);
 
-    // iterate through them looking for all with this product id
-    QMultiMap<ushort, QVariant> pmap = vmapIt.next();
-    QMapIterator<ushort, QVariant> pmapIt(pmap);
+      if (attempt > 0) {
+        updateSerialIndex(vendorId, productId, devices);
+      }
 
-    while (pmapIt.hasNext()) {
-      pmapIt.next();
+      knownPath = mSerialPathIndex.value(key);
+    }
 
-      ushort p = pmapIt.key();
+    hid_free_enumeration(devices);
 
-      if (p == productId) {
-        // either an int id or a QString
-        QVariant v = pmapIt.value();
-        QVariant::Type t = v.type();
-        bool ok;
+    if (knownPath.isEmpty()) {
+      continue;
+    }
 
-        if (t == QVariant::UInt) {
+    hid_device* device = hid_open_path(knownPath.toLocal8Bit().data());
 
-          id = v.toUInt(&ok);
+    if (device == NULL) {
+      continue;
+    }
 
-          if (ok) {
-            if (mIdDeviceMap.contains(id)) {
-              return id;
-            }
-          }
+    if (isDevice(device, vendorId, productId, serialNumber)) {
+      path = knownPath;
+      return device;
+    }
 
-        } else if (t == QVariant::String) {
-          // must have been a string
-          QString sn = v.toString();
+    hid_close(device);
 
-          id = mSerDevices.value(sn, 0);
+    QMutexLocker locker(&mEnumerationMutex);
 
-          return id;
-        }
-      }
+    if (mSerialPathIndex.value(key) == knownPath) {
+      mSerialPathIndex.remove(key);
     }
   }
 
-  // Hah not found so open it if it exists.
-  id = openNewProduct(vendorId, productId, serialNumber);
+  return NULL;
+}
 
-  return id;
+/*
+   Whether the open device has vendorId, productId and serialNumber.
+*/
+bool QHidApiPrivate::isDevice(hid_device* device, ushort vendorId, ushort productId,
+                              const QString& serialNumber)
+{
+  unsigned short deviceVendorId, deviceProductId;
+
+  if (hid_get_device_ids(device, &deviceVendorId, &deviceProductId) != 0
+      || deviceVendorId != vendorId || deviceProductId != productId) {
+    return false;
+  }
+
+  wchar_t buf[MAX_STR];
+
+  if (hid_get_serial_number_string(device, buf, MAX_STR) == -1) {
+    return false;
+  }
+
+  buf[MAX_STR - 1] = 0;
+  return QString::fromWCharArray(buf) == serialNumber;
+}
+
+/*
+   Replaces the serial number index entries which match vendorId and productId
+   (0 matches anything, as for enumerate()) with those in devices. If devices is
+   not complete, because it came from a filtered enumeration, they are only added.
+   Called with mEnumerationMutex held.
+*/
+void QHidApiPrivate::updateSerialIndex(ushort vendorId, ushort productId, hid_device_info* devices,
+                                       bool complete)
+{
+  QHash<QHidSerialKey, QString>::iterator it = mSerialPathIndex.begin();
+
+  while (complete && it != mSerialPathIndex.end()) {
+    if ((vendorId == 0 || it.key().vendorId == vendorId) &&
+        (productId == 0 || it.key().productId == productId)) {
+      it = mSerialPathIndex.erase(it);
+
+    } else {
+      ++it;
+    }
+  }
+
+  for (hid_device_info* info = devices; info != NULL; info = info->next) {
+    if (info->serial_number == NULL || info->serial_number[0] == 0) {
+      continue;
+    }
+
+    QHidSerialKey key = { info->vendor_id, info->product_id, fromWideString(info->serial_number) };
+    // composite devices share a serial number, keep the first interface.
+    if (!mSerialPathIndex.contains(key)) {
+      mSerialPathIndex.insert(key, QString(info->path));
+    }
+  }
 }
 
-quint32 QHidApiPrivate::nextId()
+/*
+   Converts a possibly NULL wide string from hidapi into a QString.
+*/
+QString QHidApiPrivate::fromWideString(const wchar_t* str)
 {
-  return mNextId++;
+  if (str == NULL) {
+    return QString();
+  }
+
+  return QString::fromWCharArray(str);
 }
@@ -26,72 +26,188 @@
 #ifndef QHIDAPI_P_H
 #define QHIDAPI_P_H
 
+#include <QAtomicInteger>
+#include <QAtomicPointer>
 #include <QObject>
 #include <QMap>
+#include <QHash>
 #include <QList>
+#include <QMutex>
+#include <QSharedPointer>
 #include <QVariant>
 
+#include "qhidapi.h"
+#include "qhidasyncexecutor.h"
 #include "qhiddeviceinfo.h"
+#include "qhiddeviceregistry.h"
+#include "qhiddescriptorcache.h"
+#include "qhidopendevice.h"
+#include "qhidreaderthread.h"
+#include "qhidusagemap.h"
 #include "hidapi.h"
 
 class QHidApi;
 
+/*
+   Key of the vendor id, product id and serial number -> path index.
+*/
+struct QHidSerialKey
+{
+  ushort vendorId;
+  ushort productId;
+  QString serialNumber;
+};
+
+inline bool operator==(const QHidSerialKey& a, const QHidSerialKey& b)
+{
+  return a.vendorId == b.vendorId && a.productId == b.productId && a.serialNumber == b.serialNumber;
+}
+
+inline uint qHash(const QHidSerialKey& key, uint seed = 0)
+{
+  return qHash(key.serialNumber, seed ^ ((uint(key.vendorId) << 16) | key.productId));
+}
+
 class QHidApiPrivate
 {
 public:
   QHidApiPrivate(ushort vendorId, ushort productId, QHidApi* parent);
   ~QHidApiPrivate();
 
-  QList<QHidDeviceInfo> enumerate(ushort vendorId = 0x0, ushort productId = 0x0);
+  QList<QHidDeviceInfo> enumerate(ushort vendorId = 0x0, ushort productId = 0x0,
+                                  QHidApi::EnumerateOptions options = QHidApi::NoEnumerateOptions);
+  QList<QHidDeviceInfo> enumerate(const QHidEnumerationFilter& filter,
+                                  QHidApi::EnumerateOptions options = QHidApi::NoEnumerateOptions);
 
   quint32 open(ushort vendor_id, ushort product_id, QString serial_number = QString());
   quint32 open(QString path);
   void close(quint32 id);
+  void close(const QList<quint32>& ids);
+  void closeAll();
   QByteArray read(quint32 id);
   QByteArray read(quint32 id, int timeout);
+  int read(quint32 id, QByteArray& report, int timeout);
+  bool cancelRead(quint32 id);
+  bool setReportHandler(quint32 id, QHidReportHandler handler);
   int write(quint32 id, QByteArray data, quint8 reportNumber);
   int write(quint32 id, QByteArray data);
   bool setBlocking(quint32 id);
   bool setNonBlocking(quint32 id);
+  bool setSpinBudget(quint32 id, int microseconds);
+  QHidSpinStats spinStats(quint32 id);
   QByteArray featureReport(quint32 id, uint reportId);
   int sendFeatureReport(quint32 id, quint8 reportId, QByteArray data);
+  QHidReportDescriptor reportDescriptor(quint32 id);
+  int resolveUsage(quint32 id, ushort usagePage, ushort usage, QHidReportField::ReportType type);
+  qint32 valueAt(quint32 id, int handle, bool* ok);
+  qint32 value(quint32 id, ushort usagePage, ushort usage, bool* ok);
+  QVector<qint32> values(quint32 id, const QVector<QHidUsage>& usages);
+  int setValue(quint32 id, ushort usagePage, ushort usage, qint32 value,
+               QHidReportField::ReportType type);
+  int write(quint32 id, const QVector<QHidUsageValue>& values);
+  int sendFeatureReport(quint32 id, const QVector<QHidUsageValue>& values);
   QString manufacturerString(quint32 id);
   QString productString(quint32 id);
   QString serialNumberString(quint32 id);
   QString indexedString(quint32 id, int index);
   QString error(quint32 id);
-  quint32 nextId();
+  QHidReaderThread* startReader(const QList<quint32>& ids, const QHidReaderOptions& options);
+  QFuture<QList<QHidDeviceInfo>> enumerateFuture(ushort vendorId, ushort productId,
+                                                 QHidApi::EnumerateOptions options);
+  QFuture<QList<QHidDeviceInfo>> enumerateFuture(const QHidEnumerationFilter& filter,
+                                                 QHidApi::EnumerateOptions options);
+  QFuture<quint32> openFuture(ushort vendorId, ushort productId, const QString& serialNumber);
+  QFuture<quint32> openFuture(const QString& path);
+  QFuture<QByteArray> readFuture(quint32 id, int timeout);
+  QFuture<int> writeFuture(quint32 id, const QByteArray& data);
+  QFuture<QByteArray> featureReportFuture(quint32 id, uint reportId);
+  QFuture<int> sendFeatureReportFuture(quint32 id, quint8 reportId, const QByteArray& data);
+  QFuture<QString> manufacturerStringFuture(quint32 id);
+  QFuture<QString> productStringFuture(quint32 id);
+  QFuture<QString> serialNumberStringFuture(quint32 id);
+  QFuture<QString> indexedStringFuture(quint32 id, int index);
   int init();
   int exit();
-  hid_device* findId(quint32 id);
-  quint32 openProduct(ushort vendorId, ushort productId, QString serialNumber);
+  QSharedPointer<QHidOpenDevice> findId(quint32 id);
+  void shutdownDevices(QList<QSharedPointer<QHidOpenDevice>>& devices);
+  static void HID_API_CALL inputReportCallback(void* context, hid_device* device,
+                                               const unsigned char* data, size_t length);
+  int readReport(QHidOpenDevice* device, QByteArray& data, int timeout, bool deviceMode = false);
+  quint32 addDevice(const QHidDeviceRegistry::Record& record);
+  QSharedPointer<QHidOpenDevice> takeDevice(quint32 id);
   quint32 openNewProduct(ushort vendorId, ushort productId, QString serialNumber);
+  hid_device* openSerial(ushort vendorId, ushort productId, QString serialNumber, QString& path);
+  bool isDevice(hid_device* device, ushort vendorId, ushort productId, const QString& serialNumber);
+  QHidReportDescriptor reportDescriptor(QHidOpenDevice* device);
+  QHidUsageMap* usageMap(QHidOpenDevice* device);
+  int sendEncodedReport(quint32 id, const QVector<QHidUsageValue>& values,
+                        QHidReportField::ReportType type);
+  int sendEncodedReport(hid_device* device, const QHidReportEncoder* encoder, quint8 reportId);
+  void updateSerialIndex(ushort vendorId, ushort productId, hid_device_info* devices,
+                         bool complete = true);
+
+  static QString fromWideString(const wchar_t* str);
 
   static const int MAX_STR = 255;
+  // the longest a read for a future waits between checks for cancellation, in milliseconds.
+  static const int ASYNC_WAIT_SLICE = 50;
+  static const int SLOT_PAGE_SIZE = 256;
+  static const int SLOT_PAGE_COUNT = 0x10000 / SLOT_PAGE_SIZE;
+
+  /*
+     The open device in one registry slot. findId() takes no lock: it counts
+     itself in readers, checks the device is there under id, which holds the
+     slot's generation, and copies owner. addDevice() sets owner and id before
+     publishing device, and takeDevice() clears device and waits for readers
+     to drain before it lets go of owner.
+  */
+  struct DeviceSlot {
+    QAtomicInt readers;
+    QAtomicInteger<quint32> id;
+    QAtomicPointer<QHidOpenDevice> device;
+    QSharedPointer<QHidOpenDevice> owner;
+  };
+
+  // keeps the counts of neighbouring slots off each other's cache lines.
+  struct PaddedDeviceSlot : DeviceSlot {
+    char padding[64];
+  };
+
+  // the slots are made a page at a time as the registry grows, and kept.
+  struct DeviceSlotPage {
+    PaddedDeviceSlot entries[SLOT_PAGE_SIZE];
+  };
 
   quint32 mVendorId, mProductId;
-  quint32 mNextId;
-  QList<QHidDeviceInfo> mDeviceInfoList;
   /*
-     map of vendorId -> productId.
+     the open devices by registry slot, each with its own strings, descriptor
+     and usage map, which are filled the first time they are asked for.
   */
-  QMultiMap<ushort, QMultiMap<ushort, QVariant>> mVendorMap;
+  QAtomicPointer<DeviceSlotPage> mSlotPages[SLOT_PAGE_COUNT];
   /*
-     map of serialNumber -> id.
+     the open devices by id, handle, path and vendorId/productId/serialNumber,
+     only used to open and close devices, under mRegistryMutex.
   */
-  QMap<QString, quint32> mSerDevices;
+  QHidDeviceRegistry mRegistry;
+  QMutex mRegistryMutex;
   /*
-     map of QString path -> id.
+     the last enumeration, and the index of vendorId, productId and
+     serialNumber -> path, rebuilt for the matching ids by every enumeration
+     that reads the strings, both under mEnumerationMutex.
   */
-  QMap<QString, quint32> mPathMap;
+  QList<QHidDeviceInfo> mDeviceInfoList;
+  QHash<QHidSerialKey, QString> mSerialPathIndex;
+  QMutex mEnumerationMutex;
   /*
-     map of id -> handle.
+     parsed descriptors of every device model seen, kept on disk between runs,
+     under mDescriptorCacheMutex.
   */
-  QMap<quint32, hid_device*> mIdDeviceMap;
+  QHidDescriptorCache mDescriptorCache;
+  QMutex mDescriptorCacheMutex;
   /*
-     reverse of idDeviceMap. Used to check if we already heve a device opened..
+     runs the calls of the QFuture functions, one at a time for each device.
   */
-  QMap<hid_device*, quint32> mDeviceIdMap;
+  QHidAsyncExecutor mAsync;
 
 private:
   QHidApi* q_ptr;
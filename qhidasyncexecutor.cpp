@@ -0,0 +1,138 @@
+/*
+  Copyright 2020 Simon Meaden
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+  of the Software, and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  @author: Simon Meaden
+
+*/
+#include "qhidasyncexecutor.h"
+
+#include <QMutexLocker>
+#include <QRunnable>
+
+namespace {
+
+class QHidAsyncJob : public QRunnable
+{
+public:
+  explicit QHidAsyncJob(std::function<void()> job) :
+    mJob(std::move(job))
+  {
+    setAutoDelete(true);
+  }
+
+  void run() override
+  {
+    mJob();
+  }
+
+private:
+  std::function<void()> mJob;
+};
+
+}
+
+QHidAsyncExecutor::QHidAsyncExecutor(int maxThreadCount, int maxReadThreadCount) :
+  mStopping(0)
+{
+  mPool.setMaxThreadCount(maxThreadCount);
+  mReadPool.setMaxThreadCount(maxReadThreadCount);
+}
+
+QHidAsyncExecutor::~QHidAsyncExecutor()
+{
+  stop();
+}
+
+bool QHidAsyncExecutor::isStopping() const
+{
+  return mStopping.loadAcquire() != 0;
+}
+
+/*
+   Skips the calls still queued, and waits for the running ones, which are
+   expected to return soon once isStopping() is set.
+*/
+void QHidAsyncExecutor::stop()
+{
+  mStopping.storeRelease(1);
+  mPool.waitForDone();
+  mReadPool.waitForDone();
+}
+
+/*
+   The key of a device's lane in mQueues, the lane in the low bit.
+*/
+quint64 QHidAsyncExecutor::laneKey(quint32 deviceId, Lane lane)
+{
+  return (quint64(deviceId) << 1) | quint64(lane);
+}
+
+void QHidAsyncExecutor::post(quint32 deviceId, Lane lane, std::function<void()> job)
+{
+  if (deviceId == 0) {
+    mPool.start(new QHidAsyncJob(std::move(job)));
+    return;
+  }
+
+  const quint64 key = laneKey(deviceId, lane);
+  QMutexLocker locker(&mMutex);
+  QHash<quint64, QQueue<std::function<void()>>>::iterator it = mQueues.find(key);
+
+  // a queue, even an empty one, means a call in the lane is running.
+  if (it != mQueues.end()) {
+    it.value().enqueue(std::move(job));
+    return;
+  }
+
+  mQueues.insert(key, QQueue<std::function<void()>>());
+  locker.unlock();
+
+  start(key, std::move(job));
+}
+
+void QHidAsyncExecutor::start(quint64 key, std::function<void()> job)
+{
+  QThreadPool& pool = (Lane(key & 1) == ReadLane) ? mReadPool : mPool;
+
+  pool.start(new QHidAsyncJob([this, key, job] {
+    job();
+    next(key);
+  }));
+}
+
+/*
+   Starts the next call in the lane, or marks it idle.
+*/
+void QHidAsyncExecutor::next(quint64 key)
+{
+  QMutexLocker locker(&mMutex);
+  QHash<quint64, QQueue<std::function<void()>>>::iterator it = mQueues.find(key);
+
+  if (it.value().isEmpty()) {
+    mQueues.erase(it);
+    return;
+  }
+
+  std::function<void()> job = it.value().dequeue();
+  locker.unlock();
+
+  start(key, std::move(job));
+}
@@ -0,0 +1,113 @@
+/*
+  Copyright 2020 Simon Meaden
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+  of the Software, and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  @author: Simon Meaden
+
+*/
+#ifndef QHIDASYNCEXECUTOR_H
+#define QHIDASYNCEXECUTOR_H
+
+#include <QAtomicInt>
+#include <QFuture>
+#include <QFutureInterface>
+#include <QHash>
+#include <QMutex>
+#include <QQueue>
+#include <QThreadPool>
+
+#include <functional>
+
+/*
+   Runs the blocking calls behind QHidApi's QFuture functions on a thread pool
+   of its own, bounded so that slow calls can't take over the global pool.
+
+   Calls on a device run one at a time, in the order they were made: the
+   first goes to the pool and the rest queue behind it, each started by the
+   one before as it finishes. Reads go in a lane of their own, as the
+   synchronous calls take readMutex rather than mutex, so a read waiting for
+   a report never holds up a feature report or string call on the device,
+   and run on a pool of their own, so reads waiting on several devices don't
+   leave the other calls without threads. A device holds at most one thread
+   of each pool. Calls with no device, enumerate and open, go straight to the
+   control pool.
+
+   A call whose future is cancelled before it starts, or which is still
+   queued when the executor stops, is skipped. The call is given its
+   QFutureInterface, so one which waits, like a read, can check for
+   cancellation and isStopping() as it goes.
+*/
+class QHidAsyncExecutor
+{
+public:
+  enum Lane {
+    ControlLane,
+    ReadLane,
+  };
+
+  explicit QHidAsyncExecutor(int maxThreadCount = 4, int maxReadThreadCount = 64);
+  ~QHidAsyncExecutor();
+
+  template<typename T>
+  QFuture<T> run(quint32 deviceId, std::function<T(QFutureInterface<T>&)> call,
+                 Lane lane = ControlLane)
+  {
+    QFutureInterface<T> result;
+    result.reportStarted();
+    QFuture<T> future = result.future();
+
+    post(deviceId, lane, [this, result, call]() mutable {
+      if (isStopping()) {
+        result.reportCanceled();
+      }
+
+      if (!result.isCanceled()) {
+        T value = call(result);
+
+        if (!result.isCanceled()) {
+          result.reportResult(value);
+        }
+      }
+
+      result.reportFinished();
+    });
+
+    return future;
+  }
+
+  bool isStopping() const;
+  void stop();
+
+private:
+  static quint64 laneKey(quint32 deviceId, Lane lane);
+
+  void post(quint32 deviceId, Lane lane, std::function<void()> job);
+  void start(quint64 key, std::function<void()> job);
+  void next(quint64 key);
+
+  QThreadPool mPool;
+  QThreadPool mReadPool;
+  QAtomicInt mStopping;
+  QMutex mMutex;
+  // device id and lane -> the calls waiting behind the one running, under mMutex.
+  QHash<quint64, QQueue<std::function<void()>>> mQueues;
+};
+
+#endif // QHIDASYNCEXECUTOR_H
@@ -0,0 +1,138 @@
+/*
+  Copyright 2020 Simon Meaden
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+  of the Software, and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  @author: Simon Meaden
+
+*/
+#include "qhidawaitable.h"
+
+#ifdef QHIDAPI_COROUTINES
+
+#include <QFutureWatcher>
+#include <QMutexLocker>
+#include <QSocketNotifier>
+#include <QTimer>
+
+#include "qhidapi.h"
+#include "qhidapi_p.h"
+
+/*!
+   \class QHidReadAwaitable
+   \brief Reads an input report from a coroutine, which is suspended until the report
+   comes without holding up a thread.
+
+   Made by QHidApi::readAsync(). A report that is already waiting is returned without
+   suspending. Otherwise the coroutine is suspended and a QSocketNotifier, in the
+   thread of the QHidApi, watches the descriptor from hid_get_read_fd(): the hidraw
+   device on Linux, or the pipe the libusb and Mac backends keep in step with their
+   queue of received reports. When it becomes readable the report is read and the
+   coroutine resumed, from that thread's event loop. So any number of sessions can
+   wait on their devices from one thread.
+   \code
+       QHidTask session(QHidApi* api, quint32 id)
+       {
+           co_await api->writeAsync(id, command);
+           QByteArray response = co_await api->readAsync(id);
+           ...
+       }
+   \endcode
+
+   Neither closing the device nor QHidApi::cancelRead() makes the descriptor readable,
+   so the wait also looks every QHidApiPrivate::ASYNC_WAIT_SLICE milliseconds for the
+   device being closed, or a cancel, which a read with a timeout of 0 returns. Either
+   resumes the coroutine with an empty report, and lets go of the device.
+
+   Where the backend has no descriptor, as on Windows, the report is read as by
+   QHidApi::readFuture(), on the read threads of the futures in short slices, and a
+   QFutureWatcher resumes the coroutine. So a waiting read never holds a thread of
+   QThreadPool::globalInstance(), and ends when the device is closed. The QHidApi
+   must outlive the coroutines waiting on it.
+*/
+
+QHidReadAwaitable::QHidReadAwaitable(QHidApi* api, QHidApiPrivate* d, quint32 id) :
+  mApi(api),
+  d(d),
+  mId(id),
+  mDevice(d->findId(id))
+{
+}
+
+/*
+   Ready if a report is already waiting, or the device isn't open.
+*/
+bool QHidReadAwaitable::await_ready()
+{
+  return !mDevice || d->readReport(mDevice.data(), mResult, 0) != 0;
+}
+
+void QHidReadAwaitable::await_suspend(std::coroutine_handle<> handle)
+{
+  // the notifier has to be made in the thread whose event loop it is on.
+  QMetaObject::invokeMethod(mApi, [this, handle] { wait(handle); }, Qt::QueuedConnection);
+}
+
+QByteArray QHidReadAwaitable::await_resume()
+{
+  return mResult;
+}
+
+/*
+   Waits for the device's read descriptor from the QHidApi's thread, then
+   reads the report and resumes handle.
+*/
+void QHidReadAwaitable::wait(std::coroutine_handle<> handle)
+{
+  int fd;
+
+  {
+    QMutexLocker locker(&mDevice->mutex);
+    fd = hid_get_read_fd(mDevice->device);
+  }
+
+  if (fd < 0) {
+    resumeWhenFinished(mApi, d->readFuture(mId, -1), &mResult, handle);
+    mDevice.reset();
+    return;
+  }
+
+  QSocketNotifier* notifier = new QSocketNotifier(fd, QSocketNotifier::Read, mApi);
+  QTimer* timer = new QTimer(notifier);
+
+  std::function<void()> check = [this, notifier, timer, handle] {
+    // 0 if another reader took the report first, so keep waiting. A cancel or an
+    // error leaves mResult empty, as does the device being closed.
+    if (!mDevice->closed.loadAcquire() && d->readReport(mDevice.data(), mResult, 0) == 0) {
+      return;
+    }
+
+    mDevice.reset();
+    timer->stop();
+    notifier->setEnabled(false);
+    notifier->deleteLater();
+    handle.resume();
+  };
+
+  QObject::connect(notifier, &QSocketNotifier::activated, notifier, check);
+  QObject::connect(timer, &QTimer::timeout, notifier, check);
+  timer->start(QHidApiPrivate::ASYNC_WAIT_SLICE);
+}
+
+#endif // QHIDAPI_COROUTINES
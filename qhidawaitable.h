@@ -0,0 +1,135 @@
+/*
+  Copyright 2020 Simon Meaden
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+  of the Software, and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  @author: Simon Meaden
+
+*/
+#ifndef QHIDAWAITABLE_H
+#define QHIDAWAITABLE_H
+
+#include "qhidapi_global.h"
+
+#ifdef QHIDAPI_COROUTINES
+
+#include <QByteArray>
+#include <QFuture>
+#include <QFutureWatcher>
+#include <QObject>
+#include <QSharedPointer>
+
+#include <coroutine>
+#include <exception>
+#include <functional>
+
+class QHidApi;
+class QHidApiPrivate;
+struct QHidOpenDevice;
+
+/** A coroutine which starts at once and runs to its end on its own, resumed by the
+    QHidApi awaitables, for sessions which nothing waits on. */
+struct QHidTask {
+  struct promise_type {
+    QHidTask get_return_object() { return QHidTask(); }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+};
+
+class QHIDAPISHARED_EXPORT QHidAwaitableBase
+{
+protected:
+  /* Resumes handle from the event loop of context's thread once future has
+     finished, with its result in result, left alone if there is none. */
+  template<typename T>
+  static void resumeWhenFinished(QObject* context, QFuture<T> future, T* result,
+                                 std::coroutine_handle<> handle)
+  {
+    // the watcher has to be made in the thread whose event loop it is on.
+    QMetaObject::invokeMethod(context, [context, future, result, handle] {
+      QFutureWatcher<T>* watcher = new QFutureWatcher<T>(context);
+      QObject::connect(watcher, &QFutureWatcherBase::finished, watcher, [watcher, result, handle] {
+        // no result if the futures were stopped first.
+        if (watcher->future().resultCount() > 0) {
+          *result = watcher->result();
+        }
+
+        watcher->deleteLater();
+        handle.resume();
+      });
+      watcher->setFuture(future);
+    }, Qt::QueuedConnection);
+  }
+};
+
+/** The awaitable of QHidApi::readAsync(), the report or an empty QByteArray on error. */
+class QHIDAPISHARED_EXPORT QHidReadAwaitable : private QHidAwaitableBase
+{
+public:
+  bool await_ready();
+  void await_suspend(std::coroutine_handle<> handle);
+  QByteArray await_resume();
+
+private:
+  friend class QHidApi;
+
+  QHidReadAwaitable(QHidApi* api, QHidApiPrivate* d, quint32 id);
+  void wait(std::coroutine_handle<> handle);
+
+  QHidApi* mApi;
+  QHidApiPrivate* d;
+  quint32 mId;
+  QSharedPointer<QHidOpenDevice> mDevice;
+  QByteArray mResult;
+};
+
+/** The awaitable of a QHidApi call which runs on the thread pool of the futures, the
+    call's result. */
+template<typename T>
+class QHidCallAwaitable : private QHidAwaitableBase
+{
+public:
+  bool await_ready() const { return false; }
+
+  void await_suspend(std::coroutine_handle<> handle)
+  {
+    resumeWhenFinished(mContext, mStart(), &mResult, handle);
+  }
+
+  T await_resume() { return mResult; }
+
+private:
+  friend class QHidApi;
+
+  QHidCallAwaitable(QObject* context, std::function<QFuture<T>()> start) :
+    mContext(context),
+    mStart(std::move(start)),
+    mResult() {}
+
+  QObject* mContext;
+  std::function<QFuture<T>()> mStart;
+  T mResult;
+};
+
+#endif // QHIDAPI_COROUTINES
+
+#endif // QHIDAWAITABLE_H
@@ -0,0 +1,412 @@
+/*
+  Copyright 2020 Simon Meaden
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+  of the Software, and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  @author: Simon Meaden
+
+*/
+#include "qhiddescriptorcache.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+#include <cstring>
+#include <type_traits>
+
+static_assert(std::is_trivially_copyable<QHidReportField>::value,
+              "fields are copied to and from the cache file as they are");
+static_assert(std::is_trivially_copyable<QHidReportDescriptor::Report>::value,
+              "reports are copied to and from the cache file as they are");
+
+// bump when the layout of the file changes.
+static const quint32 CACHE_VERSION = 1;
+// the file stops growing at this size.
+static const qint64 MAX_CACHE_SIZE = 4 * 1024 * 1024;
+
+namespace {
+
+struct FileHeader {
+  char magic[4];
+  quint32 version;
+  quint32 fieldSize;   // sizeof(QHidReportField) in the build that wrote the file.
+  quint32 reportSize;  // sizeof(QHidReportDescriptor::Report) likewise.
+};
+
+/*
+   Followed by the raw descriptor, the fields and the reports, each padded
+   to a multiple of 8 bytes.
+*/
+struct EntryHeader {
+  quint32 size;  // bytes in the entry, including this header.
+  quint16 vendorId;
+  quint16 productId;
+  quint16 releaseNumber;
+  quint16 usesReportIds;
+  quint64 hash;
+  quint32 descriptorSize;
+  quint32 fieldCount;
+  quint32 reportCount;
+  quint16 usagePage;
+  quint16 usage;
+};
+
+}
+
+static inline qint64 padded(qint64 size)
+{
+  return (size + 7) & ~qint64(7);
+}
+
+static FileHeader currentHeader()
+{
+  FileHeader header;
+  std::memcpy(header.magic, "QHDC", 4);
+  header.version = CACHE_VERSION;
+  header.fieldSize = sizeof(QHidReportField);
+  header.reportSize = sizeof(QHidReportDescriptor::Report);
+  return header;
+}
+
+static bool validType(QHidReportField::ReportType type)
+{
+  return type == QHidReportField::InputReport || type == QHidReportField::OutputReport
+         || type == QHidReportField::FeatureReport;
+}
+
+/*
+   Whether the tables copied out of an entry are ones the parser could have
+   made: every report's fields in range, of its type and id, and inside its
+   bits. The file is shared, so an entry can be damaged or from a build with
+   the same table sizes but another layout, and the decoders and encoders
+   index the fields by these ranges without checking them.
+*/
+static bool validTables(const QVector<QHidReportField>& fields,
+                        const QVector<QHidReportDescriptor::Report>& reports)
+{
+  for (const QHidReportField& field : fields) {
+    if (!validType(field.type)) {
+      return false;
+    }
+  }
+
+  for (const QHidReportDescriptor::Report& report : reports) {
+    if (!validType(report.type) || report.firstField < 0 || report.fieldCount < 0
+        || qint64(report.firstField) + report.fieldCount > fields.size()) {
+      return false;
+    }
+
+    for (int f = report.firstField; f < report.firstField + report.fieldCount; f++) {
+      const QHidReportField& field = fields.at(f);
+
+      if (field.type != report.type || field.reportId != report.reportId
+          || quint64(field.bitOffset) + quint64(field.bitSize) * field.count > report.bitSize) {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+uint qHash(const QHidDescriptorCache::Key& key, uint seed)
+{
+  return qHash(key.hash ^ (quint64(key.vendorId) << 32) ^ (quint64(key.productId) << 16)
+               ^ key.releaseNumber, seed);
+}
+
+/*
+   The cache in fileName, or in defaultFileName() if fileName is empty. The
+   file isn't read until the first lookup.
+*/
+QHidDescriptorCache::QHidDescriptorCache(const QString& fileName) :
+  mFile(fileName.isEmpty() ? defaultFileName() : fileName),
+  mMap(nullptr),
+  mMapSize(0),
+  mFileSize(-1),
+  mLoaded(false)
+{
+}
+
+QHidDescriptorCache::~QHidDescriptorCache()
+{
+  unmap();
+}
+
+/*
+   qhidapi/descriptors.cache in the user's cache directory, under
+   XDG_CACHE_HOME on Linux.
+*/
+QString QHidDescriptorCache::defaultFileName()
+{
+  return QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation)
+         + "/qhidapi/descriptors.cache";
+}
+
+QString QHidDescriptorCache::fileName() const
+{
+  return mFile.fileName();
+}
+
+/*
+   The parsed form of descriptor if it is in the cache, otherwise an invalid
+   descriptor.
+*/
+QHidReportDescriptor QHidDescriptorCache::find(ushort vendorId, ushort productId,
+    ushort releaseNumber, const QByteArray& descriptor)
+{
+  if (!mLoaded) {
+    load();
+  }
+
+  Key key = {vendorId, productId, releaseNumber, hashDescriptor(descriptor)};
+
+  QHash<Key, QHidReportDescriptor>::const_iterator added = mAdded.constFind(key);
+
+  if (added != mAdded.constEnd()) {
+    return added.value().data() == descriptor ? added.value() : QHidReportDescriptor();
+  }
+
+  QHash<Key, qint64>::const_iterator it = mIndex.constFind(key);
+
+  if (it == mIndex.constEnd()) {
+    return QHidReportDescriptor();
+  }
+
+  const uchar* entry = mMap + it.value();
+  EntryHeader header;
+  std::memcpy(&header, entry, sizeof(header));
+
+  // the hash only picks the entry, the descriptor itself has to match.
+  const uchar* raw = entry + sizeof(EntryHeader);
+
+  if (int(header.descriptorSize) != descriptor.size()
+      || std::memcmp(raw, descriptor.constData(), header.descriptorSize) != 0) {
+    return QHidReportDescriptor();
+  }
+
+  const uchar* fields = raw + padded(header.descriptorSize);
+  const uchar* reports = fields + padded(qint64(header.fieldCount) * sizeof(QHidReportField));
+
+  QHidReportDescriptor result;
+  result.mData = descriptor;
+  result.mFields.resize(int(header.fieldCount));
+  std::memcpy(result.mFields.data(), fields, header.fieldCount * sizeof(QHidReportField));
+  result.mReports.resize(int(header.reportCount));
+  std::memcpy(result.mReports.data(), reports,
+              header.reportCount * sizeof(QHidReportDescriptor::Report));
+
+  // a damaged entry is dropped from the index, so the descriptor is parsed and appended again.
+  if (!validTables(result.mFields, result.mReports)) {
+    mIndex.remove(key);
+    return QHidReportDescriptor();
+  }
+
+  result.mUsesReportIds = header.usesReportIds != 0;
+  result.mUsagePage = header.usagePage;
+  result.mUsage = header.usage;
+  result.mValid = true;
+
+  return result;
+}
+
+/*
+   Appends a parsed descriptor to the cache file. Returns false if the
+   descriptor is invalid, or the file can't be written or is full.
+*/
+bool QHidDescriptorCache::insert(ushort vendorId, ushort productId, ushort releaseNumber,
+                                 const QHidReportDescriptor& descriptor)
+{
+  if (!descriptor.isValid()) {
+    return false;
+  }
+
+  if (!mLoaded) {
+    load();
+  }
+
+  Key key = {vendorId, productId, releaseNumber, hashDescriptor(descriptor.data())};
+
+  if (mAdded.contains(key) || mIndex.contains(key)) {
+    return true;
+  }
+
+  const QByteArray& raw = descriptor.mData;
+  const qint64 fieldsSize = qint64(descriptor.mFields.size()) * sizeof(QHidReportField);
+  const qint64 reportsSize = qint64(descriptor.mReports.size()) * sizeof(QHidReportDescriptor::Report);
+  const qint64 size = sizeof(EntryHeader) + padded(raw.size()) + padded(fieldsSize)
+                      + padded(reportsSize);
+
+  if (mFileSize < 0 || mFileSize + size > MAX_CACHE_SIZE) {
+    return false;
+  }
+
+  EntryHeader header;
+  std::memset(&header, 0, sizeof(header));
+  header.size = quint32(size);
+  header.vendorId = vendorId;
+  header.productId = productId;
+  header.releaseNumber = releaseNumber;
+  header.usesReportIds = descriptor.mUsesReportIds ? 1 : 0;
+  header.hash = key.hash;
+  header.descriptorSize = quint32(raw.size());
+  header.fieldCount = quint32(descriptor.mFields.size());
+  header.reportCount = quint32(descriptor.mReports.size());
+  header.usagePage = descriptor.mUsagePage;
+  header.usage = descriptor.mUsage;
+
+  QByteArray entry(int(size), '\0');
+  char* p = entry.data();
+  std::memcpy(p, &header, sizeof(header));
+  p += sizeof(header);
+  std::memcpy(p, raw.constData(), size_t(raw.size()));
+  p += padded(raw.size());
+  std::memcpy(p, descriptor.mFields.constData(), size_t(fieldsSize));
+  p += padded(fieldsSize);
+  std::memcpy(p, descriptor.mReports.constData(), size_t(reportsSize));
+
+  // one write in append mode, so that entries from other processes stay whole.
+  QFile file(mFile.fileName());
+
+  if (!file.open(QIODevice::WriteOnly | QIODevice::Append)
+      || file.write(entry) != entry.size()) {
+    return false;
+  }
+
+  mFileSize += size;
+  mAdded.insert(key, descriptor);
+
+  return true;
+}
+
+/*
+   The parsed form of descriptor, from the cache if it is there, otherwise
+   parsed and added to the cache.
+*/
+QHidReportDescriptor QHidDescriptorCache::parse(ushort vendorId, ushort productId,
+    ushort releaseNumber, const QByteArray& descriptor)
+{
+  QHidReportDescriptor result = find(vendorId, productId, releaseNumber, descriptor);
+
+  if (!result.isValid()) {
+    result = QHidReportDescriptor::parse(descriptor);
+    insert(vendorId, productId, releaseNumber, result);
+  }
+
+  return result;
+}
+
+quint64 QHidDescriptorCache::hashDescriptor(const QByteArray& descriptor)
+{
+  // FNV-1a, as the Linux backend uses for its usage cache.
+  quint64 hash = Q_UINT64_C(0xcbf29ce484222325);
+
+  for (int i = 0; i < descriptor.size(); i++) {
+    hash ^= uchar(descriptor.at(i));
+    hash *= Q_UINT64_C(0x100000001b3);
+  }
+
+  return hash;
+}
+
+/*
+   Maps the cache file and indexes its entries, creating the file if it is
+   missing or was written by an incompatible build.
+*/
+void QHidDescriptorCache::load()
+{
+  mLoaded = true;
+
+  const FileHeader expected = currentHeader();
+  FileHeader header;
+  std::memset(&header, 0, sizeof(header));
+
+  if (mFile.open(QIODevice::ReadOnly)) {
+    mMapSize = mFile.size();
+
+    if (mMapSize >= qint64(sizeof(FileHeader))) {
+      mMap = mFile.map(0, mMapSize);
+    }
+
+    if (mMap != nullptr) {
+      std::memcpy(&header, mMap, sizeof(header));
+    }
+  }
+
+  if (mMap == nullptr || std::memcmp(&header, &expected, sizeof(header)) != 0) {
+    unmap();
+
+    QDir().mkpath(QFileInfo(mFile.fileName()).absolutePath());
+
+    /*
+       never truncated in place, as another process may have the file mapped.
+       A new file is written beside it and renamed over it, which leaves the
+       old one to whoever has it mapped.
+    */
+    QSaveFile file(mFile.fileName());
+
+    if (file.open(QIODevice::WriteOnly)
+        && file.write(reinterpret_cast<const char*>(&expected), sizeof(expected))
+        == qint64(sizeof(expected))
+        && file.commit()) {
+      mFileSize = sizeof(expected);
+    }
+
+    return;
+  }
+
+  mFileSize = mMapSize;
+
+  qint64 offset = sizeof(FileHeader);
+
+  while (offset + qint64(sizeof(EntryHeader)) <= mMapSize) {
+    EntryHeader entry;
+    std::memcpy(&entry, mMap + offset, sizeof(entry));
+
+    const qint64 size = sizeof(EntryHeader) + padded(entry.descriptorSize)
+                        + padded(qint64(entry.fieldCount) * sizeof(QHidReportField))
+                        + padded(qint64(entry.reportCount) * sizeof(QHidReportDescriptor::Report));
+
+    // an entry that doesn't add up, or runs off the end, ends the index.
+    if (entry.size != size || offset + size > mMapSize) {
+      break;
+    }
+
+    Key key = {entry.vendorId, entry.productId, entry.releaseNumber, entry.hash};
+    mIndex.insert(key, offset);
+    offset += size;
+  }
+}
+
+void QHidDescriptorCache::unmap()
+{
+  if (mMap != nullptr) {
+    mFile.unmap(mMap);
+    mMap = nullptr;
+  }
+
+  mMapSize = 0;
+  mIndex.clear();
+
+  if (mFile.isOpen()) {
+    mFile.close();
+  }
+}
@@ -0,0 +1,100 @@
+/*
+  Copyright 2020 Simon Meaden
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+  of the Software, and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  @author: Simon Meaden
+
+*/
+#ifndef QHIDDESCRIPTORCACHE_H
+#define QHIDDESCRIPTORCACHE_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QString>
+
+#include "qhidreportdescriptor.h"
+
+/*
+   A persistent cache of parsed report descriptors, shared by every process of
+   the user.
+
+   The cache file holds, for each descriptor seen, its vendor id, product id,
+   release number and hash, the raw descriptor and its field and report tables
+   as they are in memory. The file is memory mapped when first used and indexed
+   by key, so a known descriptor is found with a hash lookup, checked against
+   the raw bytes and copied out with no parsing. The tables copied out are
+   checked too, each report's fields in range and inside its bits, and an
+   entry which fails is parsed again and appended anew, the later entry
+   taking the key's place in the index.
+
+   Descriptors are only ever appended, each with a single write to a file
+   opened for appending, so processes sharing the file don't corrupt each
+   other's entries. A truncated or foreign entry ends the index, and a file
+   from another build of the library, with differently sized tables, is
+   replaced by a new one renamed over it, never truncated, as other processes
+   may have it mapped.
+*/
+class QHidDescriptorCache
+{
+public:
+  explicit QHidDescriptorCache(const QString& fileName = QString());
+  ~QHidDescriptorCache();
+
+  static QString defaultFileName();
+  QString fileName() const;
+
+  QHidReportDescriptor find(ushort vendorId, ushort productId, ushort releaseNumber,
+                            const QByteArray& descriptor);
+  bool insert(ushort vendorId, ushort productId, ushort releaseNumber,
+              const QHidReportDescriptor& descriptor);
+  QHidReportDescriptor parse(ushort vendorId, ushort productId, ushort releaseNumber,
+                             const QByteArray& descriptor);
+
+private:
+  struct Key {
+    ushort vendorId;
+    ushort productId;
+    ushort releaseNumber;
+    quint64 hash;
+
+    bool operator==(const Key& other) const
+    {
+      return vendorId == other.vendorId && productId == other.productId
+             && releaseNumber == other.releaseNumber && hash == other.hash;
+    }
+  };
+
+  friend uint qHash(const Key& key, uint seed);
+
+  static quint64 hashDescriptor(const QByteArray& descriptor);
+  void load();
+  void unmap();
+
+  QFile mFile;
+  uchar* mMap;
+  qint64 mMapSize;
+  qint64 mFileSize;
+  bool mLoaded;
+  QHash<Key, qint64> mIndex;                 // key -> offset of the entry in the map.
+  QHash<Key, QHidReportDescriptor> mAdded;   // inserted since the file was mapped.
+};
+
+#endif // QHIDDESCRIPTORCACHE_H
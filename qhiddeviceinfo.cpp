@@ -0,0 +1,158 @@
+/*
+  Copyright 2020 Simon Meaden
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+  of the Software, and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  @author: Simon Meaden
+
+*/
+#include "qhiddeviceinfo.h"
+#include "qhidapi_p.h"
+
+#include <QMutex>
+#include <QMutexLocker>
+
+#include <cstdlib>
+#include <cstring>
+
+struct QHidDeviceStrings {
+  QHidDeviceStrings() : fetched(false) {}
+
+  QMutex mutex;
+  bool fetched;
+  QString serialNumber;
+  QString manufacturerString;
+  QString productString;
+};
+
+QHidDeviceInfo::QHidDeviceInfo() :
+  vendorId(0),
+  productId(0),
+  releaseNumber(0),
+  usagePage(0),
+  usage(0),
+  interfaceNumber(-1),
+  busType(UnknownBus),
+  stringsFetched(true)
+{
+}
+
+/*!
+   \brief Get the Serial Number of the device.
+
+   If the device was enumerated with QHidApi::LazyStrings this reads the
+   strings from the device on first use and caches them.
+
+   \return a QString containing the serial number, otherwise an empty QString.
+*/
+QString QHidDeviceInfo::serial() const
+{
+  if (!mLazyStrings) {
+    return serialNumber;
+  }
+
+  fetchStrings();
+  return mLazyStrings->serialNumber;
+}
+
+/*!
+   \brief Get the Manufacturer String of the device.
+
+   If the device was enumerated with QHidApi::LazyStrings this reads the
+   strings from the device on first use and caches them.
+
+   \return a QString containing the manufacturers name, otherwise an empty QString.
+*/
+QString QHidDeviceInfo::manufacturer() const
+{
+  if (!mLazyStrings) {
+    return manufacturerString;
+  }
+
+  fetchStrings();
+  return mLazyStrings->manufacturerString;
+}
+
+/*!
+   \brief Get the Product String of the device.
+
+   If the device was enumerated with QHidApi::LazyStrings this reads the
+   strings from the device on first use and caches them.
+
+   \return a QString containing the product name, otherwise an empty QString.
+*/
+QString QHidDeviceInfo::product() const
+{
+  if (!mLazyStrings) {
+    return productString;
+  }
+
+  fetchStrings();
+  return mLazyStrings->productString;
+}
+
+/*
+   Marks the device's strings as not read, for an enumeration with
+   QHidApi::LazyStrings.
+*/
+void QHidDeviceInfo::setLazyStrings()
+{
+  stringsFetched = false;
+  mLazyStrings.reset(new QHidDeviceStrings);
+}
+
+/*!
+   \brief Read the strings of a device enumerated with QHidApi::LazyStrings,
+   if they haven't been read yet.
+
+   serial(), manufacturer() and product() call this, and so wait for the device the
+   first time. Every copy of the QHidDeviceInfo shares the strings, so calling this on
+   a worker thread saves the copies in a QHidDeviceInfoModel, for example, from waiting.
+   This can be called from any thread. The three strings are read in one go, as the
+   backends fetch them together, and a failed read is not retried, the strings staying
+   empty.
+*/
+void QHidDeviceInfo::fetchStrings() const
+{
+  if (!mLazyStrings) {
+    return;
+  }
+
+  QMutexLocker locker(&mLazyStrings->mutex);
+
+  if (mLazyStrings->fetched) {
+    return;
+  }
+
+  mLazyStrings->fetched = true;
+
+  hid_device_info* info = static_cast<hid_device_info*>(calloc(1, sizeof(hid_device_info)));
+  info->path = strdup(path.toLocal8Bit().constData());
+  info->vendor_id = vendorId;
+  info->product_id = productId;
+  info->interface_number = interfaceNumber;
+
+  if (hid_get_device_info_strings(info) == 0) {
+    mLazyStrings->serialNumber = QHidApiPrivate::fromWideString(info->serial_number);
+    mLazyStrings->manufacturerString = QHidApiPrivate::fromWideString(info->manufacturer_string);
+    mLazyStrings->productString = QHidApiPrivate::fromWideString(info->product_string);
+  }
+
+  hid_free_enumeration(info);
+}
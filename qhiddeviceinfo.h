@@ -25,37 +25,73 @@ Permission is hereby granted, free of charge, to any person obtaining a copy
 #ifndef QHIDDEVICEINFO_H
 #define QHIDDEVICEINFO_H
 
+#include <QSharedPointer>
 #include <QString>
 
+struct QHidDeviceStrings;
+
 struct QHidDeviceInfo {
+    /** The bus a device is connected by, the same values as
+            the HID_BUS_* defines in hidapi.h. */
+    enum BusType {
+        UnknownBus = 0x00, //!< The platform can't tell.
+        UsbBus = 0x01,
+        BluetoothBus = 0x02,
+        I2cBus = 0x03,
+        SpiBus = 0x04,
+    };
+
+    QHidDeviceInfo();
+
     /** Platform-specific device path */
     QString path;
     /** Device Vendor ID */
     ushort vendorId;
     /** Device Product ID */
     ushort productId;
-    /** Serial Number */
+    /** Serial Number. Empty if stringsFetched is false, use serial()
+            to read it. */
     QString serialNumber;
     /** Device Release Number in binary-coded decimal,
             also known as Device Version Number */
     ushort releaseNumber;
-    /** Manufacturer String */
+    /** Manufacturer String. Empty if stringsFetched is false, use
+            manufacturer() to read it. */
     QString manufacturerString;
-    /** Product string */
+    /** Product string. Empty if stringsFetched is false, use product()
+            to read it. */
     QString productString;
-#if defined(Q_OS_WIN32) || defined(Q_OS_MAC)
-    /** Usage Page for this Device/Interface
-            (Windows/Mac only). */
+    /** Usage Page for this Device/Interface. Always 0
+            with the libusb backend. */
     ushort usagePage;
-    /** Usage for this Device/Interface
-            (Windows/Mac only).*/
+    /** Usage for this Device/Interface. Always 0
+            with the libusb backend.*/
     ushort usage;
-#endif
     /** The USB interface which this logical device
             represents. Valid on both Linux implementations
             in all cases, and valid on the Windows implementation
             only if the device contains more than one interface. */
     int interfaceNumber;
+    /** The bus the device is connected by. */
+    BusType busType;
+    /** True if the string fields were read by the enumeration. Devices
+            enumerated with QHidApi::LazyStrings have it false, and read
+            their strings on the first call to one of the accessors. */
+    bool stringsFetched;
+
+    QString serial() const;
+    QString manufacturer() const;
+    QString product() const;
+    void fetchStrings() const;
+
+private:
+    friend class QHidApiPrivate;
+
+    void setLazyStrings();
+
+    /* the strings of a device enumerated with LazyStrings, shared by every
+       copy of it and read once, under the holder's mutex. */
+    QSharedPointer<QHidDeviceStrings> mLazyStrings;
 };
 
 #endif // QHIDDEVICEINFO_H
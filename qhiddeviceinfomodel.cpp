@@ -31,6 +31,7 @@ QHidDeviceInfoModel::QHidDeviceInfoModel(QObject* parent) : QAbstractTableModel(
 QHidDeviceInfoModel::QHidDeviceInfoModel(QList<QHidDeviceInfo> data, QObject* parent) : QAbstractTableModel(parent)
 {
   m_data = data;
+  fetchStrings();
 }
 
 QHidDeviceInfoModel::~QHidDeviceInfoModel()
@@ -38,13 +39,27 @@ QHidDeviceInfoModel::~QHidDeviceInfoModel()
 
 }
 
+/*
+   Devices enumerated with QHidApi::LazyStrings have their strings read here,
+   each a request to the device, so that data() never waits on a device while
+   the view paints. Strings already read, on a worker thread with
+   QHidDeviceInfo::fetchStrings() for example, cost nothing here.
+*/
 void QHidDeviceInfoModel::setDataSet(QList<QHidDeviceInfo> data)
 {
   emit beginResetModel();
   m_data = data;
+  fetchStrings();
   emit endResetModel();
 }
 
+void QHidDeviceInfoModel::fetchStrings()
+{
+  for (const QHidDeviceInfo& info : m_data) {
+    info.fetchStrings();
+  }
+}
+
 int QHidDeviceInfoModel::rowCount(const QModelIndex& /*parent*/) const
 {
   return m_data.size();
@@ -68,15 +83,15 @@ QVariant QHidDeviceInfoModel::data(const QModelIndex& index, int role) const
       break;
 
     case 2:
-      return QVariant(m_data.at(index.row()).manufacturerString);
+      return QVariant(m_data.at(index.row()).manufacturer());
       break;
 
     case 3:
-      return QVariant(m_data.at(index.row()).productString);
+      return QVariant(m_data.at(index.row()).product());
       break;
 
     case 4:
-      return QVariant(m_data.at(index.row()).serialNumber);
+      return QVariant(m_data.at(index.row()).serial());
       break;
 
     case 5:
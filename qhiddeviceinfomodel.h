@@ -35,6 +35,8 @@ public slots:
     void setDataSet(QList<QHidDeviceInfo> data);
 
 protected:
+    void fetchStrings();
+
     QList<QHidDeviceInfo> m_data;
 
 };
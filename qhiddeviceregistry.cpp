@@ -0,0 +1,342 @@
+/*
+  Copyright 2020 Simon Meaden
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+  of the Software, and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  @author: Simon Meaden
+
+*/
+#include "qhiddeviceregistry.h"
+
+#include <QHash>
+
+// The size every index starts at, must be a power of two.
+static const int INITIAL_CAPACITY = 16;
+// The most devices that can be open at once, the slot has 16 bits of the id.
+static const int MAX_RECORDS = 0x10000;
+
+QHidDeviceRegistry::QHidDeviceRegistry() :
+  mCount(0)
+{
+  rehash(INITIAL_CAPACITY);
+}
+
+/*
+   Adds an open device. The record is copied, apart from its id which is assigned
+   here. The device should not already be in the registry.
+   Returns the new id, or 0 if there are too many open devices.
+*/
+quint32 QHidDeviceRegistry::insert(const Record& record)
+{
+  if (mFreeRecords.isEmpty() && mRecords.size() >= MAX_RECORDS) {
+    return 0;
+  }
+
+  int capacity = mIndexes[DeviceIndex].size();
+
+  // keep every index at most half full so probes stay short and always end.
+  for (int i = 0; i < IndexCount; i++) {
+    if ((mUsedSlots[i] + 1) * 2 > capacity) {
+      rehash((mCount + 1) * 4 > capacity ? capacity * 2 : capacity);
+      break;
+    }
+  }
+
+  int slot;
+
+  if (!mFreeRecords.isEmpty()) {
+    slot = mFreeRecords.takeLast();
+    mRecords[slot] = record;
+
+  } else {
+    slot = mRecords.size();
+    mRecords.append(record);
+    mGenerations.append(1);
+  }
+
+  quint32 id = (quint32(mGenerations.at(slot)) << 16) | quint32(slot);
+  mRecords[slot].id = id;
+
+  for (int i = 0; i < IndexCount; i++) {
+    if (indexed(i, record)) {
+      addToIndex(i, slot);
+    }
+  }
+
+  mCount++;
+
+  return id;
+}
+
+/*
+   Removes the device with the supplied id. Returns false if there is none.
+*/
+bool QHidDeviceRegistry::remove(quint32 id)
+{
+  const Record* record = findId(id);
+
+  if (record == nullptr) {
+    return false;
+  }
+
+  int slot = int(record - mRecords.constData());
+
+  for (int i = 0; i < IndexCount; i++) {
+    if (indexed(i, *record)) {
+      removeFromIndex(i, slot);
+    }
+  }
+
+  mRecords[slot] = Record();
+
+  if (nextGeneration(slot)) {
+    mFreeRecords.append(slot);
+  }
+
+  mCount--;
+
+  return true;
+}
+
+/*
+   Removes every device.
+*/
+void QHidDeviceRegistry::clear()
+{
+  // the generations are kept so that no id given out before is reused.
+  for (int i = 0; i < mRecords.size(); i++) {
+    if (mRecords.at(i).id != 0) {
+      mRecords[i] = Record();
+      nextGeneration(i);
+    }
+  }
+
+  mFreeRecords.clear();
+
+  for (int i = mRecords.size() - 1; i >= 0; i--) {
+    if (mGenerations.at(i) != 0) {
+      mFreeRecords.append(i);
+    }
+  }
+
+  mCount = 0;
+  rehash(INITIAL_CAPACITY);
+}
+
+/*
+   Moves slot on to its next generation, so the ids handed out for it so far are
+   stale. Returns false if the generation has run out, which leaves the slot
+   retired with a generation of 0, as handing it out again would repeat its
+   first id.
+*/
+bool QHidDeviceRegistry::nextGeneration(int slot)
+{
+  quint16 generation = mGenerations.at(slot) + 1;
+  mGenerations[slot] = generation;
+  return generation != 0;
+}
+
+const QHidDeviceRegistry::Record* QHidDeviceRegistry::findId(quint32 id) const
+{
+  int slot = int(id & 0xffff);
+
+  // the id holds the generation too, so a stale id doesn't match the slot's record.
+  if (id == 0 || slot >= mRecords.size() || mRecords.at(slot).id != id) {
+    return nullptr;
+  }
+
+  return &mRecords.at(slot);
+}
+
+const QHidDeviceRegistry::Record* QHidDeviceRegistry::findDevice(hid_device* device) const
+{
+  return probe(DeviceIndex, hashDevice(device), [device](const Record & r) {
+    return r.device == device;
+  });
+}
+
+const QHidDeviceRegistry::Record* QHidDeviceRegistry::findPath(const QString& path) const
+{
+  if (path.isEmpty()) {
+    return nullptr;
+  }
+
+  return probe(PathIndex, hashPath(path), [&path](const Record & r) {
+    return r.path == path;
+  });
+}
+
+/*
+   Finds the device opened with the supplied vendor id, product id and serial number.
+   An empty serialNumber finds a device which was opened without one.
+*/
+const QHidDeviceRegistry::Record* QHidDeviceRegistry::findProduct(ushort vendorId,
+    ushort productId,
+    const QString& serialNumber) const
+{
+  return probe(ProductIndex, hashProduct(vendorId, productId, serialNumber),
+  [vendorId, productId, &serialNumber](const Record & r) {
+    return r.vendorId == vendorId && r.productId == productId && r.serialNumber == serialNumber;
+  });
+}
+
+QList<quint32> QHidDeviceRegistry::ids() const
+{
+  QList<quint32> result;
+
+  for (int i = 0; i < mRecords.size(); i++) {
+    if (mRecords.at(i).id != 0) {
+      result.append(mRecords.at(i).id);
+    }
+  }
+
+  return result;
+}
+
+int QHidDeviceRegistry::size() const
+{
+  return mCount;
+}
+
+/*
+   Mixes the bits of an integer key, pointers are too regular to use as they are
+   with a power of two table.
+*/
+static inline uint mix(quint64 value)
+{
+  value ^= value >> 33;
+  value *= Q_UINT64_C(0xff51afd7ed558ccd);
+  value ^= value >> 33;
+  return uint(value);
+}
+
+uint QHidDeviceRegistry::hashDevice(hid_device* device)
+{
+  return mix(quint64(quintptr(device)));
+}
+
+uint QHidDeviceRegistry::hashPath(const QString& path)
+{
+  return qHash(path);
+}
+
+uint QHidDeviceRegistry::hashProduct(ushort vendorId, ushort productId, const QString& serialNumber)
+{
+  return qHash(serialNumber, mix((quint32(vendorId) << 16) | productId));
+}
+
+uint QHidDeviceRegistry::hashRecord(int index, const Record& record) const
+{
+  switch (index) {
+  case DeviceIndex:
+    return hashDevice(record.device);
+
+  case PathIndex:
+    return hashPath(record.path);
+
+  default:
+    return hashProduct(record.vendorId, record.productId, record.serialNumber);
+  }
+}
+
+/*
+   Whether the record has a key in the index. Devices opened by vendor and product
+   id have no path.
+*/
+bool QHidDeviceRegistry::indexed(int index, const Record& record) const
+{
+  return index != PathIndex || !record.path.isEmpty();
+}
+
+template<typename Match>
+const QHidDeviceRegistry::Record* QHidDeviceRegistry::probe(int index, uint hash, Match match) const
+{
+  const QVector<int>& table = mIndexes[index];
+  int mask = table.size() - 1;
+
+  for (int i = int(hash) & mask;; i = (i + 1) & mask) {
+    int slot = table.at(i);
+
+    if (slot == EmptySlot) {
+      return nullptr;
+    }
+
+    if (slot >= 0 && match(mRecords.at(slot))) {
+      return &mRecords.at(slot);
+    }
+  }
+}
+
+void QHidDeviceRegistry::addToIndex(int index, int record)
+{
+  QVector<int>& table = mIndexes[index];
+  int mask = table.size() - 1;
+  int i = int(hashRecord(index, mRecords.at(record))) & mask;
+
+  while (table.at(i) >= 0) {
+    i = (i + 1) & mask;
+  }
+
+  if (table.at(i) == EmptySlot) {
+    mUsedSlots[index]++;
+  }
+
+  table[i] = record;
+}
+
+void QHidDeviceRegistry::removeFromIndex(int index, int record)
+{
+  QVector<int>& table = mIndexes[index];
+  int mask = table.size() - 1;
+
+  // the slot stays used so that probes for keys further along still find them.
+  for (int i = int(hashRecord(index, mRecords.at(record))) & mask;; i = (i + 1) & mask) {
+    if (table.at(i) == record) {
+      table[i] = DeletedSlot;
+      return;
+    }
+
+    if (table.at(i) == EmptySlot) {
+      return;
+    }
+  }
+}
+
+/*
+   Rebuilds every index at the supplied capacity, dropping the deleted slots.
+*/
+void QHidDeviceRegistry::rehash(int capacity)
+{
+  for (int i = 0; i < IndexCount; i++) {
+    mIndexes[i].fill(EmptySlot, capacity);
+    mUsedSlots[i] = 0;
+  }
+
+  for (int r = 0; r < mRecords.size(); r++) {
+    if (mRecords.at(r).id == 0) {
+      continue;
+    }
+
+    for (int i = 0; i < IndexCount; i++) {
+      if (indexed(i, mRecords.at(r))) {
+        addToIndex(i, r);
+      }
+    }
+  }
+}
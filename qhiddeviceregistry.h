@@ -0,0 +1,111 @@
+/*
+  Copyright 2020 Simon Meaden
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+  of the Software, and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  @author: Simon Meaden
+
+*/
+#ifndef QHIDDEVICEREGISTRY_H
+#define QHIDDEVICEREGISTRY_H
+
+#include <QString>
+#include <QVector>
+#include <QList>
+
+#include "hidapi.h"
+
+/*
+   The open devices of a QHidApiPrivate.
+
+   Each open device has one record, held in a flat vector. The device id is the
+   record's slot in the vector in the low 16 bits and the slot's generation in the
+   high 16 bits. The generation changes each time the slot is freed, so finding a
+   device by id is a bounds check and an array load, and the id of a closed device
+   never finds the device which reuses its slot. Generations start at 1, so no id
+   is ever 0, and a slot whose 65535 generations are used up is retired rather
+   than wrapped, so no id is ever handed out twice.
+
+   The records are also found through open addressing hash indexes on the device
+   handle, the path and the vendor id/product id/serial number, so every other
+   lookup is a hash and a short linear probe with no allocation. The records
+   returned by the find methods are only valid until the next insert() or remove().
+*/
+class QHidDeviceRegistry
+{
+public:
+  struct Record {
+    quint32 id;
+    hid_device* device;
+    ushort vendorId;
+    ushort productId;
+    QString serialNumber;
+    QString path;
+  };
+
+  QHidDeviceRegistry();
+
+  quint32 insert(const Record& record);
+  bool remove(quint32 id);
+  void clear();
+
+  const Record* findId(quint32 id) const;
+  const Record* findDevice(hid_device* device) const;
+  const Record* findPath(const QString& path) const;
+  const Record* findProduct(ushort vendorId, ushort productId, const QString& serialNumber) const;
+
+  QList<quint32> ids() const;
+  int size() const;
+
+private:
+  enum Index {
+    DeviceIndex,
+    PathIndex,
+    ProductIndex,
+    IndexCount,
+  };
+
+  // values of an index slot that don't refer to a record.
+  enum {
+    EmptySlot = -1,
+    DeletedSlot = -2,
+  };
+
+  static uint hashDevice(hid_device* device);
+  static uint hashPath(const QString& path);
+  static uint hashProduct(ushort vendorId, ushort productId, const QString& serialNumber);
+  uint hashRecord(int index, const Record& record) const;
+  bool indexed(int index, const Record& record) const;
+
+  template<typename Match>
+  const Record* probe(int index, uint hash, Match match) const;
+  void addToIndex(int index, int record);
+  void removeFromIndex(int index, int record);
+  void rehash(int capacity);
+  bool nextGeneration(int slot);
+
+  QVector<Record> mRecords; // records of closed devices have an id of 0.
+  QVector<quint16> mGenerations; // 0 for retired slots.
+  QVector<int> mFreeRecords;
+  QVector<int> mIndexes[IndexCount];
+  int mCount;
+  int mUsedSlots[IndexCount]; // live and deleted slots in each index.
+};
+
+#endif // QHIDDEVICEREGISTRY_H
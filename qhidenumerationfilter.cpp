@@ -0,0 +1,226 @@
+/*
+  Copyright 2020 Simon Meaden
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+  of the Software, and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  @author: Simon Meaden
+
+*/
+#include "qhidenumerationfilter.h"
+
+/*!
+   \class QHidEnumerationFilter
+   \brief Selects the devices returned by QHidApi::enumerate().
+
+   A default filter matches every device. Each setter adds a condition which a device
+   must also meet. The conditions are passed down to hidapi, which checks each one as
+   soon as it is known, so devices which don't match are passed over before their
+   strings are read.
+   \code
+       QHidEnumerationFilter filter;
+       filter.setUsagePage(0xff00);
+       filter.setBusType(QHidDeviceInfo::UsbBus);
+       QList<QHidDeviceInfo> devices = api->enumerate(filter);
+   \endcode
+
+   Not every platform can report every field. The libusb backend can't read the usage
+   page and usage, and the bus type is QHidDeviceInfo::UnknownBus wherever the platform
+   can't tell, so no device matches those conditions there.
+*/
+
+/*!
+   \brief Constructs a filter matching vendorId and productId, 0 matching any id.
+*/
+QHidEnumerationFilter::QHidEnumerationFilter(ushort vendorId, ushort productId) :
+  mVendorId(vendorId),
+  mProductId(productId),
+  mCriteria(0),
+  mUsagePage(0),
+  mUsage(0),
+  mInterfaceNumber(-1),
+  mBusType(QHidDeviceInfo::UnknownBus)
+{
+}
+
+/*!
+   \brief The vendor id to match, or 0 for any vendor.
+*/
+ushort QHidEnumerationFilter::vendorId() const
+{
+  return mVendorId;
+}
+
+/*!
+   \brief Sets the vendor id to match, 0 matches any vendor.
+*/
+void QHidEnumerationFilter::setVendorId(ushort vendorId)
+{
+  mVendorId = vendorId;
+}
+
+/*!
+   \brief The product id to match, or 0 for any product.
+*/
+ushort QHidEnumerationFilter::productId() const
+{
+  return mProductId;
+}
+
+/*!
+   \brief Sets the product id to match, 0 matches any product.
+*/
+void QHidEnumerationFilter::setProductId(ushort productId)
+{
+  mProductId = productId;
+}
+
+/*!
+   \brief Whether the usage page of the top level collection is matched.
+*/
+bool QHidEnumerationFilter::hasUsagePage() const
+{
+  return mCriteria & UsagePageCriterion;
+}
+
+/*!
+   \brief The usage page to match, if hasUsagePage() is true.
+*/
+ushort QHidEnumerationFilter::usagePage() const
+{
+  return mUsagePage;
+}
+
+/*!
+   \brief Only match devices whose top level collection has usagePage.
+*/
+void QHidEnumerationFilter::setUsagePage(ushort usagePage)
+{
+  mUsagePage = usagePage;
+  mCriteria |= UsagePageCriterion;
+}
+
+/*!
+   \brief Whether the usage of the top level collection is matched.
+*/
+bool QHidEnumerationFilter::hasUsage() const
+{
+  return mCriteria & UsageCriterion;
+}
+
+/*!
+   \brief The usage to match, if hasUsage() is true.
+*/
+ushort QHidEnumerationFilter::usage() const
+{
+  return mUsage;
+}
+
+/*!
+   \brief Only match devices whose top level collection has usage.
+*/
+void QHidEnumerationFilter::setUsage(ushort usage)
+{
+  mUsage = usage;
+  mCriteria |= UsageCriterion;
+}
+
+/*!
+   \brief Whether the USB interface number is matched.
+*/
+bool QHidEnumerationFilter::hasInterfaceNumber() const
+{
+  return mCriteria & InterfaceCriterion;
+}
+
+/*!
+   \brief The interface number to match, if hasInterfaceNumber() is true.
+*/
+int QHidEnumerationFilter::interfaceNumber() const
+{
+  return mInterfaceNumber;
+}
+
+/*!
+   \brief Only match devices on USB interface interfaceNumber.
+*/
+void QHidEnumerationFilter::setInterfaceNumber(int interfaceNumber)
+{
+  mInterfaceNumber = interfaceNumber;
+  mCriteria |= InterfaceCriterion;
+}
+
+/*!
+   \brief Whether the bus type is matched.
+*/
+bool QHidEnumerationFilter::hasBusType() const
+{
+  return mCriteria & BusTypeCriterion;
+}
+
+/*!
+   \brief The bus type to match, if hasBusType() is true.
+*/
+QHidDeviceInfo::BusType QHidEnumerationFilter::busType() const
+{
+  return mBusType;
+}
+
+/*!
+   \brief Only match devices connected by busType.
+*/
+void QHidEnumerationFilter::setBusType(QHidDeviceInfo::BusType busType)
+{
+  mBusType = busType;
+  mCriteria |= BusTypeCriterion;
+}
+
+/*!
+   \brief Whether the start of the serial number is matched.
+*/
+bool QHidEnumerationFilter::hasSerialPrefix() const
+{
+  return mCriteria & SerialPrefixCriterion;
+}
+
+/*!
+   \brief The serial number prefix to match, if hasSerialPrefix() is true.
+*/
+QString QHidEnumerationFilter::serialPrefix() const
+{
+  return mSerialPrefix;
+}
+
+/*!
+   \brief Only match devices whose serial number starts with serialPrefix.
+
+   The serial number is then read during enumeration even with QHidApi::LazyStrings.
+*/
+void QHidEnumerationFilter::setSerialPrefix(const QString& serialPrefix)
+{
+  mSerialPrefix = serialPrefix;
+  mCriteria |= SerialPrefixCriterion;
+}
+
+/*!
+   \brief Removes every condition apart from the vendor and product ids.
+*/
+void QHidEnumerationFilter::clear()
+{
+  mCriteria = 0;
+}
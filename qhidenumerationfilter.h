@@ -0,0 +1,78 @@
+/*
+  Copyright 2020 Simon Meaden
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+  of the Software, and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  @author: Simon Meaden
+
+*/
+#ifndef QHIDENUMERATIONFILTER_H
+#define QHIDENUMERATIONFILTER_H
+
+#include <QString>
+
+#include "qhidapi_global.h"
+#include "qhiddeviceinfo.h"
+
+class QHIDAPISHARED_EXPORT QHidEnumerationFilter
+{
+public:
+  explicit QHidEnumerationFilter(ushort vendorId = 0x0, ushort productId = 0x0);
+
+  ushort vendorId() const;
+  void setVendorId(ushort vendorId);
+  ushort productId() const;
+  void setProductId(ushort productId);
+
+  bool hasUsagePage() const;
+  ushort usagePage() const;
+  void setUsagePage(ushort usagePage);
+  bool hasUsage() const;
+  ushort usage() const;
+  void setUsage(ushort usage);
+  bool hasInterfaceNumber() const;
+  int interfaceNumber() const;
+  void setInterfaceNumber(int interfaceNumber);
+  bool hasBusType() const;
+  QHidDeviceInfo::BusType busType() const;
+  void setBusType(QHidDeviceInfo::BusType busType);
+  bool hasSerialPrefix() const;
+  QString serialPrefix() const;
+  void setSerialPrefix(const QString& serialPrefix);
+
+  void clear();
+
+private:
+  enum Criterion {
+    UsagePageCriterion = 0x01,
+    UsageCriterion = 0x02,
+    InterfaceCriterion = 0x04,
+    BusTypeCriterion = 0x08,
+    SerialPrefixCriterion = 0x10,
+  };
+
+  ushort mVendorId, mProductId;
+  int mCriteria;
+  ushort mUsagePage, mUsage;
+  int mInterfaceNumber;
+  QHidDeviceInfo::BusType mBusType;
+  QString mSerialPrefix;
+};
+
+#endif // QHIDENUMERATIONFILTER_H
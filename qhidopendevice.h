@@ -0,0 +1,87 @@
+/*
+  Copyright 2020 Simon Meaden
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+  of the Software, and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  @author: Simon Meaden
+
+*/
+#ifndef QHIDOPENDEVICE_H
+#define QHIDOPENDEVICE_H
+
+#include <QAtomicInt>
+#include <QMutex>
+#include <QScopedPointer>
+#include <QString>
+
+#include "qhidreportdescriptor.h"
+#include "qhidreporthandler.h"
+#include "qhidusagemap.h"
+#include "hidapi.h"
+
+/*
+   An open device of a QHidApiPrivate and everything kept for it while it is
+   open.
+
+   Devices are shared through QSharedPointer, so a device closed by one
+   thread while another is using it stays valid until the other is done, and
+   hid_close() is called when the last reference goes.
+
+   Reads take readMutex and every other call on the device takes mutex, so a
+   thread blocked in read() doesn't hold up writes to the same device, and
+   calls on different devices never share a lock. mutex also guards the
+   cached strings, descriptor and usage map.
+*/
+struct QHidOpenDevice {
+  QHidOpenDevice(hid_device* device, ushort vendorId, ushort productId, const QString& path);
+  ~QHidOpenDevice();
+
+  hid_device* const device;
+  const ushort vendorId;
+  const ushort productId;
+  const QString path;
+
+  QMutex readMutex;
+  QMutex mutex;
+
+  // filled the first time each is asked for.
+  bool manufacturerFetched;
+  bool productFetched;
+  bool serialNumberFetched;
+  bool descriptorFetched;
+  QString manufacturerString;
+  QString productString;
+  QString serialNumberString;
+  QHidReportDescriptor descriptor;
+  QScopedPointer<QHidUsageMap> usageMap;
+  // set once usageMap is, so read() only takes mutex for a device which has one.
+  QAtomicInt hasUsageMap;
+  // set by close(), so a QHidReaderThread holding the device lets it go.
+  QAtomicInt closed;
+  // set by setReportHandler(), and called from hidapi's input report callback.
+  // handlerMutex orders the setters, not mutex, which the handler may take.
+  QMutex handlerMutex;
+  QHidReportHandler reportHandler;
+  quint32 reportHandlerId;
+
+private:
+  Q_DISABLE_COPY(QHidOpenDevice)
+};
+
+#endif // QHIDOPENDEVICE_H
@@ -0,0 +1,479 @@
+/*
+  Copyright 2020 Simon Meaden
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+  of the Software, and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  @author: Simon Meaden
+
+*/
+#include "qhidreaderthread.h"
+#include "qhidopendevice.h"
+
+#include <QMutexLocker>
+
+#include <chrono>
+#include <cstring>
+
+#if defined(Q_OS_WIN)
+#include <windows.h>
+#elif defined(Q_OS_UNIX)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#endif
+
+/*!
+   \class QHidReaderThread
+   \brief A thread owned by QHidApi which reads the input reports of one device, or a
+   group of devices, into a QHidReportQueue.
+
+   A reader is started with QHidApi::startReader(). Before its first read the thread
+   applies its QHidReaderOptions: it is pinned to the listed CPUs, moved to the
+   SCHED_FIFO scheduling class at the given priority, and the process's pages are locked
+   in memory, so the read loop isn't preempted by normal threads, migrated between CPUs
+   or held up by a page fault. Whatever the platform refuses, usually for want of
+   privileges, is left as it was and reported by setupErrors().
+   \code
+       QHidReaderOptions options;
+       options.cpus << 3;
+       options.priority = 80;
+       options.lockMemory = true;
+
+       QHidReaderThread* reader = api->startReader(id, options);
+       QHidReportQueue* queue = reader->queue();
+
+       // the control loop.
+       while (const QHidReport* report = queue->front()) {
+           update(report->data, report->size);
+           queue->pop();
+       }
+   \endcode
+
+   A reader of one device blocks in hid_read_timeout() for up to
+   QHidReaderOptions::timeout milliseconds at a time. A reader of several devices polls
+   each in turn without blocking, and when a whole pass finds nothing waits on one of
+   them for QHidReaderOptions::pollInterval milliseconds, so a report from another
+   device may wait up to that long.
+
+   Reports go into the reader's queue, which has one consumer, without locks or
+   allocation. The devices stay open while the reader holds them, and a device which is
+   closed, or fails to read, is dropped from the reader. Calls to QHidApi::read() for a
+   device which has a reader take reports from the same stream, so shouldn't be made.
+   Values are still tracked for QHidApi::value().
+
+   For a receiver in an event loop, such as a GUI, QHidReaderOptions::batchSignals has
+   the reader deliver its reports in batches with reportsReady(), emitted on the thread
+   the reader belongs to, that of its QHidApi, rather than one event per report.
+   \code
+       QHidReaderOptions options;
+       options.batchSignals = true;
+       options.maxBatchSize = 64;
+       options.maxBatchLatency = 5;
+
+       QHidReaderThread* reader = api->startReader(ids, options);
+       connect(reader, &QHidReaderThread::reportsReady,
+               this, [this](const QVector<QHidReport>& reports, int backlog) {
+           for (const QHidReport& report : reports) {
+               update(report.deviceId, report.data, report.size);
+           }
+           if (backlog > 0) {
+               // falling behind, do less for each report.
+           }
+       });
+   \endcode
+   A batch is posted once maxBatchSize reports are waiting, or the oldest has waited
+   maxBatchLatency milliseconds. Only one batch is posted at a time and each carries at
+   most maxBatchSize reports, the rest following in the next pass of the event loop, so
+   however fast the devices are the receiver's event queue holds at most one event of
+   the reader. The reports which haven't been delivered wait in the queue, their number
+   given by backlog(), and once it is full further reports are dropped. The queue
+   mustn't be read from while batchSignals is set.
+
+   The reader is stopped with stop() and is stopped and deleted with its QHidApi.
+*/
+
+static inline qint64 steadyNanoseconds()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+           std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*
+   A reader of devices, which have the ids in ids. Only QHidApiPrivate makes them.
+*/
+QHidReaderThread::QHidReaderThread(const QVector<QSharedPointer<QHidOpenDevice>>& devices,
+                                   const QList<quint32>& ids, const QHidReaderOptions& options,
+                                   QObject* parent) :
+  QThread(parent),
+  mDevices(devices),
+  mIds(ids),
+  mReadIds(ids.toVector()),
+  mOptions(options),
+  mQueue(options.queueCapacity),
+  mStop(0),
+  mSetupErrors(NoSetupError),
+  mDeliveryPending(0),
+  mUnposted(0),
+  mBatchStart(0)
+{
+  qRegisterMetaType<QVector<QHidReport>>("QVector<QHidReport>");
+}
+
+/*!
+   \brief Stops the thread, waiting for the read in progress to return.
+*/
+QHidReaderThread::~QHidReaderThread()
+{
+  stop();
+}
+
+/*!
+   \brief The ids of the devices the reader was started with.
+*/
+QList<quint32> QHidReaderThread::deviceIds() const
+{
+  return mIds;
+}
+
+/*!
+   \brief The options the reader was started with.
+*/
+QHidReaderOptions QHidReaderThread::options() const
+{
+  return mOptions;
+}
+
+/*!
+   \brief The queue the reports are delivered to. Only one thread may take reports
+   from it.
+*/
+QHidReportQueue* QHidReaderThread::queue()
+{
+  return &mQueue;
+}
+
+/*!
+   \brief The reports read and not yet taken from the queue, or with
+   QHidReaderOptions::batchSignals not yet delivered by reportsReady().
+
+   A receiver whose backlog grows is falling behind the devices, and once the queue is
+   full reports are dropped, see QHidReportQueue::dropped().
+*/
+int QHidReaderThread::backlog() const
+{
+  return mQueue.size();
+}
+
+/*!
+   \fn void QHidReaderThread::reportsReady(const QVector<QHidReport>& reports, int backlog)
+   \brief Delivers a batch of reports, oldest first, with QHidReaderOptions::batchSignals
+   set. backlog is the number of reports still waiting after these.
+*/
+
+/*!
+   \brief The options which couldn't be applied, once the thread has started.
+*/
+QHidReaderThread::SetupErrors QHidReaderThread::setupErrors() const
+{
+  return SetupErrors(mSetupErrors.loadAcquire());
+}
+
+/*!
+   \brief Stops the thread, which finishes the read in progress first, so this takes
+   up to QHidReaderOptions::timeout milliseconds. The devices are released.
+*/
+void QHidReaderThread::stop()
+{
+  mStop.storeRelease(1);
+
+  if (QThread::currentThread() != this) {
+    wait();
+  }
+}
+
+void QHidReaderThread::run()
+{
+  applyOptions();
+
+  int next = 0;
+
+  while (!mStop.loadAcquire() && !mDevices.isEmpty()) {
+    if (mDevices.size() == 1) {
+      readDevice(0, batchTimeout(mOptions.timeout));
+      postReports();
+      continue;
+    }
+
+    bool idle = true;
+
+    // backwards, as a device that is dropped is removed.
+    for (int i = mDevices.size() - 1; i >= 0; i--) {
+      if (readDevice(i, 0) > 0) {
+        idle = false;
+      }
+    }
+
+    if (idle && !mDevices.isEmpty()) {
+      next = (next + 1) % mDevices.size();
+      readDevice(next, batchTimeout(mOptions.pollInterval));
+    }
+
+    postReports();
+  }
+
+  postReports(true);
+
+  // the last reference to a device closes it, so closed devices are closed here.
+  mDevices.clear();
+}
+
+/*
+   Pins, prioritises and locks the thread as the options ask, from the thread
+   itself, recording what failed.
+*/
+void QHidReaderThread::applyOptions()
+{
+  int errors = NoSetupError;
+
+  if (!mOptions.cpus.isEmpty()) {
+#if defined(Q_OS_LINUX)
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+
+    for (int cpu : mOptions.cpus) {
+      if (cpu >= 0 && cpu < CPU_SETSIZE) {
+        CPU_SET(cpu, &cpus);
+      }
+    }
+
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+      errors |= AffinityFailed;
+    }
+
+#elif defined(Q_OS_WIN)
+    DWORD_PTR mask = 0;
+
+    for (int cpu : mOptions.cpus) {
+      if (cpu >= 0 && cpu < int(sizeof(DWORD_PTR) * 8)) {
+        mask |= DWORD_PTR(1) << cpu;
+      }
+    }
+
+    if (SetThreadAffinityMask(GetCurrentThread(), mask) == 0) {
+      errors |= AffinityFailed;
+    }
+
+#else
+    // macOS only has affinity hints, no way to pin a thread.
+    errors |= AffinityFailed;
+#endif
+  }
+
+  if (mOptions.priority > 0) {
+#if defined(Q_OS_WIN)
+
+    if (!SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL)) {
+      errors |= PriorityFailed;
+    }
+
+#elif defined(Q_OS_UNIX)
+    sched_param param;
+    std::memset(&param, 0, sizeof(param));
+    param.sched_priority = qBound(sched_get_priority_min(SCHED_FIFO), mOptions.priority,
+                                  sched_get_priority_max(SCHED_FIFO));
+
+    if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0) {
+      errors |= PriorityFailed;
+    }
+
+#else
+    errors |= PriorityFailed;
+#endif
+  }
+
+  if (mOptions.lockMemory) {
+#if defined(Q_OS_UNIX)
+
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+      errors |= MemoryLockFailed;
+    }
+
+#else
+    errors |= MemoryLockFailed;
+#endif
+  }
+
+  mSetupErrors.storeRelease(errors);
+}
+
+/*
+   Reads one report from the device at index, waiting up to timeout
+   milliseconds, into the next slot of the queue. Drops the device if it has
+   been closed or the read fails, a cancelled read counting as no report.
+   returns what hid_read_timeout() did.
+*/
+int QHidReaderThread::readDevice(int index, int timeout)
+{
+  QHidOpenDevice* device = mDevices.at(index).data();
+
+  if (device->closed.loadAcquire()) {
+    mDevices.remove(index);
+    mReadIds.remove(index);
+    return -1;
+  }
+
+  // with the queue full the report is still read, so the device's buffer doesn't fill.
+  QHidReport overflow;
+  QHidReport* slot = mQueue.beginPush();
+  QHidReport* report = slot ? slot : &overflow;
+  int rep;
+
+  {
+    QMutexLocker locker(&device->readMutex);
+    rep = hid_read_timeout(device->device, report->data, sizeof(report->data), timeout);
+  }
+
+  if (rep > 0) {
+    report->deviceId = mReadIds.at(index);
+    report->size = rep;
+    report->timestamp = steadyNanoseconds();
+
+    if (device->hasUsageMap.loadAcquire()) {
+      QMutexLocker locker(&device->mutex);
+      device->usageMap->setInputReport(QByteArray(reinterpret_cast<const char*>(report->data), rep));
+    }
+
+    if (slot) {
+      if (mOptions.batchSignals && mUnposted++ == 0) {
+        mBatchStart = report->timestamp;
+      }
+
+      mQueue.push();
+    } else {
+      mQueue.drop();
+    }
+
+  } else if (rep == HID_READ_CANCELLED) {
+    rep = 0;
+
+  } else if (rep < 0) {
+    mDevices.remove(index);
+    mReadIds.remove(index);
+  }
+
+  return rep;
+}
+
+/*
+   timeout, cut short so that a read doesn't hold back reports waiting to be
+   posted for more than QHidReaderOptions::maxBatchLatency. Left alone while
+   a delivery is posted, which takes the reports when it runs.
+*/
+int QHidReaderThread::batchTimeout(int timeout) const
+{
+  if (!mOptions.batchSignals || mUnposted == 0 || mDeliveryPending.loadAcquire()) {
+    return timeout;
+  }
+
+  qint64 remaining = mOptions.maxBatchLatency - (steadyNanoseconds() - mBatchStart) / 1000000;
+
+  if (remaining <= 0) {
+    return 0;
+  }
+
+  return (timeout < 0 || remaining < timeout) ? int(remaining) : timeout;
+}
+
+/*
+   Posts deliverReports() to the reader's own thread, the thread which made
+   it, once maxBatchSize reports are waiting or the first of them has waited
+   maxBatchLatency milliseconds, or at once if force is set. Only one is
+   posted at a time, so a busy receiver has at most one of the reader's
+   events queued, the reports waiting in the reader's queue in the meantime.
+*/
+void QHidReaderThread::postReports(bool force)
+{
+  if (!mOptions.batchSignals || mUnposted == 0) {
+    return;
+  }
+
+  if (!force && mUnposted < mOptions.maxBatchSize
+      && steadyNanoseconds() - mBatchStart < mOptions.maxBatchLatency * 1000000LL) {
+    return;
+  }
+
+  // the delivery already posted takes these too.
+  if (!mDeliveryPending.testAndSetOrdered(0, 1)) {
+    return;
+  }
+
+  mUnposted = 0;
+  QMetaObject::invokeMethod(this, [this]() {
+    deliverReports();
+  }, Qt::QueuedConnection);
+}
+
+/*
+   Takes up to maxBatchSize reports from the queue and emits them with
+   reportsReady(), on the thread the reader belongs to. If more are waiting
+   it posts itself again, so the rest come in the next pass of the event
+   loop and other events are handled in between.
+*/
+void QHidReaderThread::deliverReports()
+{
+  const int maxBatchSize = qMax(1, mOptions.maxBatchSize);
+  QVector<QHidReport> reports;
+  reports.reserve(qMin(mQueue.size(), maxBatchSize));
+
+  while (reports.size() < maxBatchSize) {
+    const QHidReport* report = mQueue.front();
+
+    if (!report) {
+      break;
+    }
+
+    reports.append(*report);
+    mQueue.pop();
+  }
+
+  int waiting = mQueue.size();
+  bool again = waiting > 0;
+
+  if (!again) {
+    /*
+       a report pushed after the queue was drained but before the flag was
+       cleared found the delivery still pending and wasn't posted, so look
+       again once the flag is cleared, ordered so the look can't come first,
+       and post unless the reader has meanwhile.
+    */
+    mDeliveryPending.fetchAndStoreOrdered(0);
+    waiting = mQueue.size();
+    again = waiting > 0 && mDeliveryPending.testAndSetOrdered(0, 1);
+  }
+
+  if (again) {
+    QMetaObject::invokeMethod(this, [this]() {
+      deliverReports();
+    }, Qt::QueuedConnection);
+  }
+
+  if (!reports.isEmpty()) {
+    emit reportsReady(reports, waiting);
+  }
+}
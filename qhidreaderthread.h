@@ -0,0 +1,131 @@
+/*
+  Copyright 2020 Simon Meaden
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+  of the Software, and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  @author: Simon Meaden
+
+*/
+#ifndef QHIDREADERTHREAD_H
+#define QHIDREADERTHREAD_H
+
+#include <QAtomicInt>
+#include <QFlags>
+#include <QList>
+#include <QSharedPointer>
+#include <QThread>
+#include <QVector>
+
+#include "qhidapi_global.h"
+#include "qhidreportqueue.h"
+
+struct QHidOpenDevice;
+class QHidApiPrivate;
+
+/** How a QHidReaderThread runs. */
+struct QHidReaderOptions {
+  QHidReaderOptions() :
+    priority(0),
+    lockMemory(false),
+    queueCapacity(1024),
+    timeout(100),
+    pollInterval(1),
+    batchSignals(false),
+    maxBatchSize(64),
+    maxBatchLatency(5) {}
+
+  /** The CPUs the thread may run on, any CPU if empty. */
+  QList<int> cpus;
+  /** The SCHED_FIFO priority, 1 to 99 on Linux. 0 leaves the thread at normal priority. */
+  int priority;
+  /** Whether to lock all of the process's pages in memory, as mlockall() does. */
+  bool lockMemory;
+  /** Reports the queue holds, rounded up to a power of two. */
+  int queueCapacity;
+  /** The longest a read blocks in milliseconds, which bounds how long stop() takes. */
+  int timeout;
+  /** With several devices, how long an idle thread waits in milliseconds before polling
+      them again. */
+  int pollInterval;
+  /** Whether the reports are delivered by QHidReaderThread::reportsReady() rather than
+      taken from the queue. */
+  bool batchSignals;
+  /** The most reports one reportsReady() carries. */
+  int maxBatchSize;
+  /** The longest a report waits for others to batch with, in milliseconds. */
+  int maxBatchLatency;
+};
+
+class QHIDAPISHARED_EXPORT QHidReaderThread : public QThread
+{
+  Q_OBJECT
+
+public:
+  /** Parts of the options the platform refused, or doesn't support. */
+  enum SetupError {
+    NoSetupError = 0x0,
+    AffinityFailed = 0x1,
+    PriorityFailed = 0x2,
+    MemoryLockFailed = 0x4,
+  };
+  Q_DECLARE_FLAGS(SetupErrors, SetupError)
+
+  ~QHidReaderThread();
+
+  QList<quint32> deviceIds() const;
+  QHidReaderOptions options() const;
+  QHidReportQueue* queue();
+  int backlog() const;
+  SetupErrors setupErrors() const;
+  void stop();
+
+signals:
+  void reportsReady(const QVector<QHidReport>& reports, int backlog);
+
+protected:
+  void run() override;
+
+private:
+  friend class QHidApiPrivate;
+
+  QHidReaderThread(const QVector<QSharedPointer<QHidOpenDevice>>& devices,
+                   const QList<quint32>& ids, const QHidReaderOptions& options,
+                   QObject* parent);
+
+  void applyOptions();
+  int readDevice(int index, int timeout);
+  int batchTimeout(int timeout) const;
+  void postReports(bool force = false);
+  void deliverReports();
+
+  QVector<QSharedPointer<QHidOpenDevice>> mDevices;  // the devices still being read.
+  QList<quint32> mIds;
+  QVector<quint32> mReadIds;   // the ids of mDevices, which only the thread touches.
+  QHidReaderOptions mOptions;
+  QHidReportQueue mQueue;
+  QAtomicInt mStop;
+  QAtomicInt mSetupErrors;
+  QAtomicInt mDeliveryPending;  // set while a deliverReports() is posted and not yet run.
+  int mUnposted;                // reports pushed since the last post, only the thread touches.
+  qint64 mBatchStart;           // the timestamp of the first of them.
+};
+
+Q_DECLARE_OPERATORS_FOR_FLAGS(QHidReaderThread::SetupErrors)
+
+#endif // QHIDREADERTHREAD_H
@@ -0,0 +1,540 @@
+/*
+  Copyright 2020 Simon Meaden
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+  of the Software, and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  @author: Simon Meaden
+
+*/
+#include "qhidreportdecoder.h"
+
+#include <QtEndian>
+
+#include <cmath>
+#include <cstring>
+
+#if defined(__BMI2__) || defined(__AVX2__) || defined(__SSE4_1__)
+#include <immintrin.h>
+#endif
+
+// the widest value an op decodes, a 64 bit load holds any 32 bit value at any bit.
+static const int MAX_VALUE_BITS = 32;
+// the bytes of each load.
+static const int LOAD_SIZE = 8;
+// the bytes of each load of the vector column decoders.
+static const int VECTOR_LOAD_SIZE = 4;
+// reports decoded into every column before moving on, so that they are still in cache.
+static const int COLUMN_BLOCK = 1024;
+
+/*!
+   \class QHidReportDecoder
+   \brief Decodes reports into arrays of values, using plans compiled from a
+   QHidReportDescriptor.
+
+   The descriptor is interpreted once, when the decoder is constructed. Each report id
+   is compiled into a plan, a flat array of ops which each read one value with a 64 bit
+   little endian load, a shift and a mask, and sign extend it with a pair of shifts. There
+   are no branches on the layout while decoding, and where the compiler targets BMI2
+   the shift and mask are a single pext instruction.
+
+   decode() writes the values of a report into an array of at least valueCount()
+   elements, or maxValueCount() for any report, in the order of valueFields(). The values
+   of an Array field are its usage indexes, one for each of its count. Constant fields
+   and fields wider than 32 bits are left out. Values are qint32, as the logical ranges
+   in a descriptor are, so an unsigned 32 bit value above 0x7fffffff wraps.
+   \code
+       QHidReportDecoder decoder(api->reportDescriptor(id));
+       QVector<qint32> values(decoder.maxValueCount());
+       int x = decoder.valueIndex(0, 0x01, 0x30);
+
+       forever {
+           QByteArray report = api->read(id);
+           if (decoder.decode(report, values.data()) > 0)
+               qDebug() << values.at(x);
+       }
+   \endcode
+
+   decode() doesn't allocate. Reports too short for the last load are copied into a
+   buffer owned by the decoder first, so a decoder shouldn't be shared between threads.
+
+   decodeColumns() decodes a run of captured reports with the same report id at once,
+   into one array per value. Each value is decoded for a block of reports at a time, with
+   AVX2 gathers eight reports at a time where the compiler targets AVX2, SSE4.1 four at
+   a time where it targets that, and one at a time otherwise. The float form scales the
+   logical values to physical values in the same pass.
+   \code
+       // reports holds count reports of 65 bytes, as captured from read().
+       QVector<QVector<float>> columns(decoder.valueCount(reportId), QVector<float>(count));
+       QVector<float*> pointers;
+       for (QVector<float>& column : columns)
+           pointers.append(column.data());
+
+       decoder.decodeColumns(reports, count, 65, pointers.data());
+   \endcode
+*/
+
+/*
+   The scale and offset which map the logical range of field onto its physical
+   range, in units of its unit exponent. A field without a physical range has
+   the logical range as its physical range, as in section 6.2.2.7 of the HID
+   specification.
+*/
+static void physicalScale(const QHidReportField& field, float* scale, float* offset)
+{
+  double s = 1.0;
+  double o = 0.0;
+
+  if ((field.physicalMinimum != 0 || field.physicalMaximum != 0)
+      && field.logicalMaximum != field.logicalMinimum) {
+    s = (double(field.physicalMaximum) - field.physicalMinimum)
+        / (double(field.logicalMaximum) - field.logicalMinimum);
+    o = field.physicalMinimum - field.logicalMinimum * s;
+  }
+
+  const double exponent = std::pow(10.0, field.unitExponent);
+  *scale = float(s * exponent);
+  *offset = float(o * exponent);
+}
+
+/*!
+   \brief Constructs an invalid decoder.
+*/
+QHidReportDecoder::QHidReportDecoder() :
+  mPlanIndex(256, -1),
+  mUsesReportIds(false),
+  mMaxValueCount(0)
+{
+}
+
+/*!
+   \brief Compiles a plan for every report of type in descriptor.
+*/
+QHidReportDecoder::QHidReportDecoder(const QHidReportDescriptor& descriptor,
+                                     QHidReportField::ReportType type) :
+  mPlanIndex(256, -1),
+  mUsesReportIds(false),
+  mMaxValueCount(0)
+{
+  compile(descriptor, type);
+}
+
+void QHidReportDecoder::compile(const QHidReportDescriptor& descriptor,
+                                QHidReportField::ReportType type)
+{
+  if (!descriptor.isValid()) {
+    return;
+  }
+
+  mUsesReportIds = descriptor.usesReportIds();
+  const int idBytes = mUsesReportIds ? 1 : 0;
+  int scratchSize = 0;
+
+  for (const QHidReportDescriptor::Report& report : descriptor.reports()) {
+    if (report.type != type) {
+      continue;
+    }
+
+    Plan plan;
+    plan.reportId = report.reportId;
+    plan.firstOp = mOps.size();
+    plan.reportSize = idBytes + int((report.bitSize + 7) / 8);
+    plan.loadEnd = plan.reportSize;
+
+    for (int f = report.firstField; f < report.firstField + report.fieldCount; f++) {
+      const QHidReportField& field = descriptor.fields().at(f);
+
+      if ((field.flags & QHidReportField::Constant) || field.bitSize == 0
+          || field.bitSize > MAX_VALUE_BITS) {
+        continue;
+      }
+
+      for (int v = 0; v < field.count; v++) {
+        quint32 bit = field.bitOffset + quint32(v) * field.bitSize;
+        const quint64 valueMask = (Q_UINT64_C(1) << field.bitSize) - 1;
+
+        Op op;
+        op.byteOffset = quint32(idBytes) + bit / 8;
+        op.shift = quint8(bit % 8);
+        op.signShift = field.isSigned() ? quint8(64 - field.bitSize) : 0;
+        op.bitSize = quint8(field.bitSize);
+        physicalScale(field, &op.scale, &op.offset);
+#if defined(__BMI2__)
+        op.mask = valueMask << op.shift;
+#else
+        op.mask = valueMask;
+#endif
+        mOps.append(op);
+        mValueFields.append(field);
+
+        plan.loadEnd = qMax(plan.loadEnd, int(op.byteOffset) + LOAD_SIZE);
+      }
+    }
+
+    plan.opCount = mOps.size() - plan.firstOp;
+    mMaxValueCount = qMax(mMaxValueCount, plan.opCount);
+    scratchSize = qMax(scratchSize, plan.loadEnd);
+
+    mPlanIndex[plan.reportId] = qint16(mPlans.size());
+    mPlans.append(plan);
+  }
+
+  // zeroed, so the bytes past a short report read as 0.
+  mScratch.fill(0, scratchSize);
+}
+
+/*!
+   \brief Whether the decoder has a plan for at least one report.
+*/
+bool QHidReportDecoder::isValid() const
+{
+  return !mPlans.isEmpty();
+}
+
+/*!
+   \brief The most values any one report decodes to, the size the values array
+   passed to decode() needs to be for any report.
+*/
+int QHidReportDecoder::maxValueCount() const
+{
+  return mMaxValueCount;
+}
+
+/*!
+   \brief The number of values the report with reportId decodes to, or 0 if there is
+   no such report.
+*/
+int QHidReportDecoder::valueCount(quint8 reportId) const
+{
+  const Plan* p = plan(reportId);
+  return p != nullptr ? p->opCount : 0;
+}
+
+/*!
+   \brief The index in the values decoded from the report with reportId of the
+   Variable field with usagePage and usage, or -1 if there is none.
+*/
+int QHidReportDecoder::valueIndex(quint8 reportId, ushort usagePage, ushort usage) const
+{
+  const Plan* p = plan(reportId);
+
+  if (p == nullptr) {
+    return -1;
+  }
+
+  for (int i = 0; i < p->opCount; i++) {
+    const QHidReportField& field = mValueFields.at(p->firstOp + i);
+
+    if ((field.flags & QHidReportField::Variable) && field.usagePage == usagePage
+        && field.usage == usage) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+/*!
+   \brief The plan of the report with reportId, or nullptr if there is none.
+*/
+const QHidReportDecoder::Plan* QHidReportDecoder::plan(quint8 reportId) const
+{
+  int index = mPlanIndex.at(reportId);
+  return index >= 0 ? &mPlans.at(index) : nullptr;
+}
+
+/*!
+   \brief The ops of every plan.
+*/
+const QVector<QHidReportDecoder::Op>& QHidReportDecoder::ops() const
+{
+  return mOps;
+}
+
+/*!
+   \brief The field each op decodes, in the same order as ops().
+*/
+const QVector<QHidReportField>& QHidReportDecoder::valueFields() const
+{
+  return mValueFields;
+}
+
+/*!
+   \brief Decodes a report as returned by QHidApi::read().
+
+   \return the number of values written to values, or -1 if the report has an unknown
+   report id or is shorter than its layout.
+*/
+int QHidReportDecoder::decode(const QByteArray& report, qint32* values)
+{
+  return decode(reinterpret_cast<const uchar*>(report.constData()), report.size(), values);
+}
+
+/*!
+   \brief Decodes size bytes of report, starting with the report id if the device
+   numbers its reports.
+
+   \return the number of values written to values, or -1 if the report has an unknown
+   report id or is shorter than its layout.
+*/
+int QHidReportDecoder::decode(const uchar* report, int size, qint32* values)
+{
+  if (size <= 0) {
+    return -1;
+  }
+
+  int index = mPlanIndex.at(mUsesReportIds ? report[0] : 0);
+
+  if (index < 0) {
+    return -1;
+  }
+
+  const Plan& p = mPlans.at(index);
+
+  if (size < p.reportSize) {
+    return -1;
+  }
+
+  const uchar* data = report;
+
+  if (size < p.loadEnd) {
+    // the loads would run past the end, so they are made from a padded copy.
+    std::memcpy(mScratch.data(), report, size_t(p.reportSize));
+    data = mScratch.constData();
+  }
+
+  const Op* op = mOps.constData() + p.firstOp;
+
+  for (int i = 0; i < p.opCount; i++, op++) {
+    quint64 word = qFromLittleEndian<quint64>(data + op->byteOffset);
+#if defined(__BMI2__)
+    quint64 raw = _pext_u64(word, op->mask);
+#else
+    quint64 raw = (word >> op->shift) & op->mask;
+#endif
+    values[i] = qint32(qint64(raw << op->signShift) >> op->signShift);
+  }
+
+  return p.opCount;
+}
+
+namespace {
+
+inline qint32 extract(quint64 word, const QHidReportDecoder::Op& op)
+{
+#if defined(__BMI2__)
+  quint64 raw = _pext_u64(word, op.mask);
+#else
+  quint64 raw = (word >> op.shift) & op.mask;
+#endif
+  return qint32(qint64(raw << op.signShift) >> op.signShift);
+}
+
+// a 64 bit load which doesn't read past end.
+inline quint64 loadBounded(const uchar* p, const uchar* end)
+{
+  if (end - p >= LOAD_SIZE) {
+    return qFromLittleEndian<quint64>(p);
+  }
+
+  uchar buffer[LOAD_SIZE] = {0};
+  std::memcpy(buffer, p, size_t(end - p));
+  return qFromLittleEndian<quint64>(buffer);
+}
+
+inline void store(qint32* column, qint32 value, const QHidReportDecoder::Op&)
+{
+  *column = value;
+}
+
+inline void store(float* column, qint32 value, const QHidReportDecoder::Op& op)
+{
+  *column = float(value) * op.scale + op.offset;
+}
+
+#if defined(__AVX2__)
+
+inline void store(qint32* column, __m256i values, const QHidReportDecoder::Op&)
+{
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(column), values);
+}
+
+inline void store(float* column, __m256i values, const QHidReportDecoder::Op& op)
+{
+  __m256 physical = _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(values), _mm256_set1_ps(op.scale)),
+                                  _mm256_set1_ps(op.offset));
+  _mm256_storeu_ps(column, physical);
+}
+
+#elif defined(__SSE4_1__)
+
+inline void store(qint32* column, __m128i values, const QHidReportDecoder::Op&)
+{
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(column), values);
+}
+
+inline void store(float* column, __m128i values, const QHidReportDecoder::Op& op)
+{
+  __m128 physical = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(values), _mm_set1_ps(op.scale)),
+                               _mm_set1_ps(op.offset));
+  _mm_storeu_ps(column, physical);
+}
+
+inline qint32 load32(const uchar* p)
+{
+  qint32 word;
+  std::memcpy(&word, p, sizeof(word));
+  return word;
+}
+
+#endif
+
+/*
+   Decodes the value of op from the first of count reports, stride bytes
+   apart, with vector loads of 32 bits, so long as the value lies within them
+   and the loads stay before end. Returns the number of reports decoded, a
+   multiple of the vector width, which the caller finishes one at a time.
+*/
+template<typename T>
+inline int decodeVector(const QHidReportDecoder::Op& op, const uchar* reports, int count,
+                        int stride, const uchar* end, T* column)
+{
+#if defined(__AVX2__) || defined(__SSE4_1__)
+
+  if (op.shift + op.bitSize > VECTOR_LOAD_SIZE * 8) {
+    return 0;
+  }
+
+  // the reports whose load of the value ends before end.
+  const qint64 available = qint64(end - reports) - op.byteOffset - VECTOR_LOAD_SIZE;
+  const int vectorCount = available < 0 ? 0 : int(qMin<qint64>(count, available / stride + 1));
+
+  const int valueMask = int((Q_UINT64_C(1) << op.bitSize) - 1);
+  const int signShift = op.signShift != 0 ? 32 - op.bitSize : 0;
+  const __m128i shift = _mm_cvtsi32_si128(op.shift);
+  const __m128i sign = _mm_cvtsi32_si128(signShift);
+  const uchar* base = reports + op.byteOffset;
+  int i = 0;
+
+#if defined(__AVX2__)
+  const __m256i mask = _mm256_set1_epi32(valueMask);
+  const __m256i index = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+                        _mm256_set1_epi32(stride));
+
+  for (; i + 8 <= vectorCount; i += 8) {
+    __m256i v = _mm256_i32gather_epi32(reinterpret_cast<const int*>(base + qint64(i) * stride),
+                                       index, 1);
+    v = _mm256_and_si256(_mm256_srl_epi32(v, shift), mask);
+    v = _mm256_sra_epi32(_mm256_sll_epi32(v, sign), sign);
+    store(column + i, v, op);
+  }
+
+#else
+  const __m128i mask = _mm_set1_epi32(valueMask);
+
+  for (; i + 4 <= vectorCount; i += 4) {
+    const uchar* p = base + qint64(i) * stride;
+    __m128i v = _mm_cvtsi32_si128(load32(p));
+    v = _mm_insert_epi32(v, load32(p + stride), 1);
+    v = _mm_insert_epi32(v, load32(p + 2 * stride), 2);
+    v = _mm_insert_epi32(v, load32(p + 3 * stride), 3);
+    v = _mm_and_si128(_mm_srl_epi32(v, shift), mask);
+    v = _mm_sra_epi32(_mm_sll_epi32(v, sign), sign);
+    store(column + i, v, op);
+  }
+
+#endif
+
+  return i;
+
+#else
+  Q_UNUSED(op)
+  Q_UNUSED(reports)
+  Q_UNUSED(count)
+  Q_UNUSED(stride)
+  Q_UNUSED(end)
+  Q_UNUSED(column)
+  return 0;
+#endif
+}
+
+}
+
+/*!
+   \brief Decodes count reports with the same report id, laid out stride bytes apart
+   from reports, into an array per value.
+
+   Each report starts with the report id if the device numbers its reports, and the
+   report id of the first is the report id of all of them. columns holds valueCount()
+   arrays of at least count values, in the order of the report's values in valueFields().
+   reports must hold (count - 1) * stride bytes and a complete report after them.
+
+   \return count, or -1 if the first report has an unknown report id or stride is
+   shorter than the report.
+*/
+int QHidReportDecoder::decodeColumns(const uchar* reports, int count, int stride,
+                                     qint32* const* columns) const
+{
+  return decodeColumns<qint32>(reports, count, stride, columns);
+}
+
+/*!
+   \brief Decodes count reports as decodeColumns() does, and scales each value from its
+   logical range to its physical range, times ten to the power of its unit exponent.
+   A value without a physical range is left as it is.
+*/
+int QHidReportDecoder::decodeColumns(const uchar* reports, int count, int stride,
+                                     float* const* columns) const
+{
+  return decodeColumns<float>(reports, count, stride, columns);
+}
+
+template<typename T>
+int QHidReportDecoder::decodeColumns(const uchar* reports, int count, int stride,
+                                     T* const* columns) const
+{
+  if (count <= 0) {
+    return 0;
+  }
+
+  const Plan* p = plan(mUsesReportIds ? reports[0] : 0);
+
+  if (p == nullptr || stride < p->reportSize) {
+    return -1;
+  }
+
+  const uchar* end = reports + qint64(count - 1) * stride + p->reportSize;
+
+  for (int first = 0; first < count; first += COLUMN_BLOCK) {
+    const int n = qMin(COLUMN_BLOCK, count - first);
+    const uchar* block = reports + qint64(first) * stride;
+
+    for (int i = 0; i < p->opCount; i++) {
+      const Op& op = mOps.at(p->firstOp + i);
+      T* column = columns[i] + first;
+
+      int r = decodeVector(op, block, n, stride, end, column);
+
+      for (const uchar* report = block + qint64(r) * stride; r < n; r++, report += stride) {
+        store(column + r, extract(loadBounded(report + op.byteOffset, end), op), op);
+      }
+    }
+  }
+
+  return count;
+}
@@ -0,0 +1,89 @@
+/*
+  Copyright 2020 Simon Meaden
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+  of the Software, and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  @author: Simon Meaden
+
+*/
+#ifndef QHIDREPORTDECODER_H
+#define QHIDREPORTDECODER_H
+
+#include <QByteArray>
+#include <QVector>
+
+#include "qhidapi_global.h"
+#include "qhidreportdescriptor.h"
+
+class QHIDAPISHARED_EXPORT QHidReportDecoder
+{
+public:
+  /** One value of a report, read with a 64 bit load from byteOffset. */
+  struct Op {
+    quint32 byteOffset;
+    quint8 shift;      // the value's lowest bit within the load.
+    quint8 signShift;  // 64 - bit size for signed values, otherwise 0.
+    quint8 bitSize;
+    quint64 mask;      // with BMI2 the value's bits in place for pext, otherwise the value's size.
+    float scale;       // physical value = logical value * scale + offset.
+    float offset;
+  };
+
+  /** The ops decoding the report with reportId, opCount ops from firstOp. */
+  struct Plan {
+    quint8 reportId;
+    int firstOp;
+    int opCount;
+    int reportSize;  // bytes in a complete report, including any report id byte.
+    int loadEnd;     // bytes the loads reach, at least reportSize.
+  };
+
+  QHidReportDecoder();
+  explicit QHidReportDecoder(const QHidReportDescriptor& descriptor,
+                             QHidReportField::ReportType type = QHidReportField::InputReport);
+
+  bool isValid() const;
+  int maxValueCount() const;
+  int valueCount(quint8 reportId = 0) const;
+  int valueIndex(quint8 reportId, ushort usagePage, ushort usage) const;
+  const Plan* plan(quint8 reportId = 0) const;
+  const QVector<Op>& ops() const;
+  const QVector<QHidReportField>& valueFields() const;
+
+  int decode(const QByteArray& report, qint32* values);
+  int decode(const uchar* report, int size, qint32* values);
+
+  int decodeColumns(const uchar* reports, int count, int stride, qint32* const* columns) const;
+  int decodeColumns(const uchar* reports, int count, int stride, float* const* columns) const;
+
+private:
+  void compile(const QHidReportDescriptor& descriptor, QHidReportField::ReportType type);
+  template<typename T>
+  int decodeColumns(const uchar* reports, int count, int stride, T* const* columns) const;
+
+  QVector<Op> mOps;
+  QVector<Plan> mPlans;
+  QVector<QHidReportField> mValueFields; // the field of each op, for lookups.
+  QVector<qint16> mPlanIndex;            // report id -> plan, or -1.
+  QVector<uchar> mScratch;               // a padded copy of reports too short to load from in place.
+  bool mUsesReportIds;
+  int mMaxValueCount;
+};
+
+#endif // QHIDREPORTDECODER_H
@@ -0,0 +1,565 @@
+/*
+  Copyright 2020 Simon Meaden
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+  of the Software, and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  @author: Simon Meaden
+
+*/
+#include "qhidreportdescriptor.h"
+
+#include <algorithm>
+
+// item tags, the top six bits of a short item's prefix byte.
+enum ItemTag {
+  // main items
+  InputTag = 0x80,
+  OutputTag = 0x90,
+  CollectionTag = 0xa0,
+  FeatureTag = 0xb0,
+  EndCollectionTag = 0xc0,
+  // global items
+  UsagePageTag = 0x04,
+  LogicalMinimumTag = 0x14,
+  LogicalMaximumTag = 0x24,
+  PhysicalMinimumTag = 0x34,
+  PhysicalMaximumTag = 0x44,
+  UnitExponentTag = 0x54,
+  UnitTag = 0x64,
+  ReportSizeTag = 0x74,
+  ReportIdTag = 0x84,
+  ReportCountTag = 0x94,
+  PushTag = 0xa4,
+  PopTag = 0xb4,
+  // local items
+  UsageTag = 0x08,
+  UsageMinimumTag = 0x18,
+  UsageMaximumTag = 0x28,
+};
+
+// the deepest Push that is allowed.
+static const int MAX_GLOBAL_STACK = 16;
+
+namespace {
+
+// the global item state, which Push and Pop save and restore.
+struct GlobalState {
+  ushort usagePage = 0;
+  qint32 logicalMinimum = 0;
+  quint32 logicalMaximum = 0; // kept unsigned, see signedLogicalMaximum().
+  int logicalMaximumSize = 0;
+  qint32 physicalMinimum = 0;
+  qint32 physicalMaximum = 0;
+  qint8 unitExponent = 0;
+  quint32 unit = 0;
+  quint16 reportSize = 0;
+  quint8 reportId = 0;
+  quint16 reportCount = 0;
+
+  /*
+     The maximum is signed if the minimum is negative, otherwise a maximum
+     of 0xff in one byte means 255 and not -1.
+  */
+  qint32 signedLogicalMaximum() const
+  {
+    if (logicalMinimum >= 0 || logicalMaximumSize == 4) {
+      return qint32(logicalMaximum);
+    }
+
+    int shift = 32 - logicalMaximumSize * 8;
+    return qint32(logicalMaximum << shift) >> shift;
+  }
+};
+
+// a usage with its page, the high 16 bits of a four byte usage item.
+struct LocalUsage {
+  ushort page;
+  ushort usage;
+};
+
+// the local item state, cleared after every main item.
+struct LocalState {
+  QVector<LocalUsage> usages;
+  bool hasMinimum = false, hasMaximum = false;
+  LocalUsage minimum = {0, 0}, maximum = {0, 0};
+
+  void clear()
+  {
+    usages.clear();
+    hasMinimum = hasMaximum = false;
+  }
+};
+
+}
+
+static quint32 itemData(const uchar* data, int size)
+{
+  quint32 value = 0;
+
+  for (int i = size - 1; i >= 0; i--) {
+    value = (value << 8) | data[i];
+  }
+
+  return value;
+}
+
+static qint32 signedItemData(const uchar* data, int size)
+{
+  quint32 value = itemData(data, size);
+
+  if (size == 0 || size == 4) {
+    return qint32(value);
+  }
+
+  int shift = 32 - size * 8;
+  return qint32(value << shift) >> shift;
+}
+
+static LocalUsage localUsage(quint32 value, int size, ushort usagePage)
+{
+  // a four byte usage carries its own usage page.
+  if (size == 4) {
+    return LocalUsage{ushort(value >> 16), ushort(value)};
+  }
+
+  return LocalUsage{usagePage, ushort(value)};
+}
+
+QHidReportField::QHidReportField() :
+  type(InputReport),
+  reportId(0),
+  flags(0),
+  usagePage(0),
+  usage(0),
+  usageMaximum(0),
+  bitOffset(0),
+  bitSize(0),
+  count(0),
+  logicalMinimum(0),
+  logicalMaximum(0),
+  physicalMinimum(0),
+  physicalMaximum(0),
+  unit(0),
+  unitExponent(0)
+{
+}
+
+bool QHidReportField::isSigned() const
+{
+  return logicalMinimum < 0;
+}
+
+/*!
+   \class QHidReportDescriptor
+   \brief The fields of a device's reports, parsed from its HID report descriptor.
+
+   parse() turns the descriptor into a flat table of fields, grouped by report type
+   and report id, each with the bit offset and size of its values in the report, its
+   usage and its logical and physical ranges. With it reports can be decoded generically
+   rather than with byte offsets written for each device model.
+
+   Bit offsets are from the start of the report data. Where the device numbers its
+   reports, usesReportIds() is true and the report id is the first byte of the
+   QByteArray returned by QHidApi::read(), so the fields start at the second byte.
+
+   Use QHidApi::reportDescriptor() to get the descriptor of an open device.
+*/
+
+/*!
+   \brief Constructs an invalid descriptor with no fields.
+*/
+QHidReportDescriptor::QHidReportDescriptor() :
+  mValid(false),
+  mUsesReportIds(false),
+  mUsagePage(0),
+  mUsage(0)
+{
+}
+
+/*!
+   \brief Parses a raw HID report descriptor.
+
+   Returns an invalid descriptor if descriptor is empty or malformed, that is an item
+   runs past the end, Pop has no matching Push or a collection is not closed.
+*/
+QHidReportDescriptor QHidReportDescriptor::parse(const QByteArray& descriptor)
+{
+  QHidReportDescriptor result;
+  result.mData = descriptor;
+
+  const uchar* data = reinterpret_cast<const uchar*>(descriptor.constData());
+  const int size = descriptor.size();
+
+  GlobalState global;
+  QVector<GlobalState> globalStack;
+  LocalState local;
+  int collectionDepth = 0;
+  bool topLevelUsageFound = false;
+
+  // the next free bit of each report, by type and report id.
+  QVector<quint32> reportBits(3 * 256, 0);
+
+  int i = 0;
+
+  while (i < size) {
+    const uchar prefix = data[i];
+
+    if (prefix == 0xfe) {
+      // a long item, none are defined so it is skipped.
+      if (i + 2 >= size) {
+        return QHidReportDescriptor();
+      }
+
+      i += 3 + data[i + 1];
+      continue;
+    }
+
+    const int dataSize = (prefix & 0x03) == 3 ? 4 : (prefix & 0x03);
+    const int tag = prefix & 0xfc;
+
+    if (i + 1 + dataSize > size) {
+      return QHidReportDescriptor();
+    }
+
+    const uchar* itemBytes = data + i + 1;
+    const quint32 value = itemData(itemBytes, dataSize);
+    i += 1 + dataSize;
+
+    switch (tag) {
+    case InputTag:
+    case OutputTag:
+    case FeatureTag: {
+      QHidReportField::ReportType type =
+        tag == InputTag ? QHidReportField::InputReport :
+        tag == OutputTag ? QHidReportField::OutputReport : QHidReportField::FeatureReport;
+      quint32& offset = reportBits[type * 256 + global.reportId];
+
+      QHidReportField field;
+      field.type = type;
+      field.reportId = global.reportId;
+      field.flags = quint16(value & 0x1ff);
+      field.bitSize = global.reportSize;
+      field.logicalMinimum = global.logicalMinimum;
+      field.logicalMaximum = global.signedLogicalMaximum();
+      field.physicalMinimum = global.physicalMinimum;
+      field.physicalMaximum = global.physicalMaximum;
+      field.unit = global.unit;
+      field.unitExponent = global.unitExponent;
+
+      const bool range = local.usages.isEmpty() && local.hasMinimum && local.hasMaximum;
+
+      if (range && (field.flags & QHidReportField::Variable)) {
+        // the range stands for the list of its usages, one per value.
+        for (quint32 u = local.minimum.usage;
+             u <= local.maximum.usage && local.usages.size() < global.reportCount; u++) {
+          local.usages.append(LocalUsage{local.minimum.page, ushort(u)});
+        }
+      }
+
+      if ((field.flags & QHidReportField::Variable) && !local.usages.isEmpty()) {
+        // a field for each value, the last usage repeats if there are too few.
+        for (int v = 0; v < global.reportCount; v++) {
+          const LocalUsage& u = local.usages.at(qMin(v, local.usages.size() - 1));
+          QHidReportField f = field;
+          f.usagePage = u.page;
+          f.usage = f.usageMaximum = u.usage;
+          f.bitOffset = offset;
+          f.count = 1;
+          result.mFields.append(f);
+          offset += global.reportSize;
+        }
+
+      } else {
+        // an Array, or padding with no usage.
+        if (range) {
+          field.usagePage = local.minimum.page;
+          field.usage = local.minimum.usage;
+          field.usageMaximum = local.maximum.usage;
+
+        } else if (!local.usages.isEmpty()) {
+          field.usagePage = local.usages.first().page;
+          field.usage = local.usages.first().usage;
+          field.usageMaximum = local.usages.last().usage;
+        }
+
+        field.bitOffset = offset;
+        field.count = global.reportCount;
+        result.mFields.append(field);
+        offset += quint32(global.reportSize) * global.reportCount;
+      }
+
+      local.clear();
+      break;
+    }
+
+    case CollectionTag:
+      if (collectionDepth == 0 && !topLevelUsageFound) {
+        LocalUsage u = local.usages.isEmpty() ? (local.hasMinimum ? local.minimum : LocalUsage{global.usagePage, 0})
+                       : local.usages.first();
+        result.mUsagePage = u.page;
+        result.mUsage = u.usage;
+        topLevelUsageFound = true;
+      }
+
+      collectionDepth++;
+      local.clear();
+      break;
+
+    case EndCollectionTag:
+      if (collectionDepth == 0) {
+        return QHidReportDescriptor();
+      }
+
+      collectionDepth--;
+      local.clear();
+      break;
+
+    case UsagePageTag:
+      global.usagePage = ushort(value);
+      break;
+
+    case LogicalMinimumTag:
+      global.logicalMinimum = signedItemData(itemBytes, dataSize);
+      break;
+
+    case LogicalMaximumTag:
+      global.logicalMaximum = value;
+      global.logicalMaximumSize = dataSize;
+      break;
+
+    case PhysicalMinimumTag:
+      global.physicalMinimum = signedItemData(itemBytes, dataSize);
+      break;
+
+    case PhysicalMaximumTag:
+      global.physicalMaximum = signedItemData(itemBytes, dataSize);
+      break;
+
+    case UnitExponentTag:
+      // the exponent is a four bit signed nibble.
+      global.unitExponent = qint8((value & 0x08) ? int(value & 0x0f) - 16 : int(value & 0x0f));
+      break;
+
+    case UnitTag:
+      global.unit = value;
+      break;
+
+    case ReportSizeTag:
+      global.reportSize = quint16(value);
+      break;
+
+    case ReportIdTag:
+      if (value == 0 || value > 0xff) {
+        return QHidReportDescriptor();
+      }
+
+      global.reportId = quint8(value);
+      result.mUsesReportIds = true;
+      break;
+
+    case ReportCountTag:
+      global.reportCount = quint16(value);
+      break;
+
+    case PushTag:
+      if (globalStack.size() >= MAX_GLOBAL_STACK) {
+        return QHidReportDescriptor();
+      }
+
+      globalStack.append(global);
+      break;
+
+    case PopTag:
+      if (globalStack.isEmpty()) {
+        return QHidReportDescriptor();
+      }
+
+      global = globalStack.takeLast();
+      break;
+
+    case UsageTag:
+      local.usages.append(localUsage(value, dataSize, global.usagePage));
+      break;
+
+    case UsageMinimumTag:
+      local.minimum = localUsage(value, dataSize, global.usagePage);
+      local.hasMinimum = true;
+      break;
+
+    case UsageMaximumTag:
+      local.maximum = localUsage(value, dataSize, global.usagePage);
+      local.hasMaximum = true;
+      break;
+
+    default:
+      // designators, strings and delimiters aren't needed for decoding.
+      break;
+    }
+  }
+
+  if (collectionDepth != 0 || result.mFields.isEmpty()) {
+    return QHidReportDescriptor();
+  }
+
+  // group the fields by report, keeping the descriptor order within each.
+  std::stable_sort(result.mFields.begin(), result.mFields.end(),
+  [](const QHidReportField & a, const QHidReportField & b) {
+    return a.type != b.type ? a.type < b.type : a.reportId < b.reportId;
+  });
+
+  for (int f = 0; f < result.mFields.size(); f++) {
+    const QHidReportField& field = result.mFields.at(f);
+
+    if (result.mReports.isEmpty() || result.mReports.last().type != field.type
+        || result.mReports.last().reportId != field.reportId) {
+      Report report;
+      report.type = field.type;
+      report.reportId = field.reportId;
+      report.firstField = f;
+      report.fieldCount = 0;
+      report.bitSize = reportBits.at(field.type * 256 + field.reportId);
+      result.mReports.append(report);
+    }
+
+    result.mReports.last().fieldCount++;
+  }
+
+  result.mValid = true;
+
+  return result;
+}
+
+/*!
+   \brief Whether the descriptor was parsed successfully.
+*/
+bool QHidReportDescriptor::isValid() const
+{
+  return mValid;
+}
+
+/*!
+   \brief The raw descriptor that was parsed.
+*/
+QByteArray QHidReportDescriptor::data() const
+{
+  return mData;
+}
+
+/*!
+   \brief Whether the device numbers its reports, in which case the first byte of each
+   report is its report id.
+*/
+bool QHidReportDescriptor::usesReportIds() const
+{
+  return mUsesReportIds;
+}
+
+/*!
+   \brief The usage page of the first top level collection.
+*/
+ushort QHidReportDescriptor::usagePage() const
+{
+  return mUsagePage;
+}
+
+/*!
+   \brief The usage of the first top level collection.
+*/
+ushort QHidReportDescriptor::usage() const
+{
+  return mUsage;
+}
+
+/*!
+   \brief Every field of every report, grouped by report as listed in reports().
+*/
+const QVector<QHidReportField>& QHidReportDescriptor::fields() const
+{
+  return mFields;
+}
+
+/*!
+   \brief The fields of the report of the supplied type and report id, in the order they
+   appear in the report.
+*/
+QVector<QHidReportField> QHidReportDescriptor::fields(QHidReportField::ReportType type,
+    quint8 reportId) const
+{
+  const Report* r = report(type, reportId);
+
+  if (r == nullptr) {
+    return QVector<QHidReportField>();
+  }
+
+  return mFields.mid(r->firstField, r->fieldCount);
+}
+
+/*!
+   \brief Every report, ordered by type and then report id.
+*/
+const QVector<QHidReportDescriptor::Report>& QHidReportDescriptor::reports() const
+{
+  return mReports;
+}
+
+/*!
+   \brief The report of the supplied type and report id, or nullptr if there is none.
+*/
+const QHidReportDescriptor::Report* QHidReportDescriptor::report(QHidReportField::ReportType type,
+    quint8 reportId) const
+{
+  for (const Report& r : mReports) {
+    if (r.type == type && r.reportId == reportId) {
+      return &r;
+    }
+  }
+
+  return nullptr;
+}
+
+/*!
+   \brief The report ids of the reports of the supplied type.
+*/
+QList<quint8> QHidReportDescriptor::reportIds(QHidReportField::ReportType type) const
+{
+  QList<quint8> result;
+
+  for (const Report& r : mReports) {
+    if (r.type == type) {
+      result.append(r.reportId);
+    }
+  }
+
+  return result;
+}
+
+/*!
+   \brief The size in bytes of the data of the report of the supplied type and report id,
+   not counting the report id byte, or -1 if there is no such report.
+*/
+int QHidReportDescriptor::reportSize(QHidReportField::ReportType type, quint8 reportId) const
+{
+  const Report* r = report(type, reportId);
+
+  if (r == nullptr) {
+    return -1;
+  }
+
+  return int((r->bitSize + 7) / 8);
+}
@@ -0,0 +1,147 @@
+/*
+  Copyright 2020 Simon Meaden
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+  of the Software, and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  @author: Simon Meaden
+
+*/
+#ifndef QHIDREPORTDESCRIPTOR_H
+#define QHIDREPORTDESCRIPTOR_H
+
+#include <QByteArray>
+#include <QVector>
+#include <QList>
+
+#include "qhidapi_global.h"
+
+struct QHidReportField {
+    /** The kind of report a field belongs to. */
+    enum ReportType {
+        InputReport = 0,
+        OutputReport = 1,
+        FeatureReport = 2,
+    };
+
+    /** The data bits of the Input, Output or Feature item,
+            as in section 6.2.2.5 of the HID specification. */
+    enum Flag {
+        Constant = 0x001, //!< Padding or a fixed value, otherwise Data.
+        Variable = 0x002, //!< One value per usage, otherwise an Array of usage indexes.
+        Relative = 0x004, //!< A change since the last report, otherwise Absolute.
+        Wrap = 0x008,
+        NonLinear = 0x010,
+        NoPreferred = 0x020,
+        NullState = 0x040,
+        Volatile = 0x080,
+        BufferedBytes = 0x100,
+    };
+
+    QHidReportField();
+
+    /** Whether the values are signed, which is when the
+            logical minimum is negative. */
+    bool isSigned() const;
+
+    /** The report this field is part of. */
+    ReportType type;
+    /** The report id, 0 if the device doesn't number its reports. */
+    quint8 reportId;
+    /** The item's Input, Output or Feature data bits, see Flag. */
+    quint16 flags;
+    /** Usage Page of the field. */
+    ushort usagePage;
+    /** Usage of a Variable field. For an Array field the
+            first usage of its range. */
+    ushort usage;
+    /** The last usage of an Array field's range, the same as usage
+            for a Variable field. */
+    ushort usageMaximum;
+    /** Offset of the first value in bits from the start of the report,
+            not counting the report id byte. */
+    quint32 bitOffset;
+    /** Size of each value in bits. */
+    quint16 bitSize;
+    /** The number of values. Always 1 for a Variable field with a usage,
+            as each value gets a field of its own. */
+    quint16 count;
+    /** Logical minimum and maximum, the range of the raw values. */
+    qint32 logicalMinimum;
+    qint32 logicalMaximum;
+    /** Physical minimum and maximum, the range in units that the logical
+            range maps onto. Both are 0 if the descriptor doesn't set them. */
+    qint32 physicalMinimum;
+    qint32 physicalMaximum;
+    /** The unit, coded as in section 6.2.2.7 of the HID specification. */
+    quint32 unit;
+    /** The power of ten the physical values are scaled by. */
+    qint8 unitExponent;
+};
+
+/** A usage page and usage, which name a value in a report. */
+struct QHidUsage {
+    QHidUsage(ushort usagePage = 0, ushort usage = 0) :
+      usagePage(usagePage),
+      usage(usage) {}
+
+    ushort usagePage;
+    ushort usage;
+};
+
+class QHIDAPISHARED_EXPORT QHidReportDescriptor
+{
+public:
+  /** One report, the fields of which are fieldCount fields from firstField. */
+  struct Report {
+    QHidReportField::ReportType type;
+    quint8 reportId;
+    int firstField;
+    int fieldCount;
+    quint32 bitSize;
+  };
+
+  QHidReportDescriptor();
+
+  static QHidReportDescriptor parse(const QByteArray& descriptor);
+
+  bool isValid() const;
+  QByteArray data() const;
+  bool usesReportIds() const;
+  ushort usagePage() const;
+  ushort usage() const;
+
+  const QVector<QHidReportField>& fields() const;
+  QVector<QHidReportField> fields(QHidReportField::ReportType type, quint8 reportId = 0) const;
+  const QVector<Report>& reports() const;
+  const Report* report(QHidReportField::ReportType type, quint8 reportId = 0) const;
+  QList<quint8> reportIds(QHidReportField::ReportType type) const;
+  int reportSize(QHidReportField::ReportType type, quint8 reportId = 0) const;
+
+private:
+  friend class QHidDescriptorCache;
+
+  QByteArray mData;
+  QVector<QHidReportField> mFields;
+  QVector<Report> mReports;
+  bool mValid;
+  bool mUsesReportIds;
+  ushort mUsagePage, mUsage;
+};
+
+#endif // QHIDREPORTDESCRIPTOR_H
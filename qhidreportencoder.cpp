@@ -0,0 +1,317 @@
+/*
+  Copyright 2020 Simon Meaden
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+  of the Software, and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  @author: Simon Meaden
+
+*/
+#include "qhidreportencoder.h"
+
+#include <QtEndian>
+
+#include <cstring>
+#include <limits>
+
+// the widest value an op encodes, as the values are qint32.
+static const int MAX_VALUE_BITS = 32;
+// the bytes of each load and store.
+static const int STORE_SIZE = 8;
+
+/*!
+   \class QHidReportEncoder
+   \brief Builds output or feature reports from usage and value pairs, using the layout
+   compiled from a QHidReportDescriptor.
+
+   The descriptor is interpreted once, when the encoder is constructed. Each Variable
+   field of the reports of the encoder's type becomes an op holding its byte offset,
+   shift, mask and logical range, and the usages of the fields are indexed, so encode()
+   only looks each usage up, clamps the value to the field's logical range and merges it
+   into the report with a 64 bit load and store.
+   \code
+       QHidReportEncoder encoder(api->reportDescriptor(id));
+
+       int reportId = encoder.encode({ QHidUsageValue(0x08, 0x01, 1),    // Num Lock
+                                       QHidUsageValue(0x08, 0x02, 0) }); // Caps Lock
+       if (reportId >= 0)
+           api->write(id, encoder.report(reportId));
+   \endcode
+
+   Every report is built in a buffer owned by the encoder, which is allocated once and
+   keeps the values last written to it, so a report can be updated a few values at a time.
+   A report starts as zero, with its report id in the first byte as QHidApi::write() and
+   hid_send_feature_report() expect. QHidApi::write(quint32, const QVector<QHidUsageValue>&)
+   and QHidApi::sendFeatureReport() use an encoder kept for each open device.
+
+   Array fields, fields without a usage and fields wider than 32 bits can't be encoded.
+*/
+
+/*!
+   \brief Constructs an invalid encoder.
+*/
+QHidReportEncoder::QHidReportEncoder() :
+  mType(QHidReportField::OutputReport),
+  mPlanIndex(256, -1)
+{
+}
+
+/*!
+   \brief Compiles the layout of every report of type in descriptor, which should be
+   OutputReport or FeatureReport.
+*/
+QHidReportEncoder::QHidReportEncoder(const QHidReportDescriptor& descriptor,
+                                     QHidReportField::ReportType type) :
+  mType(type),
+  mPlanIndex(256, -1)
+{
+  compile(descriptor);
+}
+
+void QHidReportEncoder::compile(const QHidReportDescriptor& descriptor)
+{
+  if (!descriptor.isValid() || mType == QHidReportField::InputReport) {
+    return;
+  }
+
+  int bufferSize = 0;
+
+  for (const QHidReportDescriptor::Report& report : descriptor.reports()) {
+    if (report.type != mType) {
+      continue;
+    }
+
+    Plan plan;
+    plan.reportId = report.reportId;
+    plan.firstOp = mOps.size();
+    plan.reportSize = 1 + int((report.bitSize + 7) / 8);
+    plan.bufferOffset = bufferSize;
+
+    for (int f = report.firstField; f < report.firstField + report.fieldCount; f++) {
+      const QHidReportField& field = descriptor.fields().at(f);
+
+      if ((field.flags & QHidReportField::Constant) || !(field.flags & QHidReportField::Variable)
+          || field.count != 1 || field.usage == 0
+          || field.bitSize == 0 || field.bitSize > MAX_VALUE_BITS) {
+        continue;
+      }
+
+      Op op;
+      op.byteOffset = 1 + field.bitOffset / 8;
+      op.shift = quint8(field.bitOffset % 8);
+      op.signShift = field.isSigned() ? quint8(64 - field.bitSize) : 0;
+      op.reportId = report.reportId;
+      op.mask = ((Q_UINT64_C(1) << field.bitSize) - 1) << op.shift;
+
+      // a range that doesn't make sense, such as an unsigned 32 bit maximum, isn't clamped to.
+      if (field.logicalMinimum <= field.logicalMaximum) {
+        op.logicalMinimum = field.logicalMinimum;
+        op.logicalMaximum = field.logicalMaximum;
+      } else {
+        op.logicalMinimum = std::numeric_limits<qint32>::min();
+        op.logicalMaximum = std::numeric_limits<qint32>::max();
+      }
+
+      const quint32 key = (quint32(field.usagePage) << 16) | field.usage;
+
+      if (!mUsages.contains(key)) {
+        mUsages.insert(key, mOps.size());
+      }
+
+      mOps.append(op);
+    }
+
+    plan.opCount = mOps.size() - plan.firstOp;
+
+    // room for a full store at the last byte of the report.
+    bufferSize += plan.reportSize + STORE_SIZE;
+
+    mPlanIndex[plan.reportId] = qint16(mPlans.size());
+    mPlans.append(plan);
+  }
+
+  mBuffer.resize(bufferSize);
+  clear();
+}
+
+/*!
+   \brief Whether the encoder has a layout for at least one report.
+*/
+bool QHidReportEncoder::isValid() const
+{
+  return !mPlans.isEmpty();
+}
+
+/*!
+   \brief The kind of report the encoder builds.
+*/
+QHidReportField::ReportType QHidReportEncoder::type() const
+{
+  return mType;
+}
+
+/*!
+   \brief The op of the field with usagePage and usage, or -1 if there is none.
+*/
+int QHidReportEncoder::opIndex(ushort usagePage, ushort usage) const
+{
+  return mUsages.value((quint32(usagePage) << 16) | usage, -1);
+}
+
+/*!
+   \brief The plan of the report with reportId, or nullptr if there is none.
+*/
+const QHidReportEncoder::Plan* QHidReportEncoder::plan(quint8 reportId) const
+{
+  int index = mPlanIndex.at(reportId);
+  return index >= 0 ? &mPlans.at(index) : nullptr;
+}
+
+/*!
+   \brief The ops of every report.
+*/
+const QVector<QHidReportEncoder::Op>& QHidReportEncoder::ops() const
+{
+  return mOps;
+}
+
+/*!
+   \brief Writes values into their report.
+
+   Every value must be in the same report. The values are written in a single pass, so
+   if one of them has no field, or a field in another report, the values before it have
+   already been written.
+
+   \return the report id of the report, or -1 on error.
+*/
+int QHidReportEncoder::encode(const QVector<QHidUsageValue>& values)
+{
+  return encode(values.constData(), values.size());
+}
+
+/*!
+   \brief Writes count values into their report.
+
+   \return the report id of the report, or -1 on error.
+*/
+int QHidReportEncoder::encode(const QHidUsageValue* values, int count)
+{
+  if (count <= 0) {
+    return -1;
+  }
+
+  int reportId = -1;
+
+  for (int i = 0; i < count; i++) {
+    const int op = opIndex(values[i].usagePage, values[i].usage);
+
+    if (op < 0) {
+      return -1;
+    }
+
+    if (reportId < 0) {
+      reportId = mOps.at(op).reportId;
+
+    } else if (mOps.at(op).reportId != reportId) {
+      return -1;
+    }
+
+    setValue(op, values[i].value);
+  }
+
+  return reportId;
+}
+
+/*!
+   \brief Writes value, clamped to the logical range of its field, to op.
+*/
+void QHidReportEncoder::setValue(int op, qint32 value)
+{
+  const Op& o = mOps.at(op);
+  uchar* p = mBuffer.data() + mPlans.at(mPlanIndex.at(o.reportId)).bufferOffset + o.byteOffset;
+
+  const qint32 clamped = qBound(o.logicalMinimum, value, o.logicalMaximum);
+  quint64 word = qFromLittleEndian<quint64>(p);
+  word = (word & ~o.mask) | ((quint64(quint32(clamped)) << o.shift) & o.mask);
+  qToLittleEndian<quint64>(word, p);
+}
+
+/*!
+   \brief The value last written to op, 0 if none has been.
+*/
+qint32 QHidReportEncoder::value(int op) const
+{
+  const Op& o = mOps.at(op);
+  const uchar* p = mBuffer.constData() + mPlans.at(mPlanIndex.at(o.reportId)).bufferOffset
+                   + o.byteOffset;
+
+  const quint64 raw = (qFromLittleEndian<quint64>(p) & o.mask) >> o.shift;
+  return qint32(qint64(raw << o.signShift) >> o.signShift);
+}
+
+/*!
+   \brief Sets every value of every report back to zero.
+*/
+void QHidReportEncoder::clear()
+{
+  if (mBuffer.isEmpty()) {
+    return;
+  }
+
+  std::memset(mBuffer.data(), 0, size_t(mBuffer.size()));
+
+  for (const Plan& p : mPlans) {
+    mBuffer[p.bufferOffset] = p.reportId;
+  }
+}
+
+/*!
+   \brief The report with reportId as it has been built, reportSize() bytes starting with
+   the report id, or nullptr if there is no such report.
+*/
+const uchar* QHidReportEncoder::data(quint8 reportId) const
+{
+  const Plan* p = plan(reportId);
+  return p != nullptr ? mBuffer.constData() + p->bufferOffset : nullptr;
+}
+
+/*!
+   \brief The number of bytes in the report with reportId, including the report id byte,
+   or -1 if there is no such report.
+*/
+int QHidReportEncoder::reportSize(quint8 reportId) const
+{
+  const Plan* p = plan(reportId);
+  return p != nullptr ? p->reportSize : -1;
+}
+
+/*!
+   \brief A copy of the report with reportId as it has been built, or an empty QByteArray
+   if there is no such report.
+*/
+QByteArray QHidReportEncoder::report(quint8 reportId) const
+{
+  const Plan* p = plan(reportId);
+
+  if (p == nullptr) {
+    return QByteArray();
+  }
+
+  return QByteArray(reinterpret_cast<const char*>(mBuffer.constData() + p->bufferOffset),
+                    p->reportSize);
+}
@@ -0,0 +1,101 @@
+/*
+  Copyright 2020 Simon Meaden
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+  of the Software, and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  @author: Simon Meaden
+
+*/
+#ifndef QHIDREPORTENCODER_H
+#define QHIDREPORTENCODER_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QVector>
+
+#include "qhidapi_global.h"
+#include "qhidreportdescriptor.h"
+
+/** A value for the field with usagePage and usage. */
+struct QHidUsageValue {
+    QHidUsageValue(ushort usagePage = 0, ushort usage = 0, qint32 value = 0) :
+      usagePage(usagePage),
+      usage(usage),
+      value(value) {}
+
+    ushort usagePage;
+    ushort usage;
+    qint32 value;
+};
+
+class QHIDAPISHARED_EXPORT QHidReportEncoder
+{
+public:
+  /** One value of a report, written with a 64 bit load and store at byteOffset. */
+  struct Op {
+    quint32 byteOffset;      // from the start of the report's buffer, past the report id byte.
+    quint8 shift;            // the value's lowest bit within the load.
+    quint8 signShift;        // 64 - bit size for signed values, otherwise 0.
+    quint8 reportId;
+    quint64 mask;            // the value's bits in place.
+    qint32 logicalMinimum;   // the range values are clamped to.
+    qint32 logicalMaximum;
+  };
+
+  /** The ops of the report with reportId, opCount ops from firstOp. */
+  struct Plan {
+    quint8 reportId;
+    int firstOp;
+    int opCount;
+    int reportSize;    // bytes in a complete report, including the report id byte.
+    int bufferOffset;  // where the report starts in the encoder's buffer.
+  };
+
+  QHidReportEncoder();
+  explicit QHidReportEncoder(const QHidReportDescriptor& descriptor,
+                             QHidReportField::ReportType type = QHidReportField::OutputReport);
+
+  bool isValid() const;
+  QHidReportField::ReportType type() const;
+  int opIndex(ushort usagePage, ushort usage) const;
+  const Plan* plan(quint8 reportId = 0) const;
+  const QVector<Op>& ops() const;
+
+  int encode(const QVector<QHidUsageValue>& values);
+  int encode(const QHidUsageValue* values, int count);
+  void setValue(int op, qint32 value);
+  qint32 value(int op) const;
+  void clear();
+
+  const uchar* data(quint8 reportId = 0) const;
+  int reportSize(quint8 reportId = 0) const;
+  QByteArray report(quint8 reportId = 0) const;
+
+private:
+  void compile(const QHidReportDescriptor& descriptor);
+
+  QHidReportField::ReportType mType;
+  QVector<Op> mOps;
+  QVector<Plan> mPlans;
+  QVector<qint16> mPlanIndex;    // report id -> plan, or -1.
+  QHash<quint32, int> mUsages;   // usage page and usage -> op.
+  QVector<uchar> mBuffer;        // every report, each padded for the last store.
+};
+
+#endif // QHIDREPORTENCODER_H
@@ -0,0 +1,103 @@
+/*
+  Copyright 2020 Simon Meaden
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+  of the Software, and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  @author: Simon Meaden
+
+*/
+#ifndef QHIDREPORTHANDLER_H
+#define QHIDREPORTHANDLER_H
+
+#include <QtGlobal>
+
+#include <type_traits>
+
+/**
+   A reference to a function, or a lambda or other callable, which takes
+   (quint32 deviceId, const uchar* data, int size), given to
+   QHidApi::setReportHandler().
+
+   Like a pointer it doesn't own what it refers to, nor copy it, so a lambda
+   with captures has to outlive the handler. One without captures, like a
+   function, can be passed as it is written.
+*/
+class QHidReportHandler
+{
+public:
+  typedef void (*Function)(quint32 deviceId, const uchar* data, int size);
+
+  QHidReportHandler() :
+    mObject(nullptr),
+    mFunction(nullptr),
+    mCall(nullptr) {}
+
+  QHidReportHandler(Function function) :
+    mObject(nullptr),
+    mFunction(function),
+    mCall(function ? &callFunction : nullptr) {}
+
+  template<class F, typename std::enable_if<
+             !std::is_convertible<F&, Function>::value
+             && !std::is_same<typename std::remove_cv<F>::type, QHidReportHandler>::value, int>::type = 0>
+  QHidReportHandler(F& callable) :
+    mObject(const_cast<void*>(static_cast<const void*>(&callable))),
+    mFunction(nullptr),
+    mCall(&callObject<F>) {}
+
+  // a temporary would be gone before the handler is called.
+  template<class F, typename std::enable_if<
+             !std::is_lvalue_reference<F>::value
+             && !std::is_convertible<F, Function>::value
+             && !std::is_same<typename std::decay<F>::type, QHidReportHandler>::value, int>::type = 0>
+  QHidReportHandler(F&& callable) = delete;
+
+  void operator()(quint32 deviceId, const uchar* data, int size) const
+  {
+    mCall(*this, deviceId, data, size);
+  }
+
+  explicit operator bool() const
+  {
+    return mCall != nullptr;
+  }
+
+private:
+  typedef void (*Call)(const QHidReportHandler& handler, quint32 deviceId,
+                       const uchar* data, int size);
+
+  static void callFunction(const QHidReportHandler& handler, quint32 deviceId,
+                           const uchar* data, int size)
+  {
+    handler.mFunction(deviceId, data, size);
+  }
+
+  template<class F>
+  static void callObject(const QHidReportHandler& handler, quint32 deviceId,
+                         const uchar* data, int size)
+  {
+    (*static_cast<F*>(handler.mObject))(deviceId, data, size);
+  }
+
+  void* mObject;
+  Function mFunction;
+  Call mCall;
+};
+
+#endif // QHIDREPORTHANDLER_H
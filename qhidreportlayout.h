@@ -0,0 +1,287 @@
+/*
+  Copyright 2020 Simon Meaden
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+  of the Software, and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  @author: Simon Meaden
+
+*/
+#ifndef QHIDREPORTLAYOUT_H
+#define QHIDREPORTLAYOUT_H
+
+#include <QByteArray>
+#include <QVector>
+
+#include <type_traits>
+
+#include "qhidreportdescriptor.h"
+
+/*!
+   \class QHidLayoutField
+   \brief One value of a QHidReportLayout, BitSize bits from BitOffset bits into the
+   report data, not counting the report id byte.
+
+   UsagePage and Usage are only used by QHidReportLayout::verify(), a field with a
+   Usage of 0 is checked by its position and size alone.
+*/
+template<unsigned BitOffset, unsigned BitSize, bool Signed = false,
+         ushort UsagePage = 0, ushort Usage = 0>
+struct QHidLayoutField {
+  static_assert(BitSize >= 1 && BitSize <= 32, "a layout field must be 1 to 32 bits");
+
+  static constexpr unsigned bitOffset = BitOffset;
+  static constexpr unsigned bitSize = BitSize;
+  static constexpr bool isSigned = Signed;
+  static constexpr ushort usagePage = UsagePage;
+  static constexpr ushort usage = Usage;
+
+  // the position of the value in the bytes it spans.
+  static constexpr unsigned byteOffset = BitOffset / 8;
+  static constexpr unsigned shift = BitOffset % 8;
+  static constexpr unsigned byteCount = (shift + BitSize + 7) / 8;
+  static constexpr quint64 mask = (Q_UINT64_C(1) << BitSize) - 1;
+  // bytes of report data up to the end of the value.
+  static constexpr unsigned end = (BitOffset + BitSize + 7) / 8;
+};
+
+namespace QHidLayoutDetail {
+
+// little endian loads and stores of N bytes, unrolled at compile time.
+template<unsigned N>
+struct Bytes {
+  static inline quint64 load(const uchar* p)
+  {
+    return (quint64(p[N - 1]) << (8 * (N - 1))) | Bytes<N - 1>::load(p);
+  }
+
+  static inline void store(uchar* p, quint64 value)
+  {
+    p[N - 1] = uchar(value >> (8 * (N - 1)));
+    Bytes<N - 1>::store(p, value);
+  }
+};
+
+template<>
+struct Bytes<0> {
+  static inline quint64 load(const uchar*)
+  {
+    return 0;
+  }
+
+  static inline void store(uchar*, quint64) {}
+};
+
+// the largest end of a list of fields.
+template<typename... Fields>
+struct MaxEnd;
+
+template<>
+struct MaxEnd<> {
+  static constexpr unsigned value = 0;
+};
+
+template<typename Field, typename... Fields>
+struct MaxEnd<Field, Fields...> {
+  static constexpr unsigned value =
+    Field::end > MaxEnd<Fields...>::value ? Field::end : MaxEnd<Fields...>::value;
+};
+
+// whether Field is one of Fields.
+template<typename Field, typename... Fields>
+struct Contains;
+
+template<typename Field>
+struct Contains<Field> {
+  static constexpr bool value = false;
+};
+
+template<typename Field, typename First, typename... Fields>
+struct Contains<Field, First, Fields...> {
+  static constexpr bool value =
+    std::is_same<Field, First>::value || Contains<Field, Fields...>::value;
+};
+
+}
+
+/*!
+   \class QHidReportLayout
+   \brief A report layout declared as a type, for devices whose reports are known when
+   the application is built.
+
+   The offsets, masks and shifts of every field are compile time constants, so value()
+   and setValue() inline to a few loads, shifts and stores with no layout interpreted at
+   run time. The buffers are the ones QHidApi uses. An input report is the QByteArray
+   returned by QHidApi::read(), which starts with the report id only if ReportId isn't 0.
+   Output and feature reports always start with the report id, as QHidApi::write(quint32,
+   QByteArray) and QHidApi::featureReport() expect.
+   \code
+       typedef QHidLayoutField<0, 1, false, 0x09, 0x01> LeftButton;
+       typedef QHidLayoutField<8, 8, true, 0x01, 0x30> X;
+       typedef QHidLayoutField<16, 8, true, 0x01, 0x31> Y;
+       typedef QHidReportLayout<QHidReportField::InputReport, 0, LeftButton, X, Y> MouseReport;
+
+       quint32 id = api->open(path);
+       if (!MouseReport::verify(api->reportDescriptor(id)))
+           return; // a different firmware or model.
+
+       QByteArray report = api->read(id);
+       if (MouseReport::matches(report))
+           move(MouseReport::value<X>(report), MouseReport::value<Y>(report));
+   \endcode
+
+   verify() checks the declared layout against the device's parsed descriptor. Call it
+   once after the device is opened, the accessors themselves don't check anything.
+*/
+template<QHidReportField::ReportType Type, quint8 ReportId, typename... Fields>
+class QHidReportLayout
+{
+public:
+  static constexpr QHidReportField::ReportType type = Type;
+  static constexpr quint8 reportId = ReportId;
+  // bytes in front of the report data.
+  static constexpr unsigned idBytes = (Type != QHidReportField::InputReport || ReportId != 0) ? 1 : 0;
+  // bytes in a report buffer, up to the end of the last field.
+  static constexpr unsigned size = idBytes + QHidLayoutDetail::MaxEnd<Fields...>::value;
+
+  /*!
+     \brief Reads Field from a report buffer of at least size bytes.
+  */
+  template<typename Field>
+  static inline qint32 value(const uchar* report)
+  {
+    static_assert(QHidLayoutDetail::Contains<Field, Fields...>::value,
+                  "the field is not part of this layout");
+
+    quint64 raw = (QHidLayoutDetail::Bytes<Field::byteCount>::load(report + idBytes + Field::byteOffset)
+                   >> Field::shift) & Field::mask;
+
+    if (Field::isSigned) {
+      return qint32(qint64(raw << (64 - Field::bitSize)) >> (64 - Field::bitSize));
+    }
+
+    return qint32(raw);
+  }
+
+  template<typename Field>
+  static inline qint32 value(const QByteArray& report)
+  {
+    return value<Field>(reinterpret_cast<const uchar*>(report.constData()));
+  }
+
+  /*!
+     \brief Writes the low bits of v to Field in a report buffer of at least size
+     bytes, leaving the bits around it as they are.
+  */
+  template<typename Field>
+  static inline void setValue(uchar* report, qint32 v)
+  {
+    static_assert(QHidLayoutDetail::Contains<Field, Fields...>::value,
+                  "the field is not part of this layout");
+
+    uchar* p = report + idBytes + Field::byteOffset;
+    quint64 word = QHidLayoutDetail::Bytes<Field::byteCount>::load(p);
+    word &= ~(Field::mask << Field::shift);
+    word |= (quint64(quint32(v)) & Field::mask) << Field::shift;
+    QHidLayoutDetail::Bytes<Field::byteCount>::store(p, word);
+  }
+
+  template<typename Field>
+  static inline void setValue(QByteArray& report, qint32 v)
+  {
+    setValue<Field>(reinterpret_cast<uchar*>(report.data()), v);
+  }
+
+  /*!
+     \brief A zeroed report buffer of size bytes, starting with the report id where
+     the buffer has one.
+  */
+  static QByteArray create()
+  {
+    QByteArray report(int(size), '\0');
+
+    if (idBytes) {
+      report[0] = char(ReportId);
+    }
+
+    return report;
+  }
+
+  /*!
+     \brief Whether report is long enough for the layout and has its report id.
+  */
+  static inline bool matches(const QByteArray& report)
+  {
+    return report.size() >= int(size)
+           && (idBytes == 0 || uchar(report.at(0)) == ReportId);
+  }
+
+  /*!
+     \brief Whether the layout agrees with descriptor.
+
+     The report must exist and be long enough, and every field must line up with a value
+     in the descriptor of the same bit offset, size and signedness, and the same usage
+     where the field has one.
+  */
+  static bool verify(const QHidReportDescriptor& descriptor)
+  {
+    if (!descriptor.isValid() || descriptor.usesReportIds() != (ReportId != 0)) {
+      return false;
+    }
+
+    int reportSize = descriptor.reportSize(Type, ReportId);
+
+    if (reportSize < 0 || unsigned(reportSize) + idBytes < size) {
+      return false;
+    }
+
+    const QVector<QHidReportField> fields = descriptor.fields(Type, ReportId);
+    bool results[] = { true, verifyField<Fields>(fields)... };
+
+    for (bool result : results) {
+      if (!result) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+private:
+  template<typename Field>
+  static bool verifyField(const QVector<QHidReportField>& fields)
+  {
+    for (const QHidReportField& f : fields) {
+      if (f.bitSize != Field::bitSize) {
+        continue;
+      }
+
+      for (int v = 0; v < f.count; v++) {
+        if (f.bitOffset + quint32(v) * f.bitSize == Field::bitOffset) {
+          return f.isSigned() == Field::isSigned
+                 && (Field::usage == 0
+                     || (f.usagePage == Field::usagePage && f.usage == Field::usage));
+        }
+      }
+    }
+
+    return false;
+  }
+};
+
+#endif // QHIDREPORTLAYOUT_H
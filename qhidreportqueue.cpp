@@ -0,0 +1,113 @@
+/*
+  Copyright 2020 Simon Meaden
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+  of the Software, and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  @author: Simon Meaden
+
+*/
+#include "qhidreportqueue.h"
+
+#include <cstring>
+
+/*!
+   \class QHidReportQueue
+   \brief A lock free queue of input reports from one producer, a QHidReaderThread,
+   to one consumer.
+
+   The queue is a ring of fixed size slots allocated, and touched, when it is
+   constructed, so neither side allocates, locks or makes a system call to pass a
+   report. The producer fills the slot from beginPush() and publishes it with push(),
+   the consumer reads the slot from front() and releases it with pop(). Each side only
+   writes its own counter, and the counters are kept on separate cache lines.
+   \code
+       while (const QHidReport* report = queue->front()) {
+           handle(report->deviceId, report->data, report->size);
+           queue->pop();
+       }
+   \endcode
+
+   When the queue is full the reader thread keeps reading, so that the device's own
+   buffer doesn't overflow, and the newest report is dropped and counted in dropped().
+*/
+
+/*!
+   \brief Constructs a queue of capacity reports, rounded up to a power of two.
+*/
+QHidReportQueue::QHidReportQueue(int capacity) :
+  mMask(0),
+  mHead(0),
+  mTail(0),
+  mDropped(0)
+{
+  quint32 size = 1;
+
+  while (size < quint32(qMax(capacity, 1))) {
+    size <<= 1;
+  }
+
+  mSlots.resize(int(size));
+  mMask = size - 1;
+
+  // fault the pages in now, not on the reader's first pass round the ring.
+  std::memset(mSlots.data(), 0, sizeof(QHidReport) * size);
+}
+
+/*!
+   \brief The number of reports the queue holds when full.
+*/
+int QHidReportQueue::capacity() const
+{
+  return int(mMask + 1);
+}
+
+/*!
+   \brief The number of reports waiting, which is only a snapshot if the other
+   side is running.
+*/
+int QHidReportQueue::size() const
+{
+  return int(mHead.loadAcquire() - mTail.loadAcquire());
+}
+
+/*!
+   \brief The number of reports dropped because the queue was full. The count wraps.
+*/
+quint32 QHidReportQueue::dropped() const
+{
+  return mDropped.loadAcquire();
+}
+
+/*!
+   \brief Copies the oldest report into report and removes it from the queue.
+
+   \return true if there was a report, otherwise false.
+*/
+bool QHidReportQueue::tryPop(QHidReport& report)
+{
+  const QHidReport* next = front();
+
+  if (!next) {
+    return false;
+  }
+
+  report = *next;
+  pop();
+  return true;
+}
@@ -0,0 +1,114 @@
+/*
+  Copyright 2020 Simon Meaden
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+  of the Software, and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  @author: Simon Meaden
+
+*/
+#ifndef QHIDREPORTQUEUE_H
+#define QHIDREPORTQUEUE_H
+
+#include <QAtomicInteger>
+#include <QMetaType>
+#include <QVector>
+
+#include "qhidapi_global.h"
+
+/** An input report as read by a QHidReaderThread. */
+struct QHidReport {
+  /** The id of the device it was read from. */
+  quint32 deviceId;
+  /** The bytes in data, including the report id byte if the device numbers its reports. */
+  int size;
+  /** When the read returned, in nanoseconds of the steady clock. */
+  qint64 timestamp;
+  uchar data[65];
+};
+
+Q_DECLARE_METATYPE(QHidReport)
+
+class QHIDAPISHARED_EXPORT QHidReportQueue
+{
+public:
+  explicit QHidReportQueue(int capacity = 1024);
+
+  int capacity() const;
+  int size() const;
+  quint32 dropped() const;
+
+  /** The slot the producer fills next, or nullptr if the queue is full. */
+  inline QHidReport* beginPush()
+  {
+    const quint32 head = mHead.loadAcquire();
+
+    if (head - mTail.loadAcquire() > mMask) {
+      return nullptr;
+    }
+
+    return &mSlots[int(head & mMask)];
+  }
+
+  /** Hands the slot from beginPush() to the consumer. */
+  inline void push()
+  {
+    mHead.storeRelease(mHead.loadAcquire() + 1);
+  }
+
+  /** Counts a report the producer had no slot for. */
+  inline void drop()
+  {
+    mDropped.fetchAndAddRelaxed(1);
+  }
+
+  /** The oldest report, or nullptr if the queue is empty. */
+  inline const QHidReport* front() const
+  {
+    const quint32 tail = mTail.loadAcquire();
+
+    if (tail == mHead.loadAcquire()) {
+      return nullptr;
+    }
+
+    return &mSlots[int(tail & mMask)];
+  }
+
+  /** Gives the slot from front() back to the producer. */
+  inline void pop()
+  {
+    mTail.storeRelease(mTail.loadAcquire() + 1);
+  }
+
+  bool tryPop(QHidReport& report);
+
+private:
+  Q_DISABLE_COPY(QHidReportQueue)
+
+  QVector<QHidReport> mSlots;
+  quint32 mMask;
+  // the producer's and consumer's counters on cache lines of their own.
+  char mPadding0[64];
+  QAtomicInteger<quint32> mHead;
+  char mPadding1[64];
+  QAtomicInteger<quint32> mTail;
+  char mPadding2[64];
+  QAtomicInteger<quint32> mDropped;
+};
+
+#endif // QHIDREPORTQUEUE_H
@@ -0,0 +1,276 @@
+/*
+  Copyright 2020 Simon Meaden
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+  of the Software, and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  @author: Simon Meaden
+
+*/
+#include "qhidusagemap.h"
+
+// the widest value that is read or written, as the values are qint32.
+static const int MAX_VALUE_BITS = 32;
+
+/*
+   Reads bitSize bits from bit into raw, returning false if they run past the
+   end of report.
+*/
+static bool extract(const QByteArray& report, quint32 bit, int bitSize, quint64* raw)
+{
+  const int first = int(bit / 8);
+  const int last = int((bit + quint32(bitSize) - 1) / 8);
+
+  if (last >= report.size()) {
+    return false;
+  }
+
+  quint64 word = 0;
+
+  for (int i = last; i >= first; i--) {
+    word = (word << 8) | uchar(report.at(i));
+  }
+
+  *raw = (word >> (bit % 8)) & ((Q_UINT64_C(1) << bitSize) - 1);
+  return true;
+}
+
+static inline qint32 signExtend(quint64 raw, int bitSize)
+{
+  return qint32(qint64(raw << (64 - bitSize)) >> (64 - bitSize));
+}
+
+QHidUsageMap::QHidUsageMap() :
+  mInputReports(256)
+{
+}
+
+QHidUsageMap::QHidUsageMap(const QHidReportDescriptor& descriptor) :
+  mDescriptor(descriptor),
+  mInputReports(256),
+  mOutputEncoder(descriptor, QHidReportField::OutputReport),
+  mFeatureEncoder(descriptor, QHidReportField::FeatureReport)
+{
+}
+
+bool QHidUsageMap::isValid() const
+{
+  return mDescriptor.isValid();
+}
+
+/*
+   The handle of the value with usagePage and usage in a report of type, or
+   -1 if there is none. A usage in the range of an input Array field resolves to
+   that field, and reads as 1 while the usage is in the report and 0 when it
+   isn't.
+*/
+int QHidUsageMap::resolve(QHidReportField::ReportType type, ushort usagePage, ushort usage)
+{
+  const quint64 key = (quint64(type) << 32) | (quint64(usagePage) << 16) | usage;
+  QHash<quint64, int>::const_iterator it = mHandles.constFind(key);
+
+  if (it != mHandles.constEnd()) {
+    return it.value();
+  }
+
+  if (type != QHidReportField::InputReport) {
+    // output and feature values are the encoder's, which has its own index.
+    const int op = encoder(type)->opIndex(usagePage, usage);
+    int handle = -1;
+
+    if (op >= 0) {
+      Location location;
+      location.type = type;
+      location.reportId = encoder(type)->ops().at(op).reportId;
+      location.isSigned = false;
+      location.isArray = false;
+      location.bitSize = 0;
+      location.count = 0;
+      location.bit = 0;
+      location.index = op;
+
+      handle = mLocations.size();
+      mLocations.append(location);
+    }
+
+    mHandles.insert(key, handle);
+    return handle;
+  }
+
+  // input reports only start with the id if the device numbers its reports.
+  const quint32 idBits = mDescriptor.usesReportIds() ? 8 : 0;
+  int handle = -1;
+
+  for (const QHidReportField& field : mDescriptor.fields()) {
+    if (field.type != type || field.usagePage != usagePage
+        || (field.flags & QHidReportField::Constant)
+        || field.bitSize == 0 || field.bitSize > MAX_VALUE_BITS) {
+      continue;
+    }
+
+    Location location;
+    location.type = type;
+    location.reportId = field.reportId;
+    location.isSigned = field.isSigned();
+    location.bitSize = field.bitSize;
+    location.bit = idBits + field.bitOffset;
+
+    if (field.flags & QHidReportField::Variable) {
+      if (field.usage != usage) {
+        continue;
+      }
+
+      location.isArray = false;
+      location.count = 1;
+      location.index = 0;
+
+    } else {
+      if (usage < field.usage || usage > field.usageMaximum) {
+        continue;
+      }
+
+      location.isArray = true;
+      location.count = field.count;
+      location.index = field.logicalMinimum + (usage - field.usage);
+    }
+
+    handle = mLocations.size();
+    mLocations.append(location);
+    break;
+  }
+
+  // usages that aren't there are remembered too.
+  mHandles.insert(key, handle);
+
+  return handle;
+}
+
+/*
+   The type of the report the value of handle is in.
+*/
+QHidReportField::ReportType QHidUsageMap::type(int handle) const
+{
+  return mLocations.at(handle).type;
+}
+
+/*
+   Keeps report as the last input report of its report id.
+*/
+void QHidUsageMap::setInputReport(const QByteArray& report)
+{
+  if (report.isEmpty()) {
+    return;
+  }
+
+  mInputReports[mDescriptor.usesReportIds() ? uchar(report.at(0)) : 0] = report;
+}
+
+/*
+   The value of handle in the last input report, or in the output or feature
+   report buffer. ok is set false if the handle is invalid or there is no
+   report yet.
+*/
+qint32 QHidUsageMap::value(int handle, bool* ok) const
+{
+  if (ok != nullptr) {
+    *ok = false;
+  }
+
+  if (handle < 0 || handle >= mLocations.size()) {
+    return 0;
+  }
+
+  const Location& location = mLocations.at(handle);
+
+  if (location.type != QHidReportField::InputReport) {
+    if (ok != nullptr) {
+      *ok = true;
+    }
+
+    return (location.type == QHidReportField::OutputReport ? mOutputEncoder : mFeatureEncoder)
+           .value(location.index);
+  }
+
+  const QByteArray& report = mInputReports.at(location.reportId);
+  qint32 result = 0;
+
+  for (int v = 0; v < location.count; v++) {
+    quint64 raw;
+
+    if (!extract(report, location.bit + quint32(v) * location.bitSize, location.bitSize, &raw)) {
+      return 0;
+    }
+
+    qint32 value = location.isSigned ? signExtend(raw, location.bitSize) : qint32(raw);
+
+    if (!location.isArray) {
+      result = value;
+      break;
+    }
+
+    if (value == location.index) {
+      result = 1;
+      break;
+    }
+  }
+
+  if (ok != nullptr) {
+    *ok = true;
+  }
+
+  return result;
+}
+
+/*
+   Writes value to handle in its output or feature report, clamped to the
+   logical range of its field, and returns the report id, or -1 if the handle
+   is invalid or an input value. The report is then in encoder().
+*/
+int QHidUsageMap::setValue(int handle, qint32 value)
+{
+  if (handle < 0 || handle >= mLocations.size()) {
+    return -1;
+  }
+
+  const Location& location = mLocations.at(handle);
+
+  if (location.type == QHidReportField::InputReport) {
+    return -1;
+  }
+
+  encoder(location.type)->setValue(location.index, value);
+
+  return location.reportId;
+}
+
+/*
+   The encoder of the output or feature reports, or nullptr for input.
+*/
+QHidReportEncoder* QHidUsageMap::encoder(QHidReportField::ReportType type)
+{
+  switch (type) {
+  case QHidReportField::OutputReport:
+    return &mOutputEncoder;
+
+  case QHidReportField::FeatureReport:
+    return &mFeatureEncoder;
+
+  default:
+    return nullptr;
+  }
+}
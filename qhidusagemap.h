@@ -0,0 +1,84 @@
+/*
+  Copyright 2020 Simon Meaden
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+  of the Software, and to permit persons to whom the Software is furnished to do so,
+  subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+
+  @author: Simon Meaden
+
+*/
+#ifndef QHIDUSAGEMAP_H
+#define QHIDUSAGEMAP_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QVector>
+
+#include "qhidreportdescriptor.h"
+#include "qhidreportencoder.h"
+
+/*
+   The values of one open device, addressed by usage.
+
+   A usage is resolved against the device's descriptor the first time it is
+   asked for, into a handle indexing a table of bit locations, and the
+   resolution is kept, so later lookups of the same usage are a hash lookup
+   and a handle is an array index.
+
+   Input values are read from the last input report of each report id passed
+   to setInputReport(). Output and feature values are written by an encoder
+   for each, which keeps the values set before so that a report can be built
+   up a value at a time and sent whole.
+*/
+class QHidUsageMap
+{
+public:
+  QHidUsageMap();
+  explicit QHidUsageMap(const QHidReportDescriptor& descriptor);
+
+  bool isValid() const;
+  int resolve(QHidReportField::ReportType type, ushort usagePage, ushort usage);
+  QHidReportField::ReportType type(int handle) const;
+
+  void setInputReport(const QByteArray& report);
+  qint32 value(int handle, bool* ok = nullptr) const;
+  int setValue(int handle, qint32 value);
+  QHidReportEncoder* encoder(QHidReportField::ReportType type);
+
+private:
+  struct Location {
+    QHidReportField::ReportType type;
+    quint8 reportId;
+    bool isSigned;
+    bool isArray;
+    quint16 bitSize;
+    quint16 count;     // values to search for an Array field, otherwise 1.
+    quint32 bit;       // offset of the first value, including any report id byte.
+    qint32 index;      // the value an Array field holds while the usage is active,
+                       // or the encoder op of an output or feature value.
+  };
+
+  QHidReportDescriptor mDescriptor;
+  QHash<quint64, int> mHandles;         // type, usage page and usage -> handle, or -1.
+  QVector<Location> mLocations;         // handle -> location.
+  QVector<QByteArray> mInputReports;    // report id -> last input report.
+  QHidReportEncoder mOutputEncoder;
+  QHidReportEncoder mFeatureEncoder;
+};
+
+#endif // QHIDUSAGEMAP_H
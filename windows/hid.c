@@ -58,6 +58,8 @@ extern "C" {
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
 
 
 #include "hidapi.h"
@@ -134,6 +136,21 @@ struct hid_device_ {
 		BOOL read_pending;
 		char *read_buf;
 		OVERLAPPED ol;
+		/* Microseconds a read spins before sleeping, and the spin
+		   counters. Accessed with the Interlocked functions, as they
+		   are set and read from any thread. */
+		volatile LONG spin_budget_us;
+		volatile LONG64 spin_hits;
+		volatile LONG64 spin_sleeps;
+		volatile LONG64 spin_ns;
+		/* An auto-reset event hid_cancel_read() sets, which reads wait
+		   on alongside ol.hEvent. */
+		HANDLE cancel_event;
+		/* The hid_set_input_report_callback() function and its context,
+		   only set and called under callback_lock. */
+		hid_input_report_callback input_callback;
+		void *input_callback_context;
+		CRITICAL_SECTION callback_lock;
 };
 
 static hid_device *new_hid_device()
@@ -147,8 +164,16 @@ static hid_device *new_hid_device()
 	dev->last_error_num = 0;
 	dev->read_pending = FALSE;
 	dev->read_buf = NULL;
+	dev->spin_budget_us = 0;
+	dev->spin_hits = 0;
+	dev->spin_sleeps = 0;
+	dev->spin_ns = 0;
 	memset(&dev->ol, 0, sizeof(dev->ol));
 	dev->ol.hEvent = CreateEvent(NULL, FALSE, FALSE /*inital state f=nonsignaled*/, NULL);
+	dev->cancel_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+	dev->input_callback = NULL;
+	dev->input_callback_context = NULL;
+	InitializeCriticalSection(&dev->callback_lock);
 
 	return dev;
 }
@@ -156,7 +181,9 @@ static hid_device *new_hid_device()
 static void free_hid_device(hid_device *dev)
 {
 	CloseHandle(dev->ol.hEvent);
+	CloseHandle(dev->cancel_event);
 	CloseHandle(dev->device_handle);
+	DeleteCriticalSection(&dev->callback_lock);
 	LocalFree(dev->last_error_str);
 	free(dev->read_buf);
 	free(dev);
@@ -475,6 +502,18 @@ struct hid_device_info HID_API_EXPORT * HID_API_CALL hid_enumerate(unsigned shor
 					}
 				}
 			}
+
+			/* Bus Type. As with the interface, the path is the only
+			   place it can be read from. Bluetooth devices carry the
+			   HID service UUID instead of the USB VID/PID. */
+			cur_dev->bus_type = HID_BUS_UNKNOWN;
+			if (cur_dev->path) {
+				if (strstr(cur_dev->path, "{00001124-0000-1000-8000-00805f9b34fb}") ||
+				    strstr(cur_dev->path, "{00001812-0000-1000-8000-00805f9b34fb}"))
+					cur_dev->bus_type = HID_BUS_BLUETOOTH;
+				else if (strstr(cur_dev->path, "hid#vid_"))
+					cur_dev->bus_type = HID_BUS_USB;
+			}
 		}
 
 cont_close:
@@ -494,6 +533,68 @@ cont:
 
 }
 
+struct hid_device_info HID_API_EXPORT * HID_API_CALL hid_enumerate_ex(unsigned short vendor_id, unsigned short product_id, int flags)
+{
+	/* The strings are read through the handle which enumeration has
+	   to open anyway for the VID/PID, so there is nothing to gain by
+	   deferring them. */
+	(void) flags;
+
+	return hid_enumerate(vendor_id, product_id);
+}
+
+struct hid_device_info HID_API_EXPORT * HID_API_CALL hid_enumerate_filtered(const struct hid_enumerate_filter *filter, int flags)
+{
+	struct hid_device_info *root;
+	struct hid_device_info **link;
+
+	/* Every field the filter looks at comes from the handle which
+	   enumeration opens for the VID/PID, so the list is filtered after
+	   it is built. */
+	root = hid_enumerate_ex(filter->vendor_id, filter->product_id, flags);
+
+	link = &root;
+	while (*link) {
+		struct hid_device_info *d = *link;
+		int matches = 1;
+
+		if ((filter->match & HID_FILTER_USAGE_PAGE) && filter->usage_page != d->usage_page)
+			matches = 0;
+		if ((filter->match & HID_FILTER_USAGE) && filter->usage != d->usage)
+			matches = 0;
+		if ((filter->match & HID_FILTER_INTERFACE) && filter->interface_number != d->interface_number)
+			matches = 0;
+		if ((filter->match & HID_FILTER_BUS_TYPE) && filter->bus_type != d->bus_type)
+			matches = 0;
+		if ((filter->match & HID_FILTER_SERIAL_PREFIX) && filter->serial_prefix &&
+		    (!d->serial_number ||
+		     wcsncmp(d->serial_number, filter->serial_prefix, wcslen(filter->serial_prefix)) != 0))
+			matches = 0;
+
+		if (matches) {
+			link = &d->next;
+		}
+		else {
+			*link = d->next;
+			d->next = NULL;
+			hid_free_enumeration(d);
+		}
+	}
+
+	return root;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_get_device_info_strings(struct hid_device_info *info)
+{
+	/* hid_enumerate_ex() always tries to fill in the strings. A NULL
+	   here means the device refused them during enumeration. */
+	if (!info || !info->serial_number ||
+	    !info->manufacturer_string || !info->product_string)
+		return -1;
+
+	return 0;
+}
+
 void  HID_API_EXPORT HID_API_CALL hid_free_enumeration(struct hid_device_info *devs)
 {
 	/* TODO: Merge this with the Linux version. This function is platform-independent. */
@@ -659,20 +760,81 @@ end_of_function:
 }
 
 
+/* Passes a report to the device's input report callback, if it has one.
+   Returns TRUE if it did, and FALSE if the report is for the caller. */
+static BOOL call_input_callback(hid_device *dev, const unsigned char *data, size_t length)
+{
+	BOOL called = FALSE;
+
+	if (InterlockedCompareExchangePointer((PVOID volatile *) &dev->input_callback, NULL, NULL) == NULL)
+		return FALSE;
+
+	EnterCriticalSection(&dev->callback_lock);
+	if (dev->input_callback) {
+		dev->input_callback(dev->input_callback_context, dev, data, length);
+		called = TRUE;
+	}
+	LeaveCriticalSection(&dev->callback_lock);
+
+	return called;
+}
+
+/* Busy waits for up to the device's spin budget, or *milliseconds if that is
+   shorter, for the pending read to complete. If it doesn't, the time spent is
+   taken off *milliseconds. */
+static void spin_for_report(hid_device *dev, LONG budget_us, int *milliseconds)
+{
+	LARGE_INTEGER frequency, start, now;
+	LONGLONG budget_ns = budget_us * 1000LL;
+	LONGLONG elapsed_ns;
+	BOOL ready;
+
+	if (*milliseconds > 0 && *milliseconds * 1000000LL < budget_ns)
+		budget_ns = *milliseconds * 1000000LL;
+
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&start);
+
+	do {
+		ready = HasOverlappedIoCompleted(&dev->ol);
+		if (!ready)
+			YieldProcessor();
+		QueryPerformanceCounter(&now);
+		elapsed_ns = (now.QuadPart - start.QuadPart) * 1000000000LL / frequency.QuadPart;
+	} while (!ready && elapsed_ns < budget_ns);
+
+	InterlockedExchangeAdd64(&dev->spin_ns, elapsed_ns);
+
+	if (ready) {
+		InterlockedIncrement64(&dev->spin_hits);
+		return;
+	}
+
+	InterlockedIncrement64(&dev->spin_sleeps);
+	if (*milliseconds > 0) {
+		*milliseconds -= (int) (elapsed_ns / 1000000);
+		if (*milliseconds < 0)
+			*milliseconds = 0;
+	}
+}
+
 int HID_API_EXPORT HID_API_CALL hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds)
 {
 	DWORD bytes_read = 0;
 	size_t copy_len = 0;
 	BOOL res;
+	LONG budget_us = InterlockedCompareExchange(&dev->spin_budget_us, 0, 0);
 
-	/* Copy the handle for convenience. */
-	HANDLE ev = dev->ol.hEvent;
+	/* The cancel event comes first, so that a cancel wins over a report
+	   which is also ready. */
+	HANDLE events[2] = { dev->cancel_event, dev->ol.hEvent };
+	DWORD wait;
 
 	if (!dev->read_pending) {
 		/* Start an Overlapped I/O read. */
 		dev->read_pending = TRUE;
 		memset(dev->read_buf, 0, dev->input_report_length);
-		ResetEvent(ev);
+		ResetEvent(dev->ol.hEvent);
 		res = ReadFile(dev->device_handle, dev->read_buf, dev->input_report_length, &bytes_read, &dev->ol);
 		
 		if (!res) {
@@ -686,25 +848,44 @@ int HID_API_EXPORT HID_API_CALL hid_read_timeout(hid_device *dev, unsigned char
 		}
 	}
 
-	if (milliseconds >= 0) {
-		/* See if there is any data yet. */
-		res = WaitForSingleObject(ev, milliseconds);
-		if (res != WAIT_OBJECT_0) {
-			/* There was no data this time. Return zero bytes available,
-			   but leave the Overlapped I/O running. */
-			return 0;
-		}
+	/* Once the read completes, the event is set and the wait below returns
+	   at once. */
+	if (milliseconds != 0 && budget_us > 0)
+		spin_for_report(dev, budget_us, &milliseconds);
+
+	/* See if there is any data yet. A timeout of -1 waits here too, rather
+	   than in GetOverlappedResult(), so that hid_cancel_read() can end it. */
+	wait = WaitForMultipleObjects(2, events, FALSE, milliseconds >= 0 ? (DWORD) milliseconds : INFINITE);
+	if (wait == WAIT_OBJECT_0) {
+		/* The read was cancelled. Leave the Overlapped I/O running for
+		   the next read. */
+		return HID_READ_CANCELLED;
+	}
+	if (wait != WAIT_OBJECT_0 + 1) {
+		/* There was no data this time. Return zero bytes available,
+		   but leave the Overlapped I/O running. */
+		return 0;
 	}
 
-	/* Either WaitForSingleObject() told us that ReadFile has completed, or
-	   we are in non-blocking mode. Get the number of bytes read. The actual
-	   data has been copied to the data[] array which was passed to ReadFile(). */
+	/* WaitForMultipleObjects() told us that ReadFile has completed. Get the
+	   number of bytes read. The actual data has been copied to the data[]
+	   array which was passed to ReadFile(). */
 	res = GetOverlappedResult(dev->device_handle, &dev->ol, &bytes_read, TRUE/*wait*/);
 	
 	/* Set pending back to false, even if GetOverlappedResult() returned error. */
 	dev->read_pending = FALSE;
 
 	if (res && bytes_read > 0) {
+		/* Skipping the report number Windows adds, as below. */
+		unsigned char *report = (unsigned char *) dev->read_buf;
+		DWORD report_len = bytes_read;
+		if (report[0] == 0x0) {
+			report++;
+			report_len--;
+		}
+		if (call_input_callback(dev, report, report_len))
+			return 0;
+
 		if (dev->read_buf[0] == 0x0) {
 			/* If report numbers aren't being used, but Windows sticks a report
 			   number (0x0) on the beginning of the report anyway. To make this
@@ -741,6 +922,58 @@ int HID_API_EXPORT HID_API_CALL hid_set_nonblocking(hid_device *dev, int nonbloc
 	return 0; /* Success */
 }
 
+int HID_API_EXPORT HID_API_CALL hid_set_spin_budget(hid_device *dev, int microseconds)
+{
+	if (microseconds < 0) {
+		SetLastError(ERROR_INVALID_PARAMETER);
+		register_error(dev, "hid_set_spin_budget");
+		return -1;
+	}
+
+	InterlockedExchange(&dev->spin_budget_us, microseconds);
+	return 0;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_get_spin_stats(hid_device *dev, struct hid_spin_stats *stats)
+{
+	if (!stats) {
+		SetLastError(ERROR_INVALID_PARAMETER);
+		register_error(dev, "hid_get_spin_stats");
+		return -1;
+	}
+
+	stats->spin_hits = InterlockedCompareExchange64(&dev->spin_hits, 0, 0);
+	stats->sleeps = InterlockedCompareExchange64(&dev->spin_sleeps, 0, 0);
+	stats->spin_us = InterlockedCompareExchange64(&dev->spin_ns, 0, 0) / 1000;
+	return 0;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_cancel_read(hid_device *dev)
+{
+	if (!SetEvent(dev->cancel_event)) {
+		register_error(dev, "hid_cancel_read");
+		return -1;
+	}
+	return 0;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_set_input_report_callback(hid_device *dev, hid_input_report_callback callback, void *context)
+{
+	EnterCriticalSection(&dev->callback_lock);
+	dev->input_callback_context = context;
+	InterlockedExchangePointer((PVOID volatile *) &dev->input_callback, (PVOID) callback);
+	LeaveCriticalSection(&dev->callback_lock);
+	return 0;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_get_read_fd(hid_device *dev)
+{
+	/* Reads complete through overlapped I/O, there is nothing to poll. */
+	SetLastError(ERROR_NOT_SUPPORTED);
+	register_error(dev, "hid_get_read_fd");
+	return -1;
+}
+
 int HID_API_EXPORT HID_API_CALL hid_send_feature_report(hid_device *dev, const unsigned char *data, size_t length)
 {
 	BOOL res = HidD_SetFeature(dev->device_handle, (PVOID)data, length);
@@ -801,11 +1034,59 @@ int HID_API_EXPORT HID_API_CALL hid_get_feature_report(hid_device *dev, unsigned
 #endif
 }
 
+int HID_API_EXPORT HID_API_CALL hid_get_device_ids(hid_device *dev, unsigned short *vendor_id, unsigned short *product_id)
+{
+	HIDD_ATTRIBUTES attrib;
+
+	attrib.Size = sizeof(HIDD_ATTRIBUTES);
+	if (!HidD_GetAttributes(dev->device_handle, &attrib)) {
+		register_error(dev, "HidD_GetAttributes");
+		return -1;
+	}
+
+	*vendor_id = attrib.VendorID;
+	*product_id = attrib.ProductID;
+	return 0;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_get_report_descriptor(hid_device *dev, unsigned char *buf, size_t buf_size)
+{
+	/* Windows only hands out the parsed form of the descriptor, through
+	   HidD_GetPreparsedData(), never the descriptor itself. */
+	(void) buf;
+	(void) buf_size;
+	SetLastError(ERROR_NOT_SUPPORTED);
+	register_error(dev, "hid_get_report_descriptor");
+	return -1;
+}
+
+void HID_API_EXPORT HID_API_CALL hid_shutdown(hid_device *dev)
+{
+	if (!dev || !dev->read_pending)
+		return;
+
+	/* CancelIo() only cancels I/O started by the calling thread, and the
+	   read may have been started by another. The cancel isn't waited for
+	   here, so that the reads of many devices are cancelled together, and
+	   hid_close() waits for it. */
+	CancelIoEx(dev->device_handle, &dev->ol);
+}
+
 void HID_API_EXPORT HID_API_CALL hid_close(hid_device *dev)
 {
+	DWORD bytes_read;
+
 	if (!dev)
 		return;
-	CancelIo(dev->device_handle);
+
+	/* Until the cancel completes the kernel may still write to read_buf
+	   and signal ol.hEvent, which are freed below. */
+	if (dev->read_pending) {
+		CancelIoEx(dev->device_handle, &dev->ol);
+		GetOverlappedResult(dev->device_handle, &dev->ol, &bytes_read, TRUE/*wait*/);
+		dev->read_pending = FALSE;
+	}
+
 	free_hid_device(dev);
 }
 